@@ -0,0 +1,35 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Recorded start cost from which an entry is reported as expensive */
+#define AUDIT_CPU_MS 1000
+#define AUDIT_RSS_KB (256 * 1024)
+
+enum AuditKind {
+  AUDIT_DIR,       // counts of one directory, sorted first
+  AUDIT_INVALID,   // not an application entry with Name and Exec
+  AUDIT_TRYEXEC,   // TryExec program missing, entry skipped
+  AUDIT_MISSING,   // launched, but its program is not found
+  AUDIT_DUPLICATE, // launches the same program as another entry
+  AUDIT_FAILING,   // failed its last starts
+  AUDIT_EXPENSIVE, // costly start in the user's history
+  AUDIT_KINDS,
+};
+
+/* One finding, or the counts of a directory, as sent by a worker */
+struct AuditRecord {
+  int home; // index among the audited homes, -1 for system directories
+  enum AuditKind kind;
+  long value[3]; // AUDIT_DIR: files (-1 missing, -2 blocked), valid,
+                 // launched; otherwise kind specific
+  char id[256];  // desktop file ID, the directory for AUDIT_DIR
+  char detail[256];
+};
+
+int audit_run(FILE *out, const char *const *roots, size_t count,
+              const char *config_path, int jobs);
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef AUTOSTART_H
+#define AUTOSTART_H
+
+#include "config.h"
+#include "dbus.h"
+#include "history.h"
+#include "perfstat.h"
+#include "reactor.h"
+#include "running.h"
+#include "scan.h"
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define MAX_PATH 2048
+#define MAX_SYSTEM_DIRS 8
+#define TERMINAL_SERVER_WAIT_MS 2000
+#define TERMINAL_SERVER_POLL_MS 20
+#define PERF_HOLD_MS 2000      // time an app gets to stop before exec
+#define PERF_HOLD_SLACK_MS 500 // waited beyond, for stops just in time
+
+struct DesktopEntry {
+  char id[256]; // desktop file ID
+  char name[256];
+  char exec[1024];
+  char tryexec[256];
+  char icon[256];
+  char path[1024];
+  int terminal;
+  int hidden;
+  int nodisplay;
+  int dbus_activatable;
+  int valid;
+};
+
+struct Array {
+  char **values;
+  size_t count;
+  size_t capacity;
+};
+
+struct AppQueue {
+  struct DesktopEntry *apps;
+  size_t count;
+  size_t capacity;
+};
+
+/* A launched process tracked in supervise mode */
+struct Child {
+  pid_t pid;
+  int pidfd; // -1 without pidfd support
+  struct ReactorSource *watch; // pidfd in the session reactor
+  int exited;
+  int status; // wait status, -1 if reaped elsewhere
+  long started_ms, exited_ms; // CLOCK_MONOTONIC
+  long cpu_ms, rss_kb;        // cost of the start, -1 until sampled
+  int background;             // not critical, may be reclaimed when idle
+  int reclaimed;
+  int reclaiming;                  // memory.reclaim steps in progress
+  long reclaim_left_kb, reclaim_freed_kb;
+  long idle_since_ms, idle_cpu_ms; // start and CPU time of the idle period
+  struct PerfStat perf;            // cold start counters (perf_window)
+  long held_until_ms; // its stop before exec is waited for until then,
+                      // 0 once it went on
+  int held_late;      // not stopped in time, goes on uncounted
+  char name[256];
+  char id[256]; // desktop file ID, empty for helpers
+};
+
+struct ChildList {
+  struct Child *items;
+  size_t count;
+  size_t capacity;
+};
+
+enum SessionEvent {
+  EVENT_QUEUED,
+  EVENT_SKIPPED,
+  EVENT_LAUNCHED,
+  EVENT_FAILED,
+};
+
+enum TerminalServer {
+  TERM_SERVER_NONE,     // not started
+  TERM_SERVER_STARTING, // started, not listening yet
+  TERM_SERVER_READY,
+  TERM_SERVER_FAILED, // Terminal=true entries use the plain terminal
+};
+
+enum SkipReason {
+  SKIP_NONE,
+  SKIP_HIDDEN,
+  SKIP_CONFIG,
+  SKIP_TRYEXEC,
+  SKIP_RUNNING,
+  SKIP_QUARANTINED,
+  SKIP_DBUS,
+  SKIP_CLOSED,
+};
+
+typedef void (*session_event_fn)(void *userdata, enum SessionEvent event,
+                                 const struct DesktopEntry *de, pid_t pid);
+
+/* All state of one scan/filter/launch run, no globals involved */
+struct Session {
+  struct Config cfg;
+  struct AppQueue queue;
+  struct AppQueue closed; // skipped as closed in the last session
+  size_t held_from; // first quarantined entry, launched once the ones
+                    // before it started (0 if none)
+  struct Array dirs;
+  enum TerminalServer terminal_server;
+  pid_t terminal_server_pid;
+  long terminal_server_started_ms;
+  struct ReactorSource *terminal_exit; // server pidfd while starting
+  struct ProcIndex running; // built on first use when skip_running is set
+  int running_indexed;
+  struct BusNames bus_names; // asked once, for dbus:ping entries
+  int bus_listed;
+  int ignore_running; // plans for a later login (unit generation)
+  int supervise;      // track launched children for teardown
+  int stopping;       // supervise mode: stop requested
+  struct ReactorSource *ctl; // supervise mode: control socket
+  int ctl_client;            // stop requester awaiting the reply, -1 none
+  struct CtlClient *ctl_clients; // connections yet to send their request
+  struct Reactor reactor;
+  struct Scan scan; // directory workers, pending ones may merge late
+  char reclaim_cgroup[PATH_MAX]; // delegated cgroup background apps get
+                                 // leaves in, "" to use process_madvise
+  int boosting;     // startup boost of critical apps running
+  struct ReactorSource *boost_timer;
+  struct ReactorSource *perf_timer; // reads counters at window ends
+  struct ReactorSource *perf_stops; // SIGCHLD, held apps stopped
+  sigset_t perf_mask;               // signal mask before perf_watch()
+  int perf_off;                     // counters not available here
+  struct ChildList children;
+  struct History history; // loaded by run_session only
+  const char *home;       // run_session only: where the history is saved
+  const char *data_home;  // audit: data directory of the audited user,
+                          // "" for none; NULL for the caller's
+  int judge_starts;       // track launched children for the history
+
+  FILE *out; // progress output, NULL to stay quiet
+  session_event_fn on_event;
+  void *userdata;
+};
+
+extern const char *const system_autostart_dirs[];
+
+/* queue */
+void app_queue_init(struct AppQueue *a);
+void app_queue_add(struct AppQueue *a, struct DesktopEntry entry);
+
+/* scanning */
+struct Tokenizer;
+int parse_desktop_file(const char *filename, struct DesktopEntry *entry);
+int parse_desktop_entry(struct Tokenizer *t, const char *filename,
+                        struct DesktopEntry *entry);
+int parse_autostart_dir(const char *autostart_dir, struct AppQueue *out);
+int parse_autostart_files(const char *autostart_dir, struct AppQueue *out,
+                          int *found);
+int check_tryexec(const char *tryexec);
+
+/* launching */
+struct SpawnAttr;
+pid_t run_command(const char *exec_cmd, const char *work_dir,
+                  const struct SpawnAttr *attr, int *pidfd);
+
+/* session */
+int session_init(struct Session *s, FILE *out);
+void session_free(struct Session *s);
+struct AppRule *entry_rule(struct Config *cfg, const struct DesktopEntry *de);
+enum SkipReason entry_skip_reason(struct Session *s,
+                                  const struct DesktopEntry *de);
+const char *skip_reason_str(enum SkipReason reason);
+void session_record_alive(struct Session *s);
+int queue_entry(struct Session *s, const struct DesktopEntry *de);
+int scan_autostart_dir(struct Session *s, const char *autostart_dir,
+                       int dir_index);
+void prefetch_queued_assets(struct Session *s, const char *home);
+int launch_queued_apps(struct Session *s);
+void boost_finish(struct Session *s);
+
+/* pipeline */
+int run_session(const char *home, const char *config_path, int admission,
+                int supervise);
+int generate_session(const char *home, const char *config_path,
+                     const char *dir);
+int report_session(const char *home, const char *config_path);
+struct SimHost;
+int simulate_session(const char *home, const char *config_path,
+                     const struct SimHost *host);
+
+#endif
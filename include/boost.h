@@ -0,0 +1,12 @@
+#ifndef BOOST_H
+#define BOOST_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Utilization clamp scale: 1024 is the full capacity of the biggest CPU */
+#define UCLAMP_SCALE 1024
+
+size_t boost_release(const pid_t *sessions, size_t count);
+
+#endif
@@ -1,19 +1,58 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "dirtrie.h"
+#include "match.h"
 #include <limits.h>
 
-#define MAX_CFG_APPS 128
-#define MAX_CFG_DIRS 32
+#define MAX_APP_ENV 4
+
+/* What a pattern rule is matched against */
+enum MatchField {
+  FIELD_NAME, // Name= of the entry
+  FIELD_ID,   // desktop file ID (file name)
+  FIELD_EXEC, // basename of the Exec program
+  MATCH_FIELDS,
+};
+
+/* What happens to entries that keep failing at startup */
+enum Quarantine {
+  QUARANTINE_OFF,
+  QUARANTINE_SKIP, // not launched at all
+  QUARANTINE_LAST, // launched after every other entry
+};
+
+/* What happens to entries closed before the last supervised session ended */
+enum Restore {
+  RESTORE_OFF,   // launched like any other entry
+  RESTORE_DEFER, // launched after every other entry
+  RESTORE_SKIP,  // not launched until the user starts them again
+};
+
+/* How DBusActivatable=true entries are started */
+enum DbusPolicy {
+  DBUS_LAUNCH, // spawned at login like any other entry
+  DBUS_DEFER,  // left to bus activation if a .service file exists
+  DBUS_PING,   // left to bus activation if the session bus lists the name
+};
 
 struct AppRule {
-  char name[256];
+  const char *name; // exact name or pattern
+  enum MatchKind kind;
+  enum MatchField field;
   int allow;
   int delay_ms; // -1 если нет
+  int nice;
+  int dbus; // enum DbusPolicy, -1 for the [general] default
+  int critical; // boosted during its cold start
+  int ksm;      // memory mergeable by ksmd
+  int always;   // launched eagerly whatever the restore policy
+  int env_count; // ahead of env, which leaves no padding in the rule
+  const char *env[MAX_APP_ENV];
 };
 
 struct DirRule {
-  char path[PATH_MAX];
+  const char *path; // directory tree, components may be globs
   int allow;
 };
 
@@ -21,23 +60,65 @@ struct Config {
   int startup_delay_ms;
   int delay_ms;
 
+  int prefetch;
+  int system_cache;
+  int skip_running;
+  int stop_timeout_ms; // supervise mode: SIGTERM to SIGKILL
+  int scan_timeout_ms; // per-directory scan deadline, 0 scans inline
+  enum Quarantine quarantine;
+  int quarantine_after; // failed sessions in a row
+  int quarantine_retry_s; // quarantined entries are retried this long
+                          // after their last start, 0 never
+  enum Restore restore;
+  int crash_window_ms;  // exits before this count as failed starts
+  enum DbusPolicy dbus_activation;
+  int boost_time_ms;     // critical apps boosted this long, 0 disables
+  int background_uclamp; // uclamp.max of other apps meanwhile
+  int reclaim_idle_s;    // supervise mode: page out idle apps, 0 disables
+  int perf_window_ms;    // count each app's cold start this long, 0 disables
+  char icon_theme[256];
+
+  char terminal[256];
+  char terminal_server[256];
+  char terminal_client[256];
+
   int log_level;
   char log_file[PATH_MAX];
 
-  struct AppRule apps[MAX_CFG_APPS];
+  // Rule strings point into the loaded files (or are literals when
+  // baked); capacities are 0 when the arrays are not owned
+  struct AppRule *apps;
   int app_count;
+  int app_capacity;
+  int *app_index;          // rules by key, open addressing, -1 empty
+  unsigned app_index_mask; // slots - 1
+
+  struct Matcher *matchers[MATCH_FIELDS]; // pattern rules, per field
 
-  struct DirRule dirs[MAX_CFG_DIRS];
+  struct DirRule *dirs;
   int dir_count;
+  int dir_capacity;
+  struct DirTrie *dir_trie; // compiled dirs
+
+  char **texts; // loaded files
+  int text_count;
 };
 
 /* lifecycle */
 void config_init(struct Config *cfg);
 int config_load(struct Config *cfg, const char *path);
+int config_compile(struct Config *cfg);
+void config_free(struct Config *cfg);
 void print_config(const struct Config *cfg);
 
 /* lookup */
 struct AppRule *config_find_app(struct Config *cfg, const char *name);
+struct AppRule *config_match_app(struct Config *cfg, const char *name,
+                                 const char *id, const char *exec);
+int config_app_delay(struct Config *cfg, const struct AppRule *rule,
+                     int first);
+enum DbusPolicy config_app_dbus(const struct Config *cfg,
+                                const struct AppRule *rule);
 int config_dir_blocked(struct Config *cfg, const char *path);
 
 #endif
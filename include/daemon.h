@@ -0,0 +1,24 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#define DAEMON_SOCKET "/run/autostart.sock"
+#define DAEMON_REQUEST "launch\n"
+
+/* A request must be complete this long after connecting */
+#define DAEMON_REQUEST_TIMEOUT_MS 2000
+/* A launcher gives its slot back after its launch, at the latest then */
+#define DAEMON_SLOT_TIMEOUT_MS 60000
+/* Longest wait of a launcher for its slot before launching anyway */
+#define DAEMON_WAIT_MS 30000
+/* Connections and concurrent slots of one user */
+#define DAEMON_CLIENTS_PER_UID 8
+#define DAEMON_SESSIONS_PER_UID 2
+/* The system entry cache is rebuilt this long after the last change */
+#define DAEMON_REFRESH_DELAY_MS 500
+/* ... or this often where inotify can't watch the system directories */
+#define DAEMON_REFRESH_INTERVAL_MS 60000
+
+int daemon_run(const char *socket_path, int max_sessions, const char *group);
+int daemon_connect(const char *socket_path);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef DBUS_H
+#define DBUS_H
+
+#include <stddef.h>
+
+/* Bound on the whole exchange with the session bus */
+#define DBUS_TIMEOUT_MS 500
+
+/* Names the session bus can activate */
+struct BusNames {
+  char **names;
+  size_t count;
+};
+
+int dbus_name_from_id(const char *id, char *buf, size_t size);
+int dbus_service_file(const char *name, const char *data_home, char *buf,
+                      size_t size);
+int dbus_list_activatable(struct BusNames *out);
+int dbus_names_has(const struct BusNames *names, const char *name);
+void dbus_names_free(struct BusNames *names);
+
+#endif
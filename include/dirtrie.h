@@ -0,0 +1,11 @@
+#ifndef DIRTRIE_H
+#define DIRTRIE_H
+
+struct DirTrie;
+
+struct DirTrie *dirtrie_new(void);
+void dirtrie_free(struct DirTrie *t);
+int dirtrie_add(struct DirTrie *t, const char *path, int allow, int rule);
+int dirtrie_lookup(const struct DirTrie *t, const char *path);
+
+#endif
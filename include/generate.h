@@ -0,0 +1,13 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include "autostart.h"
+#include "config.h"
+
+#define UNIT_PREFIX "autostart-"
+#define UNIT_TARGET "graphical-session.target"
+
+int generate_units(const char *dir, const struct AppQueue *queue,
+                   struct Config *cfg);
+
+#endif
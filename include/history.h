@@ -0,0 +1,53 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "config.h"
+#include "perfstat.h"
+#include <stdio.h>
+#include <time.h>
+
+/* Entries not launched for this long are dropped (seconds) */
+#define HISTORY_MAX_AGE (30 * 24 * 3600)
+
+/* Startup record of one desktop file ID */
+struct HistoryEntry {
+  char id[256];
+  int streak;      // failed starts in a row, 0 after a good one
+  int status;      // last exit code, -signo if killed by a signal
+  long runtime_ms; // how long the last start lived
+  time_t time;     // when it was launched
+  long cpu_ms;     // CPU time used within the crash window, -1 unknown
+  long rss_kb;     // peak RSS within the crash window, -1 unknown
+  int alive;       // running when the last supervised session ended,
+                   // -1 unknown
+  long long perf[PSTAT_EVENTS]; // cold start counters, -1 unknown
+};
+
+struct ChildList;
+
+/* Per-user startup history, kept across sessions */
+struct History {
+  struct HistoryEntry *entries;
+  size_t count;
+  size_t capacity;
+};
+
+int history_path(const char *home, char *buf, size_t size);
+int history_load(struct History *h, const char *home);
+int history_save(const struct History *h, const char *home);
+void history_free(struct History *h);
+struct HistoryEntry *history_find(struct History *h, const char *id);
+int history_quarantined(struct History *h, const struct Config *cfg,
+                        const char *id);
+int history_retry_due(struct History *h, const struct Config *cfg,
+                      const char *id);
+void history_update(struct History *h, const struct ChildList *children,
+                    int window_ms);
+void history_session_end(struct History *h, const struct ChildList *children);
+void history_set_alive(struct History *h, const char *id, int alive);
+int history_closed(struct History *h, const char *id);
+void history_perf(struct History *h, const struct ChildList *children);
+void history_report(FILE *out, struct History *h, const struct Config *cfg);
+void history_perf_report(FILE *out, struct History *h);
+
+#endif
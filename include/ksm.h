@@ -0,0 +1,12 @@
+#ifndef KSM_H
+#define KSM_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define KSM_SYSFS "/sys/kernel/mm/ksm"
+
+int ksm_probe(char *why, size_t size);
+void ksm_report(FILE *out);
+
+#endif
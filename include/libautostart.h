@@ -0,0 +1,89 @@
+#ifndef LIBAUTOSTART_H
+#define LIBAUTOSTART_H
+
+/*
+ * libautostart - XDG autostart scanning and launching for embedding
+ * into window managers and session managers.
+ *
+ * Typical use:
+ *   as_context *ctx = as_new();
+ *   as_load_config(ctx, path);          // optional
+ *   as_scan_default(ctx, home);         // or as_scan() per directory
+ *   as_set_callback(ctx, on_event, wm);
+ *   as_filter(ctx);
+ *   as_plan(ctx);
+ *   as_launch(ctx);
+ *   as_free(ctx);
+ *
+ * The callback is set before as_filter(), which reports the entries it
+ * drops as AS_EVENT_SKIPPED.
+ *
+ * Contexts are independent, the library keeps no global state.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define AS_API_VERSION 1
+
+#if defined(__GNUC__)
+#define AS_EXPORT __attribute__((visibility("default")))
+#else
+#define AS_EXPORT
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct as_context as_context;
+
+enum as_entry_flags {
+  AS_ENTRY_TERMINAL = 1 << 0,
+  AS_ENTRY_HIDDEN = 1 << 1,
+  AS_ENTRY_NODISPLAY = 1 << 2,
+  AS_ENTRY_DBUS = 1 << 3, // DBusActivatable=true
+};
+
+/* Compact view of one entry, strings are owned by the context */
+struct as_entry {
+  const char *name;
+  const char *exec;
+  const char *tryexec;
+  const char *icon;
+  const char *path;
+  unsigned flags;
+  long start_ms; // offset from launch start, set by as_plan()
+};
+
+enum as_event {
+  AS_EVENT_SKIPPED,
+  AS_EVENT_LAUNCHED,
+  AS_EVENT_FAILED,
+};
+
+typedef void (*as_event_fn)(void *userdata, enum as_event event,
+                            const struct as_entry *entry, pid_t pid);
+
+AS_EXPORT int as_api_version(void);
+
+AS_EXPORT as_context *as_new(void);
+AS_EXPORT void as_free(as_context *ctx);
+
+AS_EXPORT int as_load_config(as_context *ctx, const char *path);
+AS_EXPORT int as_scan(as_context *ctx, const char *dir);
+AS_EXPORT int as_scan_default(as_context *ctx, const char *home);
+AS_EXPORT int as_filter(as_context *ctx);
+AS_EXPORT long as_plan(as_context *ctx);
+
+AS_EXPORT const struct as_entry *as_entries(as_context *ctx, size_t *count);
+
+AS_EXPORT void as_set_callback(as_context *ctx, as_event_fn fn,
+                               void *userdata);
+AS_EXPORT int as_launch(as_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+/* Maximum number of cached DFA states before the cache is flushed,
+ * a power of two */
+#define MATCH_MAX_DFA 4096
+
+enum MatchKind {
+  MATCH_EXACT,
+  MATCH_GLOB,
+  MATCH_REGEX,
+};
+
+struct Matcher;
+
+struct Matcher *matcher_new(void);
+void matcher_free(struct Matcher *m);
+int matcher_add(struct Matcher *m, const char *pattern, enum MatchKind kind,
+                int rule);
+int matcher_match(struct Matcher *m, const char *s);
+int matcher_count(const struct Matcher *m);
+
+#endif
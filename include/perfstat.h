@@ -0,0 +1,33 @@
+#ifndef PERFSTAT_H
+#define PERFSTAT_H
+
+#include <sys/types.h>
+
+/* Cold start counters of an application */
+enum PerfStatEvent {
+  PSTAT_TASK_CLOCK, // CPU time in ms
+  PSTAT_FAULTS,
+  PSTAT_MAJOR_FAULTS, // faults that had to read from disk
+  PSTAT_CSWITCHES,
+  PSTAT_CYCLES, // hardware, missing on most virtual machines
+  PSTAT_INSTRUCTIONS,
+  PSTAT_EVENTS,
+};
+
+/* Major faults from which a cold start counts as I/O bound */
+#define PSTAT_IO_BOUND_FAULTS 100
+
+/* Counters attached to one launched application and everything it
+ * starts, for the first perf_window ms */
+struct PerfStat {
+  int fd[PSTAT_EVENTS];          // -1 if not counted
+  long long value[PSTAT_EVENTS]; // -1 if unknown
+  long until_ms; // end of the window, CLOCK_MONOTONIC, 0 if not counting
+};
+
+void perfstat_init(struct PerfStat *p);
+int perfstat_attach(struct PerfStat *p, pid_t pid, long until_ms);
+void perfstat_read(struct PerfStat *p);
+void perfstat_close(struct PerfStat *p);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+
+/* icon-theme.cache image flags */
+#define ICON_CACHE_HAS_XPM (1 << 0)
+#define ICON_CACHE_HAS_SVG (1 << 1)
+#define ICON_CACHE_HAS_PNG (1 << 2)
+
+int prefetch_icon(const char *theme, const char *icon);
+int prefetch_gui_caches(const char *home);
+
+#endif
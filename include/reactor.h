@@ -0,0 +1,52 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <signal.h>
+#include <stdint.h>
+
+struct Reactor;
+struct ReactorSource;
+
+/* value: epoll events for plain fds, expirations for timers, the signal
+ * number for signal sources */
+typedef void (*reactor_fn)(struct ReactorSource *src, uint32_t value);
+
+enum ReactorKind {
+  REACTOR_FD,     // any pollable fd, e.g. a pidfd or a socket
+  REACTOR_TIMER,  // timerfd, CLOCK_MONOTONIC absolute deadlines
+  REACTOR_SIGNAL, // signalfd, the signals must be blocked
+};
+
+struct ReactorSource {
+  struct Reactor *reactor;
+  enum ReactorKind kind;
+  int fd;
+  int owned; // fd is closed on removal
+  int dead;  // removed while its events were being dispatched
+  reactor_fn fn;
+  void *data;
+  struct ReactorSource *next;
+};
+
+/* One epoll set driving every event of a session */
+struct Reactor {
+  int epfd;
+  int stop; // set by handlers to leave reactor_run()
+  struct ReactorSource *sources;
+  int dispatching;
+};
+
+int reactor_init(struct Reactor *r);
+void reactor_free(struct Reactor *r);
+struct ReactorSource *reactor_add(struct Reactor *r, int fd, int owned,
+                                  reactor_fn fn, void *data);
+struct ReactorSource *reactor_timer(struct Reactor *r, reactor_fn fn,
+                                    void *data);
+int reactor_timer_set(struct ReactorSource *src, long deadline_ms);
+struct ReactorSource *reactor_signals(struct Reactor *r, const sigset_t *mask,
+                                      reactor_fn fn, void *data);
+void reactor_remove(struct ReactorSource *src);
+int reactor_poll(struct Reactor *r, int timeout_ms);
+int reactor_run(struct Reactor *r);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Idle check interval of supervised background applications */
+#define RECLAIM_TICK_MS 1000
+
+/* memory.reclaim work per tick, bounds the time one write takes */
+#define RECLAIM_CHUNK_KB (64 * 1024)
+
+/* Leaf of the delegated cgroup the launcher moves into */
+#define RECLAIM_LAUNCHER_CGROUP "autostart-launcher"
+
+void session_cpu_ms(const pid_t *sessions, size_t count, long *cpu_ms);
+long reclaim_session(pid_t session);
+int reclaim_cgroup_setup(char *base, size_t size);
+int reclaim_cgroup_enter(const char *base);
+int reclaim_cgroup_step(const char *base, pid_t app, long *left_kb,
+                        long *freed_kb);
+void reclaim_cgroup_remove(const char *base, pid_t app);
+
+#endif
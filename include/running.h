@@ -0,0 +1,36 @@
+#ifndef RUNNING_H
+#define RUNNING_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define SESSION_LOCK_TIMEOUT_MS 30000
+#define SESSION_LOCK_POLL_MS 50
+
+struct ProcKey {
+  dev_t dev;
+  ino_t ino;
+};
+
+/* Executables of the live processes of the user's login session, hashed
+ * by inode */
+struct ProcIndex {
+  struct ProcKey *keys; // open addressing, ino == 0 marks a free slot
+  size_t size;
+  size_t count;
+};
+
+int proc_index_build(struct ProcIndex *idx);
+void proc_index_free(struct ProcIndex *idx);
+int proc_index_has(const struct ProcIndex *idx, const struct ProcKey *key);
+int proc_listening(pid_t session);
+int exec_program_key(const char *exec, struct ProcKey *key);
+int exec_program_exists(const char *exec);
+int program_find(const char *prog, struct stat *st);
+
+int session_lock_open(void);
+int session_lock_try(int fd);
+void session_unlock(int fd);
+
+#endif
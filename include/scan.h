@@ -0,0 +1,51 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "reactor.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+struct DesktopEntry;
+
+enum ScanState {
+  SCAN_PENDING, // worker still running
+  SCAN_DONE,    // entries received
+  SCAN_FAILED,  // worker died without a complete result
+};
+
+/* An autostart directory parsed by its own worker process */
+struct ScanDir {
+  const char *path;
+  int index; // position among the session's directories
+  pid_t pid;
+  struct ReactorSource *pipe; // result pipe, NULL once closed
+  struct ReactorSource *exit; // pidfd of the worker, NULL once reaped
+  enum ScanState state;
+  long started_ms;
+  int found;    // .desktop files, -1 if the directory can't be opened
+  size_t count; // valid application entries
+  const struct DesktopEntry *entries; // points into buf
+  char *buf;
+  size_t len, capacity;
+};
+
+typedef void (*scan_fn)(void *data, struct ScanDir *dir);
+
+/* Directories being parsed by workers, so that a hung mount only
+ * stalls its own worker */
+struct Scan {
+  struct ScanDir *dirs;
+  size_t count;
+  size_t capacity;
+  size_t pending;
+  scan_fn on_done; // called for each directory finishing, may be NULL
+  void *data;
+};
+
+int scan_add(struct Scan *scan, struct Reactor *r, const char *path,
+             int index);
+struct ScanDir *scan_find(struct Scan *scan, int index);
+size_t scan_abandon(struct Scan *scan);
+void scan_free(struct Scan *scan);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include "autostart.h"
+#include "config.h"
+#include "history.h"
+#include <stdio.h>
+
+/* Cost assumed for applications without recorded history */
+#define SIM_DEFAULT_CPU_MS 150
+#define SIM_DEFAULT_RSS_KB (40 * 1024)
+/* Launcher time per spawn */
+#define SIM_SPAWN_MS 2
+/* Throughput lost per runnable task beyond the CPU count, per CPU */
+#define SIM_SWITCH_COST 0.05
+
+/* Machine the launch is simulated on */
+struct SimHost {
+  int cpus;
+  long mem_kb; // memory available to the session
+};
+
+/* Settings the tuner searches */
+struct SimParams {
+  int startup_delay_ms;
+  int delay_ms;
+  int heavy_nice; // nice added to the heavier half of the applications
+};
+
+struct SimResult {
+  double first_ms; // first application ready
+  double all_ms;   // every application ready
+};
+
+void sim_host_detect(struct SimHost *host);
+int simulate_launch(FILE *out, const struct AppQueue *queue,
+                    struct Config *cfg, struct History *history,
+                    const struct SimHost *host);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SPAWNER_H
+#define SPAWNER_H
+
+#include <sys/types.h>
+
+#define SPAWN_MAX_ARGS 64
+#define SPAWN_MAX_ENV 8
+#define SPAWN_MSG_MAX 16384
+
+/* Per-app resource knobs applied in the child before exec */
+struct SpawnAttr {
+  int nice;
+  int uclamp_min, uclamp_max; // utilization clamps, max 0 leaves them alone
+  int ksm;                    // anonymous memory mergeable by ksmd
+  long hold_until_ms; // stop before exec for perf counters if there by
+                      // then (CLOCK_MONOTONIC), 0 never
+  const char *cgroup; // delegated cgroup to start in a leaf of, or NULL
+  const char *env[SPAWN_MAX_ENV]; // "NAME=VALUE" sets, "NAME" unsets
+  int env_count;
+};
+
+struct SpawnRequest {
+  const char *argv[SPAWN_MAX_ARGS + 1];
+  int argc;
+  const char *cwd;
+  struct SpawnAttr attr;
+};
+
+/* zygote lifecycle */
+int spawner_start(void);
+void spawner_stop(void);
+int spawner_active(void);
+
+/* spawning */
+pid_t spawner_spawn(const struct SpawnRequest *req, int *pidfd);
+void spawn_exec(const struct SpawnRequest *req);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef SUPERVISE_H
+#define SUPERVISE_H
+
+#include "autostart.h"
+
+/* Control socket of a supervising launcher, under $XDG_RUNTIME_DIR */
+#define SUPERVISE_CTL "autostart.ctl"
+#define SUPERVISE_KILL_GRACE_MS 1000
+#define SUPERVISE_CTL_TIMEOUT_MS 1000 // a connection gets to send "stop"
+
+struct Child *track_child(struct Session *s, pid_t pid, int pidfd,
+                          const char *name, const char *id);
+int watch_startup(struct Session *s, int window_ms);
+long now_ms(void);
+int session_teardown(struct Session *s, int timeout_ms, int *killed);
+int session_stop_signals(struct Session *s);
+int supervise_begin(struct Session *s);
+int supervise_session(struct Session *s);
+int supervise_stop(void);
+
+#endif
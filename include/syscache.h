@@ -0,0 +1,34 @@
+#ifndef SYSCACHE_H
+#define SYSCACHE_H
+
+#include "autostart.h"
+#include <stdint.h>
+
+#define SYSCACHE_DIR "/run/autostart"
+#define SYSCACHE_PATH SYSCACHE_DIR "/system.cache"
+#define SYSCACHE_MAGIC "ASSYSCA"
+#define SYSCACHE_VERSION 2
+
+/* On-disk header, followed by count struct DesktopEntry records */
+struct SysCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t count;
+  uint32_t dir_count;
+  int64_t mtimes[MAX_SYSTEM_DIRS][2];
+  uint64_t files; // hash of name, size and mtime of every .desktop file
+};
+
+struct SysCache {
+  struct AppQueue entries; // read-only view when mapped
+  void *map;
+  size_t map_size;
+};
+
+int syscache_open(struct SysCache *cache);
+void syscache_close(struct SysCache *cache);
+int syscache_publish(const struct AppQueue *entries, const int64_t mtimes[][2],
+                     uint64_t files);
+
+#endif
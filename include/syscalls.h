@@ -0,0 +1,25 @@
+#ifndef SYSCALLS_H
+#define SYSCALLS_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+struct perf_event_attr;
+
+/* Thin wrappers for Linux syscalls glibc may not export.
+ * All of them return -1 with errno = ENOSYS on kernels without support. */
+int sys_pidfd_open(pid_t pid, unsigned int flags);
+pid_t sys_clone_pidfd(unsigned long flags, int *pidfd);
+int sys_pidfd_send_signal(int pidfd, int sig);
+int sys_sched_uclamp(pid_t tid, int min, int max);
+int sys_sched_uclamp_reset(pid_t tid);
+ssize_t sys_process_madvise(int pidfd, const struct iovec *iov, size_t count,
+                            int advice);
+int sys_perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+                        int group, unsigned long flags);
+
+#endif
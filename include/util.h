@@ -1,2 +1,62 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+enum TokenType {
+  TOKEN_END,     // no more lines
+  TOKEN_SECTION, // [key]
+  TOKEN_PAIR,    // key=value
+  TOKEN_LINE,    // anything else, whole line in key
+};
+
+struct Token {
+  enum TokenType type;
+  char *key;
+  char *value;
+  unsigned line;
+  const char *text; // start of the line, columns are counted from it
+};
+
+/* Cap of the files tokenizer_open() reads with TOKENIZER_REGULAR */
+#define TOKENIZER_MAX_SIZE (1 << 20)
+
+/* tokenizer_open() flags, for files of places the user controls */
+enum TokenizerFlags {
+  TOKENIZER_REGULAR = 1,  // regular files of at most TOKENIZER_MAX_SIZE
+  TOKENIZER_NOFOLLOW = 2, // not through a symbolic link
+};
+
+/* Line splitter over a whole file read into memory */
+struct Tokenizer {
+  char *buf;
+  size_t len;
+  size_t pos;
+  unsigned line;
+};
+
+/**
+ * isspace() of the C locale the parsers run in, inlined: their per byte
+ * loops do without the table lookup
+ */
+static inline int is_space(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
 char *trim(char *str);
 void remove_desktop_specifiers(char *cmd);
+void exec_basename(const char *exec, char *buf, size_t size);
+int runtime_path(const char *name, char *buf, size_t size);
+int write_all(int fd, const void *buf, size_t len);
+int read_pending(int fd, char **buf, size_t *len, size_t *capacity);
+int proc_stat(pid_t pid, pid_t *session, long *cpu_ms);
+int proc_session_walk(const pid_t *sessions, size_t count,
+                      int (*fn)(pid_t pid, size_t session, void *data),
+                      void *data);
+
+int tokenizer_open(struct Tokenizer *t, const char *path, int flags);
+void tokenizer_close(struct Tokenizer *t);
+enum TokenType tokenizer_next(struct Tokenizer *t, struct Token *tok);
+
+#endif
@@ -0,0 +1,690 @@
+/**
+ * audit.c
+ *
+ * Offline audit of many users' autostart directories, e.g. of every
+ * home under /home. The homes are split among forked workers; each runs
+ * the launcher's own parse and filter (entry_skip_reason() with the
+ * user's startup history loaded) over its share and sends its findings
+ * back over a pipe, like the directory scan workers. Nothing is launched
+ * and the session bus is never asked.
+ *
+ * A worker sends the struct AuditRecord of each home as soon as it is
+ * audited, then exits. A worker that sends nothing for scan_timeout is
+ * stuck on a home (a hung network mount, say) and is killed; only the
+ * homes it had left are missing.
+ *
+ * The homes belong to their users: their desktop and history files are
+ * read only if regular, not through symbolic links and up to
+ * TOKENIZER_MAX_SIZE.
+ */
+
+#define _GNU_SOURCE
+#include "audit.h"
+#include "autostart.h"
+#include "supervise.h"
+#include "util.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Findings of a worker, or of the launcher for the system directories */
+struct AuditBuf {
+  struct AuditRecord *items;
+  size_t count;
+  size_t capacity;
+};
+
+/* Program of a launched entry, for finding duplicates */
+struct AuditProgram {
+  struct ProcKey key;
+  char id[256];
+  const char *dir;
+};
+
+struct AuditPrograms {
+  struct AuditProgram *items;
+  size_t count;
+  size_t capacity;
+};
+
+struct Audit;
+
+/* A worker auditing every jobs-th home */
+struct AuditWorker {
+  struct Audit *audit;
+  pid_t pid;
+  size_t first;                // its first home
+  struct ReactorSource *pipe;  // NULL once closed
+  struct ReactorSource *timer; // progress deadline, NULL without one
+  int hung;                    // killed at its deadline
+  char *buf;
+  size_t len, capacity;
+};
+
+struct Audit {
+  struct Session s; // config, and the history of the home being audited
+  struct Array homes;
+  struct AuditPrograms system; // launched system entries, sorted
+  struct AuditWorker *workers;
+  size_t worker_count;
+  size_t step; // homes are dealt round robin to this many shares
+  size_t pending;
+};
+
+static const char *const kind_names[AUDIT_KINDS] = {
+    [AUDIT_INVALID] = "Invalid entries",
+    [AUDIT_TRYEXEC] = "TryExec not found",
+    [AUDIT_MISSING] = "Programs not found",
+    [AUDIT_DUPLICATE] = "Duplicate programs",
+    [AUDIT_FAILING] = "Failing at startup",
+    [AUDIT_EXPENSIVE] = "Expensive starts",
+};
+
+static void *grow(void *items, size_t *capacity, size_t size) {
+  *capacity = *capacity ? *capacity * 2 : 64;
+  void *tmp = realloc(items, *capacity * size);
+  if (!tmp) {
+    perror("realloc");
+    exit(1);
+  }
+  return tmp;
+}
+
+static struct AuditRecord *record_add(struct AuditBuf *b, int home,
+                                      enum AuditKind kind, const char *id) {
+  if (b->count == b->capacity)
+    b->items = grow(b->items, &b->capacity, sizeof(*b->items));
+
+  struct AuditRecord *r = &b->items[b->count++];
+  memset(r, 0, sizeof(*r));
+  r->home = home;
+  r->kind = kind;
+  strncpy(r->id, id, sizeof(r->id) - 1);
+  return r;
+}
+
+/**
+ * printf() into the detail of a record, long Exec lines are cut
+ */
+static void record_detail(struct AuditRecord *r, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(r->detail, sizeof(r->detail), fmt, ap);
+  va_end(ap);
+}
+
+/**
+ * Records why tokenizer_open() refused a desktop file
+ * @param err errno it left
+ */
+static void record_unread(struct AuditRecord *r, int err) {
+  if (err == ELOOP)
+    record_detail(r, "symbolic link, not followed");
+  else if (err == EINVAL)
+    record_detail(r, "not a regular file");
+  else if (err == EFBIG)
+    record_detail(r, "larger than %d KiB", TOKENIZER_MAX_SIZE / 1024);
+  else
+    record_detail(r, "%s", strerror(err));
+}
+
+static void program_add(struct AuditPrograms *p, const struct ProcKey *key,
+                        const char *id, const char *dir) {
+  if (p->count == p->capacity)
+    p->items = grow(p->items, &p->capacity, sizeof(*p->items));
+
+  struct AuditProgram *prog = &p->items[p->count++];
+  prog->key = *key;
+  strncpy(prog->id, id, sizeof(prog->id) - 1);
+  prog->id[sizeof(prog->id) - 1] = '\0';
+  prog->dir = dir;
+}
+
+static int compare_program(const void *a, const void *b) {
+  const struct ProcKey *x = &((const struct AuditProgram *)a)->key;
+  const struct ProcKey *y = &((const struct AuditProgram *)b)->key;
+  if (x->dev != y->dev)
+    return x->dev < y->dev ? -1 : 1;
+  return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+static int compare_program_id(const void *a, const void *b) {
+  int c = compare_program(a, b);
+  return c ? c
+           : strcmp(((const struct AuditProgram *)a)->id,
+                    ((const struct AuditProgram *)b)->id);
+}
+
+/**
+ * Audits one parsed entry
+ * @return 1 if the launcher would launch it, 0 otherwise
+ */
+static int audit_entry(struct Audit *a, const struct DesktopEntry *de,
+                       const char *dir, int home, struct AuditBuf *out,
+                       struct AuditPrograms *progs) {
+  const struct HistoryEntry *e = history_find(&a->s.history, de->id);
+  if (e && e->streak > 0)
+    record_add(out, home, AUDIT_FAILING, de->id)->value[0] = e->streak;
+  if (e && (e->cpu_ms >= AUDIT_CPU_MS || e->rss_kb >= AUDIT_RSS_KB)) {
+    struct AuditRecord *r = record_add(out, home, AUDIT_EXPENSIVE, de->id);
+    r->value[0] = e->cpu_ms;
+    r->value[1] = e->rss_kb;
+  }
+
+  enum SkipReason reason = entry_skip_reason(&a->s, de);
+  if (reason == SKIP_TRYEXEC)
+    record_detail(record_add(out, home, AUDIT_TRYEXEC, de->id), "%s",
+                  de->tryexec);
+  if (reason != SKIP_NONE)
+    return 0;
+
+  struct ProcKey key;
+  if (exec_program_key(de->exec, &key) == 0)
+    program_add(progs, &key, de->id, dir);
+  else if (!exec_program_exists(de->exec))
+    record_detail(record_add(out, home, AUDIT_MISSING, de->id), "%s",
+                  de->exec);
+  return 1;
+}
+
+/**
+ * Audits an autostart directory and collects the programs of the entries
+ * it would launch
+ * @param a Audit, with the history of the directory's user loaded
+ * @param dir Directory
+ * @param home Index of the home, -1 for a system directory
+ * @param out Receives the findings and the directory's counts
+ * @param progs Receives the programs of launched entries
+ */
+static void audit_dir(struct Audit *a, const char *dir, int home,
+                      struct AuditBuf *out, struct AuditPrograms *progs) {
+  long files = 0, valid = 0, launched = 0;
+
+  DIR *d = NULL;
+  if (config_dir_blocked(&a->s.cfg, dir))
+    files = -2;
+  else if (!(d = opendir(dir)))
+    files = -1;
+
+  struct dirent *ent;
+  while (d && (ent = readdir(d)) != NULL) {
+    const char *ext = strrchr(ent->d_name, '.');
+    if (!ext || strcmp(ext, ".desktop") != 0)
+      continue;
+    files++;
+
+    char path[MAX_PATH];
+    struct DesktopEntry de;
+    struct Tokenizer t;
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    if (tokenizer_open(&t, path,
+                       TOKENIZER_REGULAR |
+                           (home >= 0 ? TOKENIZER_NOFOLLOW : 0)) != 0) {
+      record_unread(record_add(out, home, AUDIT_INVALID, ent->d_name),
+                    errno);
+      continue;
+    }
+    int ok = parse_desktop_entry(&t, path, &de);
+    tokenizer_close(&t);
+    if (!ok) {
+      record_add(out, home, AUDIT_INVALID, ent->d_name);
+      continue;
+    }
+    valid++;
+    launched += audit_entry(a, &de, dir, home, out, progs);
+  }
+  if (d)
+    closedir(d);
+
+  struct AuditRecord *r = record_add(out, home, AUDIT_DIR, dir);
+  r->value[0] = files;
+  r->value[1] = valid;
+  r->value[2] = launched;
+}
+
+/**
+ * Reports the entries of a home that launch a program another launched
+ * entry of the home, or of the system directories, launches too
+ */
+static void audit_duplicates(struct Audit *a, struct AuditPrograms *progs,
+                             int home, struct AuditBuf *out) {
+  qsort(progs->items, progs->count, sizeof(*progs->items),
+        compare_program_id);
+
+  // Every entry of a group is reported against its first one
+  const struct AuditProgram *first = NULL;
+  for (size_t i = 0; i < progs->count; i++) {
+    const struct AuditProgram *p = &progs->items[i], *other = NULL;
+    if (first && compare_program(p, first) == 0)
+      other = first;
+    else
+      first = p;
+    if (!other && home >= 0)
+      other = bsearch(p, a->system.items, a->system.count,
+                      sizeof(*a->system.items), compare_program);
+    if (other)
+      record_detail(record_add(out, home, AUDIT_DUPLICATE, p->id), "%s/%s",
+                    other->dir, other->id);
+  }
+}
+
+/**
+ * Audits every step-th home, starting at first
+ * @param out Receives the findings
+ * @param fd Pipe of a worker, which gets the findings of each home as
+ *        soon as they are complete; -1 to keep them all in out
+ */
+static void audit_homes(struct Audit *a, size_t first, size_t step,
+                        struct AuditBuf *out, int fd) {
+  struct AuditPrograms progs = {0};
+  char dir[MAX_PATH], data_home[MAX_PATH];
+
+  for (size_t i = first; i < a->homes.count; i += step) {
+    const char *home = a->homes.values[i];
+    history_free(&a->s.history);
+    if (history_load(&a->s.history, home) != 0)
+      history_free(&a->s.history); // unreadable, audit without it
+    // D-Bus activation files of the user, not of the caller
+    snprintf(data_home, sizeof(data_home), "%s/.local/share", home);
+    a->s.data_home = data_home;
+
+    snprintf(dir, sizeof(dir), "%s/.config/autostart", home);
+    progs.count = 0;
+    audit_dir(a, dir, i, out, &progs);
+    audit_duplicates(a, &progs, i, out);
+
+    if (fd >= 0) {
+      if (write_all(fd, out->items, out->count * sizeof(*out->items)) != 0)
+        _exit(1);
+      out->count = 0;
+    }
+  }
+  a->s.data_home = "";
+  free(progs.items);
+}
+
+static void worker_done(struct AuditWorker *w) {
+  reactor_remove(w->pipe);
+  if (w->timer) // none without scan_timeout
+    reactor_remove(w->timer);
+  w->pipe = w->timer = NULL;
+  w->audit->pending--;
+}
+
+/**
+ * Collects the output of a worker; each home it sends renews its
+ * deadline
+ */
+static void on_worker_pipe(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct AuditWorker *w = src->data;
+
+  if (read_pending(src->fd, &w->buf, &w->len, &w->capacity) != 0) {
+    worker_done(w);
+    return;
+  }
+  if (w->timer)
+    reactor_timer_set(w->timer,
+                      now_ms() + w->audit->s.cfg.scan_timeout_ms);
+}
+
+/**
+ * Gives up on a worker that sent nothing for scan_timeout, keeping what
+ * it sent before
+ */
+static void on_worker_timer(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  struct AuditWorker *w = src->data;
+
+  read_pending(w->pipe->fd, &w->buf, &w->len, &w->capacity);
+  kill(w->pid, SIGKILL);
+  w->hung = 1;
+  worker_done(w);
+}
+
+/**
+ * Starts a worker auditing every step-th home from first
+ * @return 0 on success, -1 if no worker could be started
+ */
+static int worker_start(struct Audit *a, struct AuditWorker *w, size_t first,
+                        size_t step) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    struct AuditBuf out = {0};
+    close(fds[0]);
+    audit_homes(a, first, step, &out, fds[1]);
+    _exit(0);
+  }
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  memset(w, 0, sizeof(*w));
+  w->audit = a;
+  w->pid = pid;
+  w->first = first;
+  w->pipe = reactor_add(&a->s.reactor, fds[0], 1, on_worker_pipe, w);
+  if (w->pipe && a->s.cfg.scan_timeout_ms > 0) {
+    w->timer = reactor_timer(&a->s.reactor, on_worker_timer, w);
+    if (!w->timer) {
+      reactor_remove(w->pipe);
+      w->pipe = NULL;
+    }
+  }
+  if (!w->pipe) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+  if (w->timer)
+    reactor_timer_set(w->timer, now_ms() + a->s.cfg.scan_timeout_ms);
+  a->pending++;
+  return 0;
+}
+
+static void homes_add(struct Array *homes, const char *path) {
+  if (homes->count == homes->capacity)
+    homes->values = grow(homes->values, &homes->capacity, sizeof(char *));
+  homes->values[homes->count] = strdup(path);
+  if (!homes->values[homes->count]) {
+    perror("strdup");
+    exit(1);
+  }
+  homes->count++;
+}
+
+static int compare_str(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Adds the homes under a root: the root itself if it has an autostart
+ * directory, otherwise each of its subdirectories
+ */
+static void add_root(struct Array *homes, const char *root) {
+  char path[MAX_PATH];
+  struct stat st;
+
+  snprintf(path, sizeof(path), "%s/.config/autostart", root);
+  if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+    homes_add(homes, root);
+    return;
+  }
+
+  DIR *dir = opendir(root);
+  if (!dir) {
+    perror(root);
+    return;
+  }
+
+  size_t first = homes->count;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    if (ent->d_name[0] == '.' ||
+        (ent->d_type != DT_DIR && ent->d_type != DT_LNK &&
+         ent->d_type != DT_UNKNOWN))
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", root, ent->d_name);
+    if (ent->d_type != DT_DIR && (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)))
+      continue;
+    homes_add(homes, path);
+  }
+  closedir(dir);
+
+  qsort(homes->values + first, homes->count - first, sizeof(char *),
+        compare_str);
+}
+
+static int compare_record(const void *a, const void *b) {
+  const struct AuditRecord *x = a, *y = b;
+  if (x->home != y->home)
+    return x->home < y->home ? -1 : 1;
+  if (x->kind != y->kind)
+    return x->kind < y->kind ? -1 : 1;
+  return strcmp(x->id, y->id);
+}
+
+static void print_finding(FILE *out, const struct AuditRecord *r) {
+  switch (r->kind) {
+  case AUDIT_INVALID:
+    if (r->detail[0])
+      fprintf(out, "  %s: not read, %s\n", r->id, r->detail);
+    else
+      fprintf(out, "  %s: invalid, not an application entry with Name and "
+                   "Exec\n",
+              r->id);
+    break;
+  case AUDIT_TRYEXEC:
+    fprintf(out, "  %s: skipped, TryExec %s not found\n", r->id, r->detail);
+    break;
+  case AUDIT_MISSING:
+    fprintf(out, "  %s: launched, but its program is not found: %s\n",
+            r->id, r->detail);
+    break;
+  case AUDIT_DUPLICATE:
+    fprintf(out, "  %s: launches the same program as %s\n", r->id,
+            r->detail);
+    break;
+  case AUDIT_FAILING:
+    fprintf(out, "  %s: failed its last %ld start%s\n", r->id, r->value[0],
+            r->value[0] == 1 ? "" : "s");
+    break;
+  case AUDIT_EXPENSIVE:
+    fprintf(out, "  %s: expensive start, %ldms CPU, %ld MB\n", r->id,
+            r->value[0], r->value[1] / 1024);
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * Prints the findings, one block per directory that has any, and the
+ * totals
+ */
+static void print_audit(FILE *out, struct Audit *a,
+                        const struct AuditRecord *records, size_t count,
+                        long elapsed_ms) {
+  long kinds[AUDIT_KINDS] = {0};
+  long files = 0, valid = 0, launched = 0, system_launched = 0;
+  long with_dir = 0, without_dir = 0, blocked = 0, most = -1;
+  const char *busiest = NULL;
+
+  for (size_t i = 0; i < count;) {
+    const struct AuditRecord *dir = &records[i];
+    size_t end = i + 1;
+    while (end < count && records[end].home == dir->home)
+      end++;
+
+    // The counts sort first; a directory without them was lost with its
+    // worker
+    if (dir->kind == AUDIT_DIR && dir->home < 0) {
+      // System directories: one record each, findings follow all of them
+      fprintf(out, "System directories:\n");
+      for (; i < end && records[i].kind == AUDIT_DIR; i++) {
+        const struct AuditRecord *r = &records[i];
+        if (r->value[0] == -2)
+          fprintf(out, "  %s: blocked by config\n", r->id);
+        else if (r->value[0] >= 0)
+          fprintf(out, "  %s: %ld files, %ld valid, %ld launched\n", r->id,
+                  r->value[0], r->value[1], r->value[2]);
+        system_launched += r->value[2] > 0 ? r->value[2] : 0;
+      }
+    } else if (dir->kind == AUDIT_DIR) {
+      if (dir->value[0] == -1)
+        without_dir++;
+      else if (dir->value[0] == -2)
+        blocked++;
+      else
+        with_dir++;
+      if (dir->value[0] > 0) {
+        files += dir->value[0];
+        valid += dir->value[1];
+        launched += dir->value[2];
+      }
+      if (dir->value[2] > most) {
+        most = dir->value[2];
+        busiest = a->homes.values[dir->home];
+      }
+      if (end > i + 1)
+        fprintf(out, "\n%s/.config/autostart: %ld files, %ld valid, %ld "
+                     "launched\n",
+                a->homes.values[dir->home], dir->value[0], dir->value[1],
+                dir->value[2]);
+      i++;
+    }
+
+    for (; i < end; i++) {
+      kinds[records[i].kind]++;
+      print_finding(out, &records[i]);
+    }
+  }
+
+  fprintf(out, "\nAudited %zu homes in %ldms with %zu worker%s\n",
+          a->homes.count, elapsed_ms, a->worker_count,
+          a->worker_count == 1 ? "" : "s");
+  fprintf(out, "  With autostart entries: %ld, without: %ld, blocked: %ld\n",
+          with_dir, without_dir, blocked);
+  fprintf(out, "  Desktop files: %ld, valid: %ld\n", files, valid);
+  fprintf(out, "  Would be launched: %ld from homes, plus %ld system "
+               "entries each\n",
+          launched, system_launched);
+  if (busiest)
+    fprintf(out, "  Most in one home: %ld (%s)\n", most, busiest);
+  for (int k = AUDIT_DIR + 1; k < AUDIT_KINDS; k++)
+    fprintf(out, "  %s: %ld\n", kind_names[k], kinds[k]);
+}
+
+/**
+ * Audits the autostart directories of every home under the given roots
+ * and the system directories, with the launcher's own parse and filter,
+ * and prints the findings. Nothing is launched.
+ * @param out Output stream
+ * @param roots Directories holding homes, or homes themselves
+ * @param count Number of roots
+ * @param config_path Config file applied to every user (NULL for defaults)
+ * @param jobs Number of workers, 0 for one per online CPU
+ * @return 0 on success, -1 if a worker failed
+ */
+int audit_run(FILE *out, const char *const *roots, size_t count,
+              const char *config_path, int jobs) {
+  struct Audit a;
+  struct AuditBuf records = {0};
+  int ret = 0;
+
+  memset(&a, 0, sizeof(a));
+  if (session_init(&a.s, NULL) != 0) {
+    perror("epoll");
+    return -1;
+  }
+  a.s.ignore_running = 1; // other users' processes say nothing
+  a.s.bus_listed = 1;     // dbus:ping entries count as launched
+  if (config_path)
+    config_load(&a.s.cfg, config_path);
+
+  // Histories are read from the audited homes, not the caller's state
+  unsetenv("XDG_STATE_HOME");
+
+  long start = now_ms();
+  for (size_t i = 0; i < count; i++)
+    add_root(&a.homes, roots[i]);
+
+  // System entries are the same for everyone, audit them once, with
+  // the system D-Bus activation files only
+  a.s.data_home = "";
+  for (size_t i = 0; system_autostart_dirs[i]; i++)
+    audit_dir(&a, system_autostart_dirs[i], -1, &records, &a.system);
+  audit_duplicates(&a, &a.system, -1, &records);
+
+  if (jobs <= 0)
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if ((size_t)jobs > a.homes.count)
+    jobs = a.homes.count;
+  a.step = jobs;
+  a.workers = calloc(jobs > 0 ? jobs : 1, sizeof(*a.workers));
+  if (!a.workers) {
+    perror("calloc");
+    exit(1);
+  }
+
+  // A share without a worker is audited here after the others started
+  size_t inline_from = jobs;
+  for (int i = 0; i < jobs; i++) {
+    if (worker_start(&a, &a.workers[i], i, jobs) != 0) {
+      inline_from = i;
+      break;
+    }
+    a.worker_count++;
+  }
+  for (size_t i = inline_from; i < (size_t)jobs; i++)
+    audit_homes(&a, i, jobs, &records, -1);
+
+  while (a.pending > 0)
+    if (reactor_poll(&a.s.reactor, -1) < 0)
+      break;
+
+  for (size_t i = 0; i < a.worker_count; i++) {
+    struct AuditWorker *w = &a.workers[i];
+    const struct AuditRecord *sent = (const struct AuditRecord *)w->buf;
+    size_t n = w->len / sizeof(struct AuditRecord);
+    int status;
+    if (w->hung) {
+      // Stuck in the kernel, it may outlive SIGKILL for a while: not waited
+      waitpid(w->pid, NULL, WNOHANG);
+      size_t done = 0;
+      for (size_t j = 0; j < n; j++)
+        done += sent[j].kind == AUDIT_DIR;
+      size_t home = w->first + done * a.step;
+      if (home < a.homes.count)
+        fprintf(stderr, "Audit worker %zu sent nothing for %dms on %s, its "
+                        "remaining homes are missing\n",
+                i, a.s.cfg.scan_timeout_ms, a.homes.values[home]);
+      else
+        fprintf(stderr, "Audit worker %zu did not exit within %dms\n", i,
+                a.s.cfg.scan_timeout_ms);
+      ret = -1;
+    } else if (waitpid(w->pid, &status, 0) != w->pid || !WIFEXITED(status) ||
+               WEXITSTATUS(status) != 0) {
+      fprintf(stderr,
+              "Audit worker %zu failed, its remaining homes are missing\n",
+              i);
+      ret = -1;
+    }
+    if (n > 0) {
+      while (records.capacity < records.count + n)
+        records.items =
+            grow(records.items, &records.capacity, sizeof(*records.items));
+      memcpy(records.items + records.count, sent, n * sizeof(*sent));
+      records.count += n;
+    }
+    free(w->buf);
+  }
+
+  qsort(records.items, records.count, sizeof(*records.items),
+        compare_record);
+  print_audit(out, &a, records.items, records.count, now_ms() - start);
+
+  for (size_t i = 0; i < a.homes.count; i++)
+    free(a.homes.values[i]);
+  free(a.homes.values);
+  free(a.system.items);
+  free(a.workers);
+  free(records.items);
+  session_free(&a.s);
+  return ret;
+}
@@ -10,54 +10,42 @@
  * - Filters hidden/no-display applications
  * - Launches applications in background
  * - Supports both user (~/.config/autostart) and system (/etc/xdg/autostart)
+ *
+ * All state lives in struct Session, so the same code backs the
+ * autostart binary and libautostart.
  */
 
+#include "autostart.h"
+#include "boost.h"
 #include "config.h"
+#include "generate.h"
+#include "ksm.h"
+#include "prefetch.h"
+#include "reclaim.h"
+#include "simulate.h"
+#include "spawner.h"
+#include "supervise.h"
+#include "syscache.h"
+#include "syscalls.h"
 #include "util.h"
 #include <dirent.h>
 #include <errno.h>
-#include <pwd.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
-#define MAX_LINE 1024
-#define MAX_PATH 2048
-
-struct DesktopEntry {
-  char name[256];
-  char exec[1024];
-  char tryexec[256];
-  char icon[256];
-  char path[1024];
-  int terminal;
-  int hidden;
-  int nodisplay;
-  int valid;
-};
-
-struct Array {
-  char **values;
-  size_t count;
-  size_t capacity;
-};
-
-struct AppQueue {
-  struct DesktopEntry *apps;
-  size_t count;
-  size_t capacity;
-};
-
-static struct AppQueue app_queue;
-static struct Config cfg;
-static struct Array autostart_dirs;
+const char *const system_autostart_dirs[] = {"/etc/xdg/autostart",
+                                             "/usr/share/autostart", NULL};
 
 /*
  * Initialier array of autostart directories
@@ -97,80 +85,188 @@ void app_queue_add(struct AppQueue *a, struct DesktopEntry entry) {
   a->apps[a->count++] = entry;
 }
 
+/*
+ * Initialier array of autostart directories
+ * @param a dynamic array of autostart dirs
+ * @return None
+ */
+static void autostart_dirs_init(struct Array *a) {
+  int size = 5;
+
+  a->values = malloc(size * sizeof(char *));
+  if (!a->values) {
+    perror("malloc");
+    exit(1);
+  }
+  a->count = 0;
+  a->capacity = size;
+}
+
+/*
+ * Initialier array of autostart directories
+ * @param a dynamic array of autostart dirs
+ * @param path directory to copy in array
+ * @return None
+ */
+static void autostart_dirs_add(struct Array *a, const char *path) {
+  if (a->count == a->capacity) {
+    a->capacity *= 2;
+    char **tmp = realloc(a->values, a->capacity * sizeof(char *));
+    if (!tmp) {
+      perror("realloc");
+      exit(1);
+    }
+    a->values = tmp;
+  }
+
+  a->values[a->count] = strdup(path);
+  if (!a->values[a->count]) {
+    perror("strdup");
+    exit(1);
+  }
+  a->count++;
+}
+
 /*
  * Cleaner autostart Array
- * @param None
+ * @param a dynamic array of autostart dirs
  * @return None
  */
-void cleanup_autostart_dirs() {
-  for (size_t i = 0; i < autostart_dirs.count; i++)
-    free(autostart_dirs.values[i]);
-  free(autostart_dirs.values);
+static void cleanup_autostart_dirs(struct Array *a) {
+  for (size_t i = 0; i < a->count; i++)
+    free(a->values[i]);
+  free(a->values);
+  a->values = NULL;
+  a->count = a->capacity = 0;
+}
+
+/**
+ * Initializes a session with default config and empty queue
+ * @param s Session to initialize
+ * @param out Stream for progress output, NULL to stay quiet
+ * @return 0 on success, -1 if the reactor can't be created (errno set);
+ *         the session must not be used or freed then
+ */
+int session_init(struct Session *s, FILE *out) {
+  memset(s, 0, sizeof(*s));
+  if (reactor_init(&s->reactor) != 0)
+    return -1;
+  s->ctl_client = -1;
+  config_init(&s->cfg);
+  app_queue_init(&s->queue);
+  app_queue_init(&s->closed);
+  autostart_dirs_init(&s->dirs);
+  s->out = out;
+  return 0;
 }
 
-void cleanup_app_queue() { free(app_queue.apps); }
 /*
- * Cleaner all dynamic memory allocated
- * @param None
+ * Cleaner all dynamic memory allocated by a session
+ * @param s Session
  * @return None
  */
-void cleanup() {
-  cleanup_autostart_dirs();
-  cleanup_app_queue();
+void session_free(struct Session *s) {
+  cleanup_autostart_dirs(&s->dirs);
+  config_free(&s->cfg);
+  proc_index_free(&s->running);
+  dbus_names_free(&s->bus_names);
+  history_free(&s->history);
+  scan_free(&s->scan);
+  if (s->ctl_client >= 0)
+    close(s->ctl_client);
+  // Watched pidfds are closed with the reactor
+  for (size_t i = 0; i < s->children.count; i++) {
+    perfstat_close(&s->children.items[i].perf);
+    if (s->children.items[i].pidfd >= 0 && !s->children.items[i].watch)
+      close(s->children.items[i].pidfd);
+  }
+  reactor_free(&s->reactor);
+  free(s->children.items);
+  memset(&s->children, 0, sizeof(s->children));
+  free(s->queue.apps);
+  s->queue.apps = NULL;
+  free(s->closed.apps);
+  s->closed.apps = NULL;
+  s->queue.count = s->queue.capacity = 0;
 }
 
 /**
- * Parses a .desktop file into a DesktopEntry struct
+ * printf() to the session output, if any
+ */
+static void say(struct Session *s, const char *fmt, ...) {
+  if (!s->out)
+    return;
+
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(s->out, fmt, ap);
+  va_end(ap);
+}
+
+static void emit(struct Session *s, enum SessionEvent event,
+                 const struct DesktopEntry *de, pid_t pid) {
+  if (s->on_event)
+    s->on_event(s->userdata, event, de, pid);
+}
+
+/**
+ * Parses a .desktop file into a DesktopEntry struct. Only regular files
+ * up to TOKENIZER_MAX_SIZE are read, a FIFO left in an autostart
+ * directory must not hang the login.
  * @param filename Path to the .desktop file
  * @param entry Pointer to DesktopEntry struct to populate
  * @return 1 on success, 0 on failure or if not an application
  */
 int parse_desktop_file(const char *filename, struct DesktopEntry *entry) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    fprintf(stderr, "Error opening file: %s\n", filename);
+  struct Tokenizer t;
+  if (tokenizer_open(&t, filename, TOKENIZER_REGULAR) != 0) {
+    fprintf(stderr, "Error opening file: %s: %s\n", filename,
+            errno == EINVAL ? "not a regular file" : strerror(errno));
     return 0;
   }
 
+  int valid = parse_desktop_entry(&t, filename, entry);
+  tokenizer_close(&t);
+  return valid;
+}
+
+/**
+ * Parses an opened .desktop file into a DesktopEntry struct
+ * @param t Tokenizer over the file, left open
+ * @param filename Path of the file, its basename is the entry ID
+ * @param entry Pointer to DesktopEntry struct to populate
+ * @return 1 on success, 0 if not a valid application
+ */
+int parse_desktop_entry(struct Tokenizer *t, const char *filename,
+                        struct DesktopEntry *entry) {
   // Initialize the struct
   memset(entry, 0, sizeof(struct DesktopEntry));
   entry->valid = 0;
 
-  char line[MAX_LINE];
+  const char *base = strrchr(filename, '/');
+  strncpy(entry->id, base ? base + 1 : filename, sizeof(entry->id) - 1);
+
+  struct Token tok;
   bool in_desktop_entry = false;
   bool type_is_application = false;
 
-  while (fgets(line, MAX_LINE, file)) {
-    char *trimmed = trim(line);
-
-    // Skip comments and empty lines
-    if (trimmed[0] == '#' || trimmed[0] == 0)
-      continue;
-
+  while (tokenizer_next(t, &tok) != TOKEN_END) {
     // Check for [Desktop Entry] section
-    if (trimmed[0] == '[') {
-      in_desktop_entry = (strstr(trimmed, "[Desktop Entry]") != NULL);
+    if (tok.type == TOKEN_SECTION) {
+      in_desktop_entry = strcmp(tok.key, "Desktop Entry") == 0;
       continue;
     }
 
-    if (!in_desktop_entry)
+    if (!in_desktop_entry || tok.type != TOKEN_PAIR)
       continue;
 
-    // Split key and value
-    char *sep = strchr(trimmed, '=');
-    if (!sep)
-      continue;
-
-    *sep = '\0';
-    char *key = trim(trimmed);
-    char *value = trim(sep + 1);
+    const char *key = tok.key;
+    const char *value = tok.value;
 
     // Parse key-value pairs
     if (strcmp(key, "Type") == 0) {
-      if (strcmp(value, "Application") != 0) {
-        fclose(file);
+      if (strcmp(value, "Application") != 0)
         return 0; // Not an application, skip
-      }
       type_is_application = true;
     } else if (strcmp(key, "Name") == 0) {
       strncpy(entry->name, value, sizeof(entry->name) - 1);
@@ -188,11 +284,11 @@ int parse_desktop_file(const char *filename, struct DesktopEntry *entry) {
       entry->hidden = (strcmp(value, "true") == 0);
     } else if (strcmp(key, "NoDisplay") == 0) {
       entry->nodisplay = (strcmp(value, "true") == 0);
+    } else if (strcmp(key, "DBusActivatable") == 0) {
+      entry->dbus_activatable = (strcmp(value, "true") == 0);
     }
   }
 
-  fclose(file);
-
   // Validate required fields
   if (type_is_application && strlen(entry->name) > 0 &&
       strlen(entry->exec) > 0) {
@@ -203,7 +299,8 @@ int parse_desktop_file(const char *filename, struct DesktopEntry *entry) {
 }
 
 /**
- * Checks if a program exists in PATH via TryExec field
+ * Checks if a program exists in PATH via TryExec field. PATH is searched
+ * directly, without a shell per entry, so audits of many users stay fast
  * @param tryexec Program name to check
  * @return 1 if executable exists, 0 otherwise
  */
@@ -211,19 +308,24 @@ int check_tryexec(const char *tryexec) {
   if (strlen(tryexec) == 0)
     return 1;
 
-  // Use which command to check existence in PATH
-  char command[MAX_PATH];
-  snprintf(command, sizeof(command), "command -v %s > /dev/null 2>&1", tryexec);
-  return (system(command) == 0);
+  struct stat st;
+  return program_find(tryexec, &st) == 0;
 }
 
 /**
- * Executes a command using fork() and execvp()
- * Uses wordexp() for proper shell expansion and argument parsing
+ * Executes a command through the zygote spawner, or fork() when the
+ * spawner is not available
  * @param exec_cmd Command string to execute
  * @param work_dir Working directory for the command (NULL for current)
+ * @param attr Resource knobs for the child (NULL for none)
+ * @param pidfd Receives the pidfd of the child the zygote passed back,
+ *              -1 if there is none; may be NULL
+ * @return Child pid, 0 on failure
  */
-int run_command(const char *exec_cmd, const char *work_dir) {
+pid_t run_command(const char *exec_cmd, const char *work_dir,
+                  const struct SpawnAttr *attr, int *pidfd) {
+  if (pidfd)
+    *pidfd = -1;
   if (!exec_cmd || !*exec_cmd) {
     return 0;
   }
@@ -235,71 +337,376 @@ int run_command(const char *exec_cmd, const char *work_dir) {
   // Remove desktop file specifiers
   remove_desktop_specifiers(cmd);
 
-  pid_t pid = fork();
+  // Execute with sh
+  struct SpawnRequest req = {.argv = {"sh", "-c", cmd, NULL},
+                             .argc = 3,
+                             .cwd = work_dir};
+  if (attr)
+    req.attr = *attr;
+
+  pid_t pid = -1;
+  if (spawner_active())
+    pid = spawner_spawn(&req, pidfd);
+
+  if (pid <= 0) {
+    pid = fork();
+    if (pid == 0)
+      spawn_exec(&req);
+  }
 
-  if (pid == 0) {
-    // Ignore signals that could cause coredump (из оригинального кода)
-    signal(SIGSEGV, SIG_IGN);
-    signal(SIGABRT, SIG_IGN);
-    signal(SIGILL, SIG_IGN);
-
-    // Start new session to detach from terminal
-    setsid();
-
-    // Change working directory if specified
-    if (work_dir && *work_dir) {
-      if (chdir(work_dir) != 0) {
-        // Error message before closing descriptors
-        fprintf(stderr, "Failed to chdir to %s: %s\n", work_dir,
-                strerror(errno));
-      }
+  return pid > 0 ? pid : 0;
+}
+
+/**
+ * Fills spawn knobs from the config rule of an application
+ * @param s Session
+ * @param de Desktop entry
+ * @param attr Output spawn attributes
+ */
+static void app_spawn_attr(struct Session *s, const struct DesktopEntry *de,
+                           struct SpawnAttr *attr) {
+  memset(attr, 0, sizeof(*attr));
+
+  struct AppRule *rule = entry_rule(&s->cfg, de);
+
+  // Startup boost: critical apps at full capacity, the others capped
+  if (s->boosting && rule && rule->critical) {
+    attr->uclamp_min = UCLAMP_SCALE;
+    attr->uclamp_max = UCLAMP_SCALE;
+  } else if (s->boosting && s->cfg.background_uclamp < UCLAMP_SCALE) {
+    attr->uclamp_max = s->cfg.background_uclamp;
+  }
+
+  // Stop before exec, perf_resume() attaches the counters
+  if (s->perf_stops && !s->perf_off)
+    attr->hold_until_ms = now_ms() + PERF_HOLD_MS;
+
+  // Background apps get a cgroup of their own to be reclaimed through
+  if (*s->reclaim_cgroup && (!rule || !rule->critical))
+    attr->cgroup = s->reclaim_cgroup;
+
+  if (!rule)
+    return;
+
+  attr->nice = rule->nice;
+  attr->ksm = rule->ksm;
+  for (int i = 0; i < rule->env_count && i < SPAWN_MAX_ENV; i++)
+    attr->env[attr->env_count++] = rule->env[i];
+}
+
+/**
+ * Checks whether the terminal server process has exited
+ * @param status Receives its wait status, -1 if unknown
+ * @return 1 if exited, 0 if still running
+ */
+static int terminal_server_exited(struct Session *s, int *status) {
+  for (size_t i = 0; i < s->children.count; i++) {
+    const struct Child *c = &s->children.items[i];
+    if (c->pid == s->terminal_server_pid && c->exited) {
+      *status = c->status;
+      return 1;
     }
+  }
 
-    // Close standard file descriptors
-    close(STDIN_FILENO);
-    close(STDOUT_FILENO);
-    close(STDERR_FILENO);
+  pid_t r = waitpid(s->terminal_server_pid, status, WNOHANG);
+  if (r < 0)
+    *status = -1;
+  return r != 0;
+}
+
+/**
+ * Checks once, without waiting, whether the terminal server listens on
+ * its socket. A server that exited successfully forked into the
+ * background and counts as ready; one that is not listening
+ * TERMINAL_SERVER_WAIT_MS after its start has failed.
+ * @param s Session
+ */
+static void terminal_server_check(struct Session *s) {
+  if (s->terminal_server != TERM_SERVER_STARTING)
+    return;
 
-    // Execute with sh
-    execlp("sh", "sh", "-c", cmd, (char *)NULL);
-    execlp("bash", "bash", "-c", cmd, (char *)NULL);
+  int status;
+  if (proc_listening(s->terminal_server_pid))
+    s->terminal_server = TERM_SERVER_READY;
+  else if (terminal_server_exited(s, &status))
+    s->terminal_server =
+        status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0
+            ? TERM_SERVER_READY
+            : TERM_SERVER_FAILED;
+  else if (now_ms() >= s->terminal_server_started_ms + TERMINAL_SERVER_WAIT_MS)
+    s->terminal_server = TERM_SERVER_FAILED;
+  else
+    return;
 
-    // Exec failed
-    _exit(EXIT_FAILURE);
+  if (s->terminal_server == TERM_SERVER_FAILED)
+    fprintf(stderr, "Warning: Terminal server %s not ready, using %s\n",
+            s->cfg.terminal_server, s->cfg.terminal);
+  if (s->terminal_exit) {
+    reactor_remove(s->terminal_exit);
+    s->terminal_exit = NULL;
   }
+}
 
-  return (pid > 0);
+/**
+ * Settles the terminal server state as soon as the server exits
+ */
+static void on_terminal_exit(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  terminal_server_check(src->data);
 }
 
 /**
- * Scans an autostart directory and queues valid .desktop applications
- * @param autostart_dir Directory to scan for .desktop files
- * @param dir_index Index of directory for reporting
- * @return Number of applications queued from this directory
+ * Starts the configured terminal server once, so that every Terminal=true
+ * entry can be opened as a cheap client instead of a full terminal. Its
+ * readiness is checked from the launch timer and its pidfd, see
+ * terminal_server_check().
+ * @param s Session
+ * @return 1 if the server was started, 0 otherwise
  */
-int scan_autostart_dir(const char *autostart_dir, int dir_index) {
-  DIR *dir = opendir(autostart_dir);
+static int start_terminal_server(struct Session *s) {
+  if (s->terminal_server != TERM_SERVER_NONE)
+    return s->terminal_server != TERM_SERVER_FAILED;
+  if (!*s->cfg.terminal_server || !*s->cfg.terminal_client)
+    return 0;
 
-  if (!dir) {
-    fprintf(stderr, "\nWarning: Autostart directory does not exist: %s\n",
-            autostart_dir);
+  int pidfd;
+  pid_t pid = run_command(s->cfg.terminal_server, NULL, NULL, &pidfd);
+  s->terminal_server = pid > 0 ? TERM_SERVER_STARTING : TERM_SERVER_FAILED;
+  s->terminal_server_pid = pid;
+  s->terminal_server_started_ms = now_ms();
+  // Tracked always, so that its exit status tells whether it came up
+  if (pid > 0) {
+    struct Child *c = track_child(s, pid, pidfd, s->cfg.terminal_server, NULL);
+    int exitfd = c->pidfd >= 0 ? fcntl(c->pidfd, F_DUPFD_CLOEXEC, 0) : -1;
+    if (exitfd >= 0)
+      s->terminal_exit =
+          reactor_add(&s->reactor, exitfd, 1, on_terminal_exit, s);
+  }
+  say(s, "Terminal server %s: %s\n", pid > 0 ? "started" : "failed",
+      s->cfg.terminal_server);
+  return pid > 0;
+}
+
+/**
+ * Builds the command line for an entry, wrapping Terminal=true entries
+ * into the terminal client (once the server is ready) or the terminal.
+ * Entries waiting for the server are held by launch_next().
+ * @param s Session
+ * @param de Desktop entry to launch
+ * @param buf Output buffer for the command line
+ * @param size Size of the output buffer
+ */
+static void build_command(struct Session *s, const struct DesktopEntry *de,
+                          char *buf, size_t size) {
+  if (!de->terminal) {
+    snprintf(buf, size, "%s", de->exec);
+    return;
+  }
+
+  const char *term = s->terminal_server == TERM_SERVER_READY
+                         ? s->cfg.terminal_client
+                         : s->cfg.terminal;
+  snprintf(buf, size, "%s %s", term, de->exec);
+}
+
+/**
+ * Finds the config rule of an entry by name, desktop file ID or Exec
+ * program
+ * @param cfg Configuration
+ * @param de Desktop entry
+ * @return Matching rule, NULL if none
+ */
+struct AppRule *entry_rule(struct Config *cfg, const struct DesktopEntry *de) {
+  char exec[256];
+  exec_basename(de->exec, exec, sizeof(exec));
+  return config_match_app(cfg, de->name, de->id, exec);
+}
+
+/**
+ * Checks whether an entry's program already runs in a user process. The
+ * process index is built once, on the first check of the session.
+ * @param s Session
+ * @param de Desktop entry
+ * @return 1 if running, 0 if not or unknown
+ */
+static int entry_running(struct Session *s, const struct DesktopEntry *de) {
+  struct ProcKey key;
+  if (exec_program_key(de->exec, &key) != 0)
+    return 0;
+
+  if (!s->running_indexed) {
+    proc_index_build(&s->running);
+    s->running_indexed = 1;
+    say(s, "Running processes indexed: %zu executables\n", s->running.count);
+  }
+  return proc_index_has(&s->running, &key);
+}
+
+/**
+ * Checks whether a DBusActivatable entry can be left to the session bus.
+ * Entries the bus could not start are launched as usual.
+ * @param s Session
+ * @param de Desktop entry
+ * @param rule Matching config rule, NULL if none
+ * @return 1 if the bus activates the entry on demand, 0 to launch it
+ */
+static int entry_bus_activated(struct Session *s,
+                               const struct DesktopEntry *de,
+                               const struct AppRule *rule) {
+  enum DbusPolicy policy = config_app_dbus(&s->cfg, rule);
+  char name[256], service[MAX_PATH];
+
+  if (!de->dbus_activatable || policy == DBUS_LAUNCH)
+    return 0;
+
+  if (dbus_name_from_id(de->id, name, sizeof(name)) != 0 ||
+      dbus_service_file(name, s->data_home, service, sizeof(service)) != 0) {
+    say(s, "  No D-Bus activation file for %s, launching\n", de->name);
     return 0;
   }
 
-  printf("\n[Directory %d] Scanning: %s\n", dir_index + 1, autostart_dir);
+  if (policy == DBUS_PING) {
+    if (!s->bus_listed) {
+      s->bus_listed = 1;
+      if (dbus_list_activatable(&s->bus_names) == 0)
+        say(s, "Session bus activates %zu names\n", s->bus_names.count);
+      else
+        say(s, "Session bus not reachable\n");
+    }
+    if (!dbus_names_has(&s->bus_names, name)) {
+      say(s, "  Session bus can't activate %s, launching\n", name);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Checks whether the restore policy holds an entry back: the user closed
+ * it before the last supervised session ended, and no always:1 rule
+ * matches it
+ * @param s Session (history loaded)
+ * @param de Desktop entry
+ * @return 1 if held back, 0 to launch it as usual
+ */
+static int entry_closed(struct Session *s, const struct DesktopEntry *de) {
+  if (s->cfg.restore == RESTORE_OFF || !history_closed(&s->history, de->id))
+    return 0;
+
+  const struct AppRule *rule = entry_rule(&s->cfg, de);
+  return !rule || !rule->always;
+}
+
+/**
+ * Decides whether a parsed entry may be launched
+ * @param s Session (config rules)
+ * @param de Parsed desktop entry
+ * @return SKIP_NONE if the entry is eligible, otherwise why it is not
+ */
+enum SkipReason entry_skip_reason(struct Session *s,
+                                  const struct DesktopEntry *de) {
+  // Skip hidden or no-display entries
+  if (de->hidden || de->nodisplay)
+    return SKIP_HIDDEN;
+
+  struct AppRule *rule = entry_rule(&s->cfg, de);
+  if (rule && !rule->allow)
+    return SKIP_CONFIG;
+
+  // Check if TryExec exists
+  if (!check_tryexec(de->tryexec))
+    return SKIP_TRYEXEC;
+
+  if (entry_bus_activated(s, de, rule))
+    return SKIP_DBUS;
+
+  if (s->cfg.skip_running && !s->ignore_running && entry_running(s, de))
+    return SKIP_RUNNING;
+
+  if (s->cfg.quarantine == QUARANTINE_SKIP &&
+      history_quarantined(&s->history, &s->cfg, de->id) &&
+      !history_retry_due(&s->history, &s->cfg, de->id))
+    return SKIP_QUARANTINED;
+
+  if (s->cfg.restore == RESTORE_SKIP && entry_closed(s, de))
+    return SKIP_CLOSED;
+
+  return SKIP_NONE;
+}
+
+/**
+ * @param reason Skip reason
+ * @return Human readable reason
+ */
+const char *skip_reason_str(enum SkipReason reason) {
+  switch (reason) {
+  case SKIP_HIDDEN:
+    return "hidden/no-display";
+  case SKIP_CONFIG:
+    return "disallowed by config";
+  case SKIP_TRYEXEC:
+    return "TryExec not found";
+  case SKIP_RUNNING:
+    return "already running";
+  case SKIP_QUARANTINED:
+    return "quarantined, see --report";
+  case SKIP_DBUS:
+    return "D-Bus activated on demand";
+  case SKIP_CLOSED:
+    return "closed in the last session";
+  default:
+    return "eligible";
+  }
+}
+
+/**
+ * Applies hidden/config/TryExec filters to a parsed entry and queues it
+ * @param s Session
+ * @param de Parsed desktop entry
+ * @return 1 if queued, 0 if skipped
+ */
+int queue_entry(struct Session *s, const struct DesktopEntry *de) {
+  enum SkipReason reason = entry_skip_reason(s, de);
+
+  if (reason != SKIP_NONE) {
+    // Checked again when the session ends, the user may start it by hand
+    if (reason == SKIP_CLOSED)
+      app_queue_add(&s->closed, *de);
+    say(s, "  Skipped (%s): %s\n", skip_reason_str(reason), de->name);
+    emit(s, EVENT_SKIPPED, de, 0);
+    return 0;
+  }
+
+  app_queue_add(&s->queue, *de);
+  say(s, "  Queued: %s\n", de->name);
+  emit(s, EVENT_QUEUED, &s->queue.apps[s->queue.count - 1], 0);
+  return 1;
+}
+
+/**
+ * Parses every application entry of a directory without filtering
+ * @param autostart_dir Directory to parse
+ * @param out Queue receiving the valid entries
+ * @param found Receives the number of .desktop files, valid or not
+ * @return Number of entries parsed, -1 if the directory can't be opened
+ */
+int parse_autostart_files(const char *autostart_dir, struct AppQueue *out,
+                          int *found) {
+  *found = 0;
+  DIR *dir = opendir(autostart_dir);
+  if (!dir)
+    return -1;
 
   struct dirent *entry;
-  int total_found = 0;
-  int queued = 0;
+  int parsed = 0;
 
   while ((entry = readdir(dir)) != NULL) {
     // Only process .desktop files
     const char *ext = strrchr(entry->d_name, '.');
-    if (!ext || strcmp(ext, ".desktop") != 0) {
+    if (!ext || strcmp(ext, ".desktop") != 0)
       continue;
-    }
 
-    total_found++;
+    (*found)++;
 
     char full_path[MAX_PATH];
     snprintf(full_path, sizeof(full_path), "%s/%s", autostart_dir,
@@ -307,168 +714,1020 @@ int scan_autostart_dir(const char *autostart_dir, int dir_index) {
 
     struct DesktopEntry de;
     if (parse_desktop_file(full_path, &de) && de.valid) {
-      // Skip hidden or no-display entries
-      if (de.hidden || de.nodisplay) {
-        printf("  Skipped (hidden/no-display): %s\n", de.name);
-        continue;
-      }
+      app_queue_add(out, de);
+      parsed++;
+    }
+  }
 
-      int allowed = 1;
-      for (int i = 0; i < cfg.app_count; i++) {
-        if (strcmp(cfg.apps[i].name, de.name) == 0) {
-          allowed = cfg.apps[i].allow;
-          break;
-        }
-      }
+  closedir(dir);
+  return parsed;
+}
 
-      if (!allowed) {
-        printf("  Skipped (disallowed by config): %s\n", de.name);
-        continue;
-      }
+/**
+ * Parses every application entry of a directory without filtering
+ * @param autostart_dir Directory to parse
+ * @param out Queue receiving the valid entries
+ * @return Number of entries parsed, -1 if the directory can't be opened
+ */
+int parse_autostart_dir(const char *autostart_dir, struct AppQueue *out) {
+  int found;
+  return parse_autostart_files(autostart_dir, out, &found);
+}
 
-      // Check if TryExec exists
-      if (!check_tryexec(de.tryexec)) {
-        printf("  Skipped (TryExec not found): %s\n", de.name);
-        continue;
-      }
+/**
+ * Filters and queues the parsed entries of one directory and prints its
+ * summary
+ * @param s Session
+ * @param autostart_dir Directory the entries come from
+ * @param entries Parsed entries
+ * @param count Number of entries
+ * @param found Number of .desktop files in the directory
+ * @return Number of applications queued
+ */
+static int queue_dir_entries(struct Session *s, const char *autostart_dir,
+                             const struct DesktopEntry *entries, size_t count,
+                             int found) {
+  int queued = 0;
+  for (size_t i = 0; i < count; i++)
+    queued += queue_entry(s, &entries[i]);
 
-      // Add to queue if there's space
-      app_queue_add(&app_queue, de);
-      printf("  Queued: %s\n", de.name);
-    }
-  }
+  say(s, "\n  --- Summary for %s ---\n", autostart_dir);
+  say(s, "  Total .desktop files found: %d\n", found);
+  say(s, "  Queued for launch: %d\n", queued);
+  say(s, "  Skipped: %d\n", found - queued);
 
-  closedir(dir);
+  return queued;
+}
+
+static void warn_missing_dir(struct Session *s, const char *autostart_dir) {
+  if (s->out)
+    fprintf(stderr, "\nWarning: Autostart directory does not exist: %s\n",
+            autostart_dir);
+}
+
+/**
+ * Scans an autostart directory and queues valid .desktop applications
+ * @param s Session
+ * @param autostart_dir Directory to scan for .desktop files
+ * @param dir_index Index of directory for reporting
+ * @return Number of applications queued from this directory
+ */
+int scan_autostart_dir(struct Session *s, const char *autostart_dir,
+                       int dir_index) {
+  if (config_dir_blocked(&s->cfg, autostart_dir)) {
+    say(s, "\n[Directory %d] Blocked by config: %s\n", dir_index + 1,
+        autostart_dir);
+    return 0;
+  }
 
-  printf("\n  --- Summary for %s ---\n", autostart_dir);
-  printf("  Total .desktop files found: %d\n", total_found);
-  printf("  Queued for launch: %d\n", queued);
-  printf("  Skipped: %d\n", total_found - queued);
+  struct AppQueue parsed;
+  int found;
+  app_queue_init(&parsed);
+  if (parse_autostart_files(autostart_dir, &parsed, &found) < 0) {
+    free(parsed.apps);
+    warn_missing_dir(s, autostart_dir);
+    return 0;
+  }
 
+  say(s, "\n[Directory %d] Scanning: %s\n", dir_index + 1, autostart_dir);
+  int queued =
+      queue_dir_entries(s, autostart_dir, parsed.apps, parsed.count, found);
+  free(parsed.apps);
   return queued;
 }
 
 /**
- * Launches all queued applications using threads with staggered delays
+ * Queues a directory that a worker returned after the launch started
  */
-void launch_queued_apps() {
-  int success_count = 0;
+static void merge_late_dir(void *data, struct ScanDir *d) {
+  struct Session *s = data;
 
-  if (app_queue.count == 0) {
-    printf("\nNo applications to launch.\n");
+  if (d->state != SCAN_DONE || d->found < 0)
     return;
-  }
+  say(s, "\n[Directory %d] Responded after %ldms: %s\n", d->index + 1,
+      now_ms() - d->started_ms, d->path);
+  queue_dir_entries(s, d->path, d->entries, d->count, d->found);
+}
 
-  printf("\n========================================\n");
-  printf("Launching %ld apps with %dms delay\n", app_queue.count, cfg.delay_ms);
+/**
+ * Scans the session directories, each on its own worker, and queues the
+ * ones that answer within scan_timeout in directory order. Directories
+ * still pending are left to merge_late_dir().
+ * @param s Session
+ */
+static void scan_dirs_parallel(struct Session *s) {
+  long deadline = now_ms() + s->cfg.scan_timeout_ms;
 
-  // Create a thread for each application
-  for (size_t i = 0; i < app_queue.count; i++) {
-    int delay = i ? cfg.delay_ms : cfg.startup_delay_ms;
-    // Sleep for the calculated delay
-    struct timespec ts = {.tv_sec = delay / 1000,
-                          .tv_nsec = (delay % 1000) * 1000000L};
-    nanosleep(&ts, NULL);
+  for (size_t i = 0; i < s->dirs.count; i++)
+    if (!config_dir_blocked(&s->cfg, s->dirs.values[i]))
+      scan_add(&s->scan, &s->reactor, s->dirs.values[i], i);
 
-    printf("[%ld/%ld] ", i + 1, app_queue.count);
+  while (s->scan.pending > 0 && !s->stopping) {
+    long left = deadline - now_ms();
+    if (left <= 0 || reactor_poll(&s->reactor, (int)left) < 0)
+      break;
+  }
 
-    if (run_command(app_queue.apps[i].exec, app_queue.apps[i].path)) {
-      printf("Access ");
-      success_count++;
+  for (size_t i = 0; i < s->dirs.count; i++) {
+    const char *path = s->dirs.values[i];
+    struct ScanDir *d = scan_find(&s->scan, i);
+
+    // Blocked, or no worker could be started
+    if (!d) {
+      scan_autostart_dir(s, path, i);
+    } else if (d->state == SCAN_PENDING) {
+      fprintf(stderr,
+              "\nWarning: %s not scanned within %dms, launching without it\n",
+              path, s->cfg.scan_timeout_ms);
+    } else if (d->state == SCAN_FAILED) {
+      fprintf(stderr, "\nWarning: Scanning %s failed\n", path);
+    } else if (d->found < 0) {
+      warn_missing_dir(s, path);
     } else {
-      printf("Deny ");
+      say(s, "\n[Directory %zu] Scanning: %s\n", i + 1, path);
+      queue_dir_entries(s, path, d->entries, d->count, d->found);
     }
-    printf("launching: %s\n", app_queue.apps[i].name);
   }
 
-  printf("========================================\n");
-  printf("Launch completed\n");
-  printf("Total:      %ld\n", app_queue.count);
-  printf("Successful: %d\n", success_count);
-  printf("Failed:     %ld\n", app_queue.count - success_count);
+  s->scan.on_done = merge_late_dir;
+  s->scan.data = s;
 }
 
-/*
- * Initialier array of autostart directories
- * @param a dynamic array of autostart dirs
- * @return None
+/**
+ * Reaps the prefetch worker
  */
-void autostart_dirs_init(struct Array *a) {
-  int size = 5;
+static void on_prefetch_exit(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  waitpid((pid_t)(intptr_t)src->data, NULL, WNOHANG);
+  reactor_remove(src);
+}
 
-  a->values = malloc(size * sizeof(char *));
-  if (!a->values) {
+/**
+ * Queues readahead of icons and shared GUI caches of all queued apps,
+ * so the files are warm by the time the apps start after their delays.
+ * Resolving the icons reads theme caches and index files, so it runs in
+ * a worker process and the launch doesn't wait for it.
+ * @param s Session
+ * @param home User home directory
+ */
+void prefetch_queued_assets(struct Session *s, const char *home) {
+  if (s->out)
+    fflush(s->out);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return;
+  }
+  if (pid == 0) {
+    prefetch_gui_caches(home);
+    for (size_t i = 0; i < s->queue.count; i++)
+      prefetch_icon(s->cfg.icon_theme, s->queue.apps[i].icon);
+    _exit(0);
+  }
+
+  // Without pidfds the worker is reaped with the other children
+  int pidfd = sys_pidfd_open(pid, 0);
+  if (pidfd >= 0)
+    reactor_add(&s->reactor, pidfd, 1, on_prefetch_exit,
+                (void *)(intptr_t)pid);
+
+  say(s, "\nPrefetching icons of %zu apps in the background\n",
+      s->queue.count);
+}
+
+/**
+ * Ends the startup boost: resets the clamps of everything the launched
+ * applications run by now
+ * @param s Session
+ */
+static void boost_end(struct Session *s) {
+  if (!s->boosting)
+    return;
+  s->boosting = 0;
+  reactor_remove(s->boost_timer);
+  s->boost_timer = NULL;
+
+  pid_t *sessions = malloc((s->children.count + 1) * sizeof(*sessions));
+  if (!sessions) {
     perror("malloc");
     exit(1);
   }
-  a->count = 0;
-  a->capacity = size;
+
+  // Helpers may outlive an exited application in its session
+  size_t count = 0;
+  for (size_t i = 0; i < s->children.count; i++)
+    if (*s->children.items[i].id)
+      sessions[count++] = s->children.items[i].pid;
+
+  size_t threads = boost_release(sessions, count);
+  free(sessions);
+  say(s, "Startup boost released: %zu threads\n", threads);
 }
 
-/*
- * Initialier array of autostart directories
- * @param a dynamic array of autostart dirs
- * @param path directory to copy in array
- * @return None
+static void on_boost_timer(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  boost_end(src->data);
+}
+
+/**
+ * Waits until critical applications had their boost_time after their
+ * launch, or for a stop request, and releases the boost
+ * @param s Session
  */
-void autostart_dirs_add(struct Array *a, const char *path) {
-  if (a->count == a->capacity) {
-    a->capacity *= 2;
-    char **tmp = realloc(a->values, a->capacity * sizeof(char *));
-    if (!tmp) {
-      perror("realloc");
-      exit(1);
+void boost_finish(struct Session *s) {
+  while (s->boosting && !s->stopping)
+    if (reactor_poll(&s->reactor, -1) < 0)
+      break;
+  boost_end(s);
+}
+
+/**
+ * Starts the startup boost when a queued entry is critical. It ends
+ * boost_time after the last critical launch.
+ * @param s Session
+ */
+static void boost_begin(struct Session *s) {
+  if (s->cfg.boost_time_ms <= 0)
+    return;
+
+  int critical = 0;
+  for (size_t i = 0; i < s->queue.count && !critical; i++) {
+    const struct AppRule *rule = entry_rule(&s->cfg, &s->queue.apps[i]);
+    critical = rule && rule->critical;
+  }
+  if (!critical)
+    return;
+
+  // Without a timer the clamps could never be released
+  s->boost_timer = reactor_timer(&s->reactor, on_boost_timer, s);
+  if (!s->boost_timer)
+    return;
+  s->boosting = 1;
+  reactor_timer_set(s->boost_timer, now_ms() + s->cfg.boost_time_ms);
+  say(s, "Boosting critical apps for %dms\n", s->cfg.boost_time_ms);
+}
+
+/**
+ * Reports once why ksm:1 rules of queued entries won't merge anything
+ * @param s Session
+ */
+static void ksm_check(struct Session *s) {
+  int ksm = 0;
+  for (size_t i = 0; i < s->queue.count && !ksm; i++) {
+    const struct AppRule *rule = entry_rule(&s->cfg, &s->queue.apps[i]);
+    ksm = rule && rule->ksm;
+  }
+  if (!ksm)
+    return;
+
+  char why[128];
+  int state = ksm_probe(why, sizeof(why));
+  if (state < 0)
+    fprintf(stderr, "ksm:1 has no effect: %s\n", why);
+  else if (state == 0)
+    fprintf(stderr, "ksm:1 apps are mergeable, but %s\n", why);
+}
+
+/**
+ * @return 1 while a cold start window is still counting, or an
+ *         application waits to be attached one
+ */
+static int perf_counting(const struct Session *s) {
+  for (size_t i = 0; i < s->children.count; i++) {
+    const struct Child *c = &s->children.items[i];
+    if (c->perf.until_ms || (c->held_until_ms && !c->held_late))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Reads the cold start counters whose window ended, stores them in the
+ * history right away, a supervised session may be killed before its
+ * end, and arms the timer for the next window or hold deadline
+ * @param s Session
+ * @param all Read every counter, e.g. on a stop request
+ */
+static void perf_collect(struct Session *s, int all) {
+  long now = now_ms(), next = 0;
+  int read = 0;
+
+  for (size_t i = 0; i < s->children.count; i++) {
+    struct Child *c = &s->children.items[i];
+    if (c->held_until_ms && !c->held_late &&
+        (!next || c->held_until_ms < next))
+      next = c->held_until_ms;
+    long until = c->perf.until_ms;
+    if (!until)
+      continue;
+    if (!all && until > now) {
+      if (!next || until < next)
+        next = until;
+      continue;
     }
-    a->values = tmp;
+
+    perfstat_read(&c->perf);
+    read = 1;
+    const long long *v = c->perf.value;
+    say(s, "Cold start of %s: %lldms CPU, %lld faults (%lld major)", c->name,
+        v[PSTAT_TASK_CLOCK], v[PSTAT_FAULTS], v[PSTAT_MAJOR_FAULTS]);
+    if (v[PSTAT_CSWITCHES] >= 0)
+      say(s, ", %lld switches", v[PSTAT_CSWITCHES]);
+    if (v[PSTAT_CYCLES] > 0 && v[PSTAT_INSTRUCTIONS] >= 0)
+      say(s, ", %.2f IPC",
+          (double)v[PSTAT_INSTRUCTIONS] / v[PSTAT_CYCLES]);
+    say(s, "\n");
   }
 
-  a->values[a->count] = strdup(path);
-  if (!a->values[a->count]) {
-    perror("strdup");
-    exit(1);
+  if (read && s->home) {
+    history_perf(&s->history, &s->children);
+    if (history_save(&s->history, s->home) != 0)
+      perror("history");
+  }
+  if (next && s->perf_timer)
+    reactor_timer_set(s->perf_timer, next);
+}
+
+/**
+ * Attaches the cold start counters to the held applications that
+ * stopped themselves right before exec (SpawnAttr.hold_until_ms), and
+ * lets them go on. One that did not stop by its deadline goes on
+ * uncounted; the launcher never blocks on it.
+ * @param s Session
+ */
+static void perf_resume(struct Session *s) {
+  long now = now_ms();
+
+  for (size_t i = 0; i < s->children.count; i++) {
+    struct Child *c = &s->children.items[i];
+    if (!c->held_until_ms)
+      continue;
+    if (c->exited) {
+      c->held_until_ms = 0;
+      continue;
+    }
+
+    // Look for the stop without reaping, an early death is reaped as usual
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, c->pid, &info,
+               WSTOPPED | WEXITED | WNOWAIT | WNOHANG) == 0 &&
+        info.si_pid == 0) {
+      if (!c->held_late && now >= c->held_until_ms) {
+        fprintf(stderr, "%s did not reach exec within %dms, its cold start "
+                        "is not counted\n",
+                c->name, PERF_HOLD_MS);
+        c->held_late = 1;
+        kill(c->pid, SIGCONT);
+      }
+      continue;
+    }
+
+    if (info.si_code == CLD_STOPPED) {
+      if (!c->held_late && !s->perf_off &&
+          perfstat_attach(&c->perf, c->pid, now + s->cfg.perf_window_ms) <
+              0) {
+        fprintf(stderr, "Cold start counters not available: %s\n",
+                strerror(errno));
+        s->perf_off = 1;
+      }
+      kill(c->pid, SIGCONT);
+    }
+    c->held_until_ms = 0;
   }
-  a->count++;
 }
 
-int main(int argc, char **argv) {
-  // Get home directory
-  const char *home = getenv("HOME");
-  if (!home) {
-    struct passwd *pw = getpwuid(getuid());
-    home = pw->pw_dir;
+/**
+ * Lets every application still held go on, uncounted, before the
+ * launcher leaves: nothing else would continue it. One that stops only
+ * after this gets SIGCONT as its parent death signal.
+ * @param s Session
+ */
+static void perf_release(struct Session *s) {
+  for (size_t i = 0; i < s->children.count; i++) {
+    struct Child *c = &s->children.items[i];
+    if (c->held_until_ms && !c->exited)
+      kill(c->pid, SIGCONT);
+    c->held_until_ms = 0;
   }
+}
 
-  config_init(&cfg);
+static void on_perf_timer(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  perf_resume(src->data);
+  perf_collect(src->data, 0);
+}
+
+static void on_perf_stop(struct ReactorSource *src, uint32_t signo) {
+  (void)signo;
+  perf_resume(src->data);
+  perf_collect(src->data, 0);
+}
+
+/**
+ * Ends the cold start counting of a session: lets held applications go
+ * and restores the signal mask perf_watch() found
+ * @param s Session
+ */
+static void perf_unwatch(struct Session *s) {
+  perf_release(s);
+  if (s->perf_stops)
+    reactor_remove(s->perf_stops);
+  if (s->perf_timer)
+    reactor_remove(s->perf_timer);
+  s->perf_stops = s->perf_timer = NULL;
+  sigprocmask(SIG_SETMASK, &s->perf_mask, NULL);
+}
+
+/**
+ * Prepares the cold start counters before the launch: window ends and
+ * hold deadlines come from a timer, the stops of held applications as
+ * SIGCHLD. Without either, applications are not held. SIGCHLD is
+ * blocked process-wide until perf_unwatch(), so only the launcher binary
+ * counts cold starts; libautostart leaves the signals of its host alone.
+ * @param s Session
+ */
+static void perf_watch(struct Session *s) {
+  // Launched applications get an empty mask again in spawn_exec()
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &s->perf_mask);
+
+  s->perf_timer = reactor_timer(&s->reactor, on_perf_timer, s);
+  s->perf_stops = reactor_signals(&s->reactor, &mask, on_perf_stop, s);
+  if (!s->perf_timer || !s->perf_stops) {
+    perror("perf_window");
+    s->perf_off = 1;
+    perf_unwatch(s);
+  }
+}
+
+
+/**
+ * Waits for a launched application to stop before exec, through the
+ * session reactor, to attach its cold start counters
+ * @param s Session
+ * @param c The application
+ * @param hold_until_ms Its SpawnAttr.hold_until_ms
+ */
+static void perf_begin(struct Session *s, struct Child *c,
+                       long hold_until_ms) {
+  c->held_until_ms = hold_until_ms + PERF_HOLD_SLACK_MS;
+  perf_resume(s);
+  perf_collect(s, 0);
+}
+
+/* State of the launch loop, advanced by its timer */
+struct Launch {
+  struct Session *s;
+  size_t next;   // next entry to launch
+  long deadline; // its absolute launch time, CLOCK_MONOTONIC ms
+  int armed;     // timer set for the next entry
+  int held;      // waited for the entries before the quarantined ones
+  int success;
+};
+
+/**
+ * Launches the next queued entry and arms the timer for the one after
+ * it. Deadlines add up from the previous deadline, not from the time
+ * the launch finished, so output and spawn time don't accumulate. A
+ * Terminal=true entry waits, on the same timer, until the terminal
+ * server is ready or has failed.
+ */
+static void launch_next(struct ReactorSource *timer, uint32_t expirations) {
+  (void)expirations;
+  struct Launch *l = timer->data;
+  struct Session *s = l->s;
+  struct AppQueue *queue = &s->queue;
+  const struct DesktopEntry *de = &queue->apps[l->next];
+
+  if (de->terminal) {
+    terminal_server_check(s);
+    if (s->terminal_server == TERM_SERVER_STARTING) {
+      reactor_timer_set(timer, now_ms() + TERMINAL_SERVER_POLL_MS);
+      return;
+    }
+  }
+  l->next++;
 
-  if (argc > 1)
-    config_load(&cfg, argv[1]);
+  say(s, "[%zu/%zu] ", l->next, queue->count);
+
+  char cmd[MAX_PATH];
+  struct SpawnAttr attr;
+  build_command(s, de, cmd, sizeof(cmd));
+  app_spawn_attr(s, de, &attr);
+
+  int pidfd;
+  pid_t pid = run_command(cmd, de->path, &attr, &pidfd);
+  if (pid) {
+    say(s, "Access ");
+    l->success++;
+    if (s->supervise || s->judge_starts || s->boosting || attr.hold_until_ms) {
+      const struct AppRule *rule = entry_rule(&s->cfg, de);
+      struct Child *c = track_child(s, pid, pidfd, de->name, de->id);
+      c->background = !rule || !rule->critical;
+      if (attr.hold_until_ms)
+        perf_begin(s, c, attr.hold_until_ms);
+    } else if (pidfd >= 0) {
+      close(pidfd);
+    }
+    if (attr.uclamp_min)
+      reactor_timer_set(s->boost_timer, now_ms() + s->cfg.boost_time_ms);
+  } else {
+    say(s, "Deny ");
+  }
+  say(s, "launching: %s\n", de->name);
+  emit(s, pid ? EVENT_LAUNCHED : EVENT_FAILED, de, pid);
+
+  // The first quarantined entry waits in launch_queued_apps()
+  l->armed = 0;
+  if (l->next < queue->count && l->next != s->held_from) {
+    de = &queue->apps[l->next];
+    l->deadline += config_app_delay(&s->cfg, entry_rule(&s->cfg, de), 0);
+    l->armed = reactor_timer_set(timer, l->deadline) == 0;
+  }
+}
+
+/**
+ * Launches all queued applications with staggered delays. The delays
+ * are deadlines of a timer in the session reactor, so child exits and
+ * stop requests are handled while waiting for them. Quarantined entries
+ * at the end of the queue wait until the applications before them have
+ * exited or outlived the crash window.
+ * @param s Session
+ * @return Number of successfully started applications
+ */
+int launch_queued_apps(struct Session *s) {
+  struct AppQueue *queue = &s->queue;
+
+  if (queue->count == 0) {
+    say(s, "\nNo applications to launch.\n");
+    return 0;
+  }
+
+  say(s, "\n========================================\n");
+  say(s, "Launching %zu apps with %dms delay\n", queue->count,
+      s->cfg.delay_ms);
+
+  boost_begin(s);
+  ksm_check(s);
+
+  // Give the terminal server the whole stagger time to come up
+  for (size_t i = 0; i < queue->count; i++) {
+    if (queue->apps[i].terminal) {
+      start_terminal_server(s);
+      break;
+    }
+  }
+
+  struct Launch l = {.s = s};
+  struct ReactorSource *timer = reactor_timer(&s->reactor, launch_next, &l);
+  if (!timer) {
+    perror("timerfd");
+    exit(1);
+  }
+  l.deadline = now_ms() + config_app_delay(&s->cfg,
+                                           entry_rule(&s->cfg, &queue->apps[0]),
+                                           1);
+  l.armed = reactor_timer_set(timer, l.deadline) == 0;
+
+  while (l.next < queue->count && !s->stopping) {
+    if (!l.armed && l.next == s->held_from && l.next > 0 && !l.held) {
+      say(s, "Waiting for %zu apps to start before the quarantined ones\n",
+          l.next);
+      l.held = 1;
+      watch_startup(s, s->cfg.crash_window_ms);
+      if (s->stopping)
+        break;
+      l.deadline = now_ms();
+    }
+    // A late directory queued entries after the last launch
+    if (!l.armed) {
+      const struct DesktopEntry *de = &queue->apps[l.next];
+      l.deadline += config_app_delay(&s->cfg, entry_rule(&s->cfg, de), 0);
+      if (reactor_timer_set(timer, l.deadline) != 0) {
+        perror("timerfd_settime");
+        break;
+      }
+      l.armed = 1;
+    }
+    if (reactor_poll(&s->reactor, -1) < 0) {
+      perror("epoll_wait");
+      break;
+    }
+  }
+  reactor_remove(timer);
 
-  autostart_dirs_init(&autostart_dirs);
-  app_queue_init(&app_queue);
+  int success_count = l.success;
+  if (l.next < queue->count)
+    say(s, "Stop requested, %zu apps not launched\n", queue->count - l.next);
+
+  say(s, "========================================\n");
+  say(s, "Launch completed\n");
+  say(s, "Total:      %zu\n", queue->count);
+  say(s, "Successful: %d\n", success_count);
+  say(s, "Failed:     %zu\n", l.next - success_count);
+
+  return success_count;
+}
+
+/**
+ * Queues every eligible application of a session
+ * @param s Session, initialized, config loaded
+ * @param home User home directory
+ * @param system_entries Pre-parsed system entries, NULL to use the shared
+ *        cache or scan the system directories
+ * @param cache Receives the shared cache mapping, release after use
+ */
+static void session_scan(struct Session *s, const char *home,
+                         const struct AppQueue *system_entries,
+                         struct SysCache *cache) {
+  // Pre-parsed entries cover every system directory, scan them one by
+  // one when the policy blocks some of them
+  int system_blocked = 0;
+  for (size_t i = 0; system_autostart_dirs[i]; i++)
+    system_blocked |= config_dir_blocked(&s->cfg, system_autostart_dirs[i]);
+  if (system_blocked)
+    system_entries = NULL;
+
+  // Share parsed system directories host-wide through the /run cache
+  memset(cache, 0, sizeof(*cache));
+  if (!system_entries && !system_blocked && s->cfg.system_cache) {
+    int mapped = syscache_open(cache);
+    say(s, "System entries %s %s\n", mapped ? "mapped from" : "parsed, cache",
+        SYSCACHE_PATH);
+    system_entries = &cache->entries;
+  }
 
   char buf[MAX_PATH];
 
   snprintf(buf, MAX_PATH, "%s/.config/autostart", home);
-  autostart_dirs_add(&autostart_dirs, buf);
-  autostart_dirs_add(&autostart_dirs, "/etc/xdg/autostart");
-  autostart_dirs_add(&autostart_dirs, "/usr/share/autostart");
-
-  print_config(&cfg);
-  printf("\nScanning directories:\n");
-  for (size_t i = 0; i < autostart_dirs.count; i++) {
-    printf("  %zu. %s\n", i + 1, autostart_dirs.values[i]);
+  autostart_dirs_add(&s->dirs, buf);
+  if (!system_entries)
+    for (size_t i = 0; system_autostart_dirs[i]; i++)
+      autostart_dirs_add(&s->dirs, system_autostart_dirs[i]);
+
+  if (s->out)
+    print_config(&s->cfg);
+  say(s, "\nScanning directories:\n");
+  for (size_t i = 0; i < s->dirs.count; i++) {
+    say(s, "  %zu. %s\n", i + 1, s->dirs.values[i]);
   }
-  printf("\n");
+  say(s, "\n");
 
   // Scan directories and queue applications
-  for (size_t i = 0; i < autostart_dirs.count; i++) {
-    scan_autostart_dir(autostart_dirs.values[i], i);
+  if (s->cfg.scan_timeout_ms > 0)
+    scan_dirs_parallel(s);
+  else
+    for (size_t i = 0; i < s->dirs.count; i++)
+      scan_autostart_dir(s, s->dirs.values[i], i);
+
+  if (system_entries) {
+    say(s, "\n[System] Cached entries: %zu\n", system_entries->count);
+    for (size_t i = 0; i < system_entries->count; i++)
+      queue_entry(s, &system_entries->apps[i]);
+  }
+}
+
+/**
+ * @return Launch group of an entry: 0 first, 1 closed in the last
+ *         session (restore=defer), 2 quarantined (quarantine=last, or
+ *         retried with quarantine=skip)
+ */
+static int defer_group(struct Session *s, const struct DesktopEntry *de) {
+  if (history_quarantined(&s->history, &s->cfg, de->id))
+    return 2;
+  if (s->cfg.restore == RESTORE_DEFER && entry_closed(s, de))
+    return 1;
+  return 0;
+}
+
+/**
+ * Moves entries held back by the quarantine or the restore policy behind
+ * every other entry, keeping the order within each group. Quarantined
+ * entries are also held until the ones before them have started (see
+ * launch_queued_apps()), so that a crash loop does not compete with them.
+ * @param s Session
+ */
+static void defer_entries(struct Session *s) {
+  struct AppQueue *queue = &s->queue;
+  size_t count = queue->count;
+  if (count == 0)
+    return;
+
+  struct DesktopEntry *apps = malloc(count * sizeof(*apps));
+  if (!apps) {
+    perror("malloc");
+    exit(1);
   }
 
+  static const char *const reasons[] = {"", "closed in the last session",
+                                        "quarantined, see --report"};
+  size_t n = 0;
+  s->held_from = 0;
+  for (int group = 0; group <= 2; group++) {
+    if (group == 2 && n < count)
+      s->held_from = n;
+    for (size_t i = 0; i < count; i++) {
+      const struct DesktopEntry *de = &queue->apps[i];
+      if (defer_group(s, de) != group)
+        continue;
+      if (group)
+        say(s, "Deferred (%s): %s\n", reasons[group], de->name);
+      apps[n++] = *de;
+    }
+  }
+
+  memcpy(queue->apps, apps, count * sizeof(*apps));
+  free(apps);
+}
+
+/**
+ * Records which applications still run as the supervised session ends,
+ * for the restore policy of the next login. Entries skipped as closed
+ * count as running again once the user started them by hand.
+ * @param s Session
+ */
+void session_record_alive(struct Session *s) {
+  history_session_end(&s->history, &s->children);
+  if (s->closed.count == 0)
+    return;
+
+  // The index of the login is stale by now
+  proc_index_free(&s->running);
+  proc_index_build(&s->running);
+  s->running_indexed = 1;
+  for (size_t i = 0; i < s->closed.count; i++) {
+    const struct DesktopEntry *de = &s->closed.apps[i];
+    struct ProcKey key;
+    if (exec_program_key(de->exec, &key) == 0 &&
+        proc_index_has(&s->running, &key))
+      history_set_alive(&s->history, de->id, 1);
+  }
+}
+
+/* Wait for the session lock, retried by a timer of the session reactor */
+struct LockWait {
+  int fd;
+  int locked;
+};
+
+static void on_lock_retry(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  struct LockWait *w = src->data;
+  w->locked = session_lock_try(w->fd) == 0;
+  if (!w->locked)
+    reactor_timer_set(src, now_ms() + SESSION_LOCK_POLL_MS);
+}
+
+/**
+ * Serializes launcher instances of one login session with skip_running:
+ * a second instance waits until the first one has launched everything,
+ * then sees those applications as running. The wait runs in the session
+ * reactor, so a stop request ends it, and gives up after
+ * SESSION_LOCK_TIMEOUT_MS, so that a hung instance does not keep the
+ * session from starting.
+ * @param s Session, stop signals watched
+ * @return Lock file descriptor, -1 if no lock was taken
+ */
+static int session_lock(struct Session *s) {
+  struct LockWait w = {.fd = session_lock_open()};
+  if (w.fd < 0 || session_lock_try(w.fd) == 0)
+    return w.fd;
+
+  fprintf(stderr, "Another autostart instance is running, waiting\n");
+  long deadline = now_ms() + SESSION_LOCK_TIMEOUT_MS;
+  struct ReactorSource *timer = reactor_timer(&s->reactor, on_lock_retry, &w);
+  if (timer)
+    reactor_timer_set(timer, now_ms() + SESSION_LOCK_POLL_MS);
+  while (timer && !w.locked && !s->stopping) {
+    long left = deadline - now_ms();
+    if (left <= 0 || reactor_poll(&s->reactor, (int)left) < 0)
+      break;
+  }
+  if (timer)
+    reactor_remove(timer);
+
+  if (w.locked)
+    return w.fd;
+  if (!s->stopping)
+    fprintf(stderr, "Other instance still running after %dms, not waiting\n",
+            SESSION_LOCK_TIMEOUT_MS);
+  close(w.fd);
+  return -1;
+}
+
+/**
+ * Runs the scan, filter and launch pipeline for one session
+ * @param home User home directory
+ * @param config_path Config file (NULL for defaults)
+ * @param admission Launch slot of the multi-session daemon, closed once
+ *        the applications are launched; -1 if none
+ * @param supervise Stay alive after launching and stop the applications
+ *        on SIGTERM or a control request
+ * @return Number of launched applications, -1 if the session can't be
+ *         set up
+ */
+int run_session(const char *home, const char *config_path, int admission,
+                int supervise) {
+  struct Session s;
+  struct SysCache cache;
+
+  if (session_init(&s, stdout) != 0) {
+    perror("epoll");
+    if (admission >= 0)
+      close(admission);
+    return -1;
+  }
+  s.supervise = supervise;
+
+  // Stop requests from here on cut the launch short and tear down; a
+  // launcher that does not supervise still releases the boost
+  if (supervise)
+    supervise_begin(&s);
+  else
+    session_stop_signals(&s);
+
+  if (config_path)
+    config_load(&s.cfg, config_path);
+  // The daemon keeps the shared cache fresh for the sessions it admits
+  if (admission >= 0)
+    s.cfg.system_cache = 1;
+
+  // Another instance of this login session finishes launching first,
+  // which only matters when its applications are then skipped
+  int lock = s.cfg.skip_running ? session_lock(&s) : -1;
+
+  if (history_load(&s.history, home) != 0)
+    perror("history");
+  s.home = home;
+  session_scan(&s, home, NULL, &cache);
+  s.judge_starts = s.cfg.quarantine != QUARANTINE_OFF;
+  if (s.cfg.quarantine != QUARANTINE_OFF || s.cfg.restore == RESTORE_DEFER)
+    defer_entries(&s);
+
+  if (s.cfg.prefetch)
+    prefetch_queued_assets(&s, home);
+
+  // Idle apps are reclaimed through memory.reclaim in a delegated cgroup,
+  // elsewhere through process_madvise()
+  if (supervise && s.cfg.reclaim_idle_s > 0) {
+    if (reclaim_cgroup_setup(s.reclaim_cgroup, sizeof(s.reclaim_cgroup)) == 0)
+      say(&s, "Reclaim through memory.reclaim below %s\n", s.reclaim_cgroup);
+    else
+      say(&s, "Reclaim through process_madvise(), the cgroup is not "
+              "delegated\n");
+  }
+
+  if (s.cfg.perf_window_ms > 0 && s.queue.count > 0)
+    perf_watch(&s);
+
   // Launch queued applications with staggered delays
-  launch_queued_apps();
+  int launched = launch_queued_apps(&s);
+  session_unlock(lock);
+  // shutdown() reaches the daemon even while a worker holds a copy
+  if (admission >= 0) {
+    shutdown(admission, SHUT_RDWR);
+    close(admission);
+  }
+
+  // Directories still hanging after the last launch are given up
+  scan_abandon(&s.scan);
+
+  // Judge the starts for the crash-loop quarantine
+  if (s.judge_starts && s.children.count > 0 && !s.stopping) {
+    int early = watch_startup(&s, s.cfg.crash_window_ms);
+    if (early)
+      say(&s, "%d applications exited within %dms\n", early,
+          s.cfg.crash_window_ms);
+    history_update(&s.history, &s.children, s.cfg.crash_window_ms);
+    if (history_save(&s.history, home) != 0)
+      perror("history");
+  }
+
+  // Critical apps keep their boost for boost_time after their launch
+  boost_finish(&s);
+
+  // Cold start counters are read as their windows end; a supervisor
+  // reads them from its own loop and the rest at the stop
+  while (!supervise && perf_counting(&s) && !s.stopping)
+    if (reactor_poll(&s.reactor, -1) < 0)
+      break;
+
+  if (supervise)
+    supervise_session(&s);
+
+  // Windows cut short by a stop are saved with the rest
+  if (s.perf_stops) {
+    perf_collect(&s, 1);
+    perf_unwatch(&s);
+  }
+  if (supervise && s.cfg.restore != RESTORE_OFF &&
+      history_save(&s.history, home) != 0)
+    perror("history");
+
+  session_free(&s);
+  syscache_close(&cache);
+
+  return launched;
+}
+
+/**
+ * Runs the scan and filter pipeline and writes systemd user units for
+ * the eligible applications instead of launching them
+ * @param home User home directory
+ * @param config_path Config file (NULL for defaults)
+ * @param dir Output directory for the units
+ * @return Number of generated units, -1 on error
+ */
+int generate_session(const char *home, const char *config_path,
+                     const char *dir) {
+  struct Session s;
+  struct SysCache cache;
+
+  if (session_init(&s, stdout) != 0) {
+    perror("epoll");
+    return -1;
+  }
+  s.ignore_running = 1;
+  if (config_path)
+    config_load(&s.cfg, config_path);
+  session_scan(&s, home, NULL, &cache);
+
+  int generated = generate_units(dir, &s.queue, &s.cfg);
+
+  session_free(&s);
+  syscache_close(&cache);
+
+  return generated;
+}
+
+/**
+ * Runs the scan and filter pipeline of a login and predicts its launch
+ * on a virtual clock instead of launching, then tunes the delays
+ * @param home User home directory
+ * @param config_path Config file (NULL for defaults)
+ * @param host Machine to simulate
+ * @return 0 on success
+ */
+int simulate_session(const char *home, const char *config_path,
+                     const struct SimHost *host) {
+  struct Session s;
+  struct SysCache cache;
+
+  if (session_init(&s, NULL) != 0) {
+    perror("epoll");
+    return -1;
+  }
+  s.ignore_running = 1;
+  if (history_load(&s.history, home) != 0)
+    perror("history");
+  if (config_path)
+    config_load(&s.cfg, config_path);
+  session_scan(&s, home, NULL, &cache);
+  if (s.cfg.quarantine != QUARANTINE_OFF || s.cfg.restore == RESTORE_DEFER)
+    defer_entries(&s);
+
+  int ret = simulate_launch(stdout, &s.queue, &s.cfg, &s.history, host);
+
+  session_free(&s);
+  syscache_close(&cache);
+
+  return ret;
+}
+
+/**
+ * Explains, one line per application, which entries failed at startup
+ * and whether they are quarantined
+ * @param home User home directory
+ * @param config_path Config file (NULL for defaults)
+ * @return 0 on success, -1 if the history can't be read
+ */
+int report_session(const char *home, const char *config_path) {
+  struct Config cfg;
+  struct History history;
+  char path[MAX_PATH];
+
+  config_init(&cfg);
+  if (config_path)
+    config_load(&cfg, config_path);
+
+  memset(&history, 0, sizeof(history));
+  if (history_path(home, path, sizeof(path)) != 0 ||
+      history_load(&history, home) != 0) {
+    perror("history");
+    config_free(&cfg);
+    return -1;
+  }
 
-  cleanup();
+  printf("Startup history: %s\n", path);
+  history_report(stdout, &history, &cfg);
+  history_perf_report(stdout, &history);
+  ksm_report(stdout);
 
+  history_free(&history);
+  config_free(&cfg);
   return 0;
 }
@@ -0,0 +1,157 @@
+/**
+ * boost.c
+ *
+ * Ends the startup boost. Critical applications are spawned with
+ * uclamp.min at full capacity, so schedutil runs their CPU at top
+ * frequency during the cold start, and the others with a lowered
+ * uclamp.max. Clamps are per thread and inherited, so releasing them
+ * means resetting every thread of every process the applications
+ * started meanwhile. /proc is walked once; the processes of the
+ * applications' sessions and every descendant of the applications and
+ * of the launcher are reset, which covers helpers that left the session
+ * with setsid() and orphans reparented to a supervising launcher.
+ */
+
+#define _GNU_SOURCE
+#include "boost.h"
+#include "syscalls.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* One process of the user, from /proc/PID/stat */
+struct BoostProc {
+  pid_t pid, ppid, session;
+  int mark; // in the tree to release
+};
+
+/**
+ * Reads the parent and session of a process
+ * @return 0 on success, -1 if it is gone
+ */
+static int read_stat(int proc_fd, const char *pid, struct BoostProc *p) {
+  char path[64], buf[512];
+  if (snprintf(path, sizeof(path), "%s/stat", pid) >= (int)sizeof(path))
+    return -1;
+
+  FILE *f = NULL;
+  int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+    f = fdopen(fd, "r");
+  if (!f) {
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  char *line = fgets(buf, sizeof(buf), f);
+  fclose(f);
+
+  // The command name may contain spaces and parentheses
+  char *end = line ? strrchr(line, ')') : NULL;
+  if (!end || sscanf(end + 1, " %*c %d %*d %d", &p->ppid, &p->session) != 2)
+    return -1;
+  p->pid = atoi(pid);
+  return 0;
+}
+
+/**
+ * Resets the clamps of every thread of a process
+ * @return Number of threads reset
+ */
+static size_t release_threads(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+
+  DIR *dir = opendir(path);
+  if (!dir)
+    return 0;
+
+  size_t released = 0;
+  struct dirent *d;
+  while ((d = readdir(dir)) != NULL) {
+    if (!isdigit((unsigned char)d->d_name[0]))
+      continue;
+    pid_t tid = atoi(d->d_name);
+    // Kernels before 5.11 can't reset, lift the clamps to the defaults
+    released +=
+        sys_sched_uclamp_reset(tid) == 0 ||
+        (errno == EINVAL && sys_sched_uclamp(tid, 0, UCLAMP_SCALE) == 0);
+  }
+
+  closedir(dir);
+  return released;
+}
+
+/**
+ * Resets the utilization clamps of every thread the applications run:
+ * the processes of their sessions and the descendants of them and of
+ * the launcher
+ * @param sessions Session ids, i.e. pids of the launched applications
+ * @param count Number of sessions
+ * @return Number of threads reset
+ */
+size_t boost_release(const pid_t *sessions, size_t count) {
+  DIR *dir = opendir("/proc");
+  if (!dir)
+    return 0;
+
+  struct BoostProc *procs = NULL;
+  size_t n = 0, capacity = 0;
+  int proc_fd = dirfd(dir);
+  uid_t uid = geteuid();
+  pid_t self = getpid();
+  struct dirent *d;
+
+  while ((d = readdir(dir)) != NULL) {
+    struct stat st;
+    if (!isdigit((unsigned char)d->d_name[0]) ||
+        fstatat(proc_fd, d->d_name, &st, 0) != 0 || st.st_uid != uid)
+      continue;
+
+    if (n == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      struct BoostProc *tmp = realloc(procs, capacity * sizeof(*tmp));
+      if (!tmp) {
+        perror("realloc");
+        exit(1);
+      }
+      procs = tmp;
+    }
+    struct BoostProc *p = &procs[n];
+    if (read_stat(proc_fd, d->d_name, p) != 0 || p->pid == self)
+      continue;
+    p->mark = p->ppid == self;
+    for (size_t i = 0; i < count && !p->mark; i++)
+      p->mark = p->session == sessions[i] || p->pid == sessions[i];
+    n++;
+  }
+  closedir(dir);
+
+  // Descendants, one generation per pass
+  for (int changed = 1; changed;) {
+    changed = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (procs[i].mark)
+        continue;
+      for (size_t j = 0; j < n; j++) {
+        if (procs[j].mark && procs[j].pid == procs[i].ppid) {
+          procs[i].mark = changed = 1;
+          break;
+        }
+      }
+    }
+  }
+
+  size_t released = 0;
+  for (size_t i = 0; i < n; i++)
+    if (procs[i].mark)
+      released += release_threads(procs[i].pid);
+  free(procs);
+  return released;
+}
@@ -1,106 +1,965 @@
 #include "config.h"
 #include "util.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#define MAX_LINE 1024
+#ifdef AUTOSTART_BAKED_CONFIG
+#include "config_baked.h"
+#endif
 
 /**
  * Initializes the configuration structure with default values.
+ * Baked builds copy the configuration generated at build time instead.
  * @param cfg Pointer to the configuration structure to initialize.
  */
 void config_init(struct Config *cfg) {
+#ifdef AUTOSTART_BAKED_CONFIG
+  *cfg = baked_config;
+  config_compile(cfg);
+#else
   memset(cfg, 0, sizeof(*cfg));
   cfg->delay_ms = 200;
+  cfg->stop_timeout_ms = 5000;
+  cfg->quarantine_after = 3;
+  cfg->quarantine_retry_s = 86400;
+  cfg->crash_window_ms = 3000;
+  cfg->background_uclamp = 512;
+  strcpy(cfg->terminal, "xterm -e");
+#endif
 }
 
+// Baked builds parse nothing at runtime
+#ifndef AUTOSTART_BAKED_CONFIG
+/* Integer options of [general] and [log] */
+static const struct {
+  const char *section;
+  const char *key;
+  size_t offset;
+} int_options[] = {
+    {"general", "startup_delay", offsetof(struct Config, startup_delay_ms)},
+    {"general", "delay", offsetof(struct Config, delay_ms)},
+    {"general", "prefetch", offsetof(struct Config, prefetch)},
+    {"general", "system_cache", offsetof(struct Config, system_cache)},
+    {"general", "skip_running", offsetof(struct Config, skip_running)},
+    {"general", "stop_timeout", offsetof(struct Config, stop_timeout_ms)},
+    {"general", "scan_timeout", offsetof(struct Config, scan_timeout_ms)},
+    {"general", "quarantine_after", offsetof(struct Config, quarantine_after)},
+    {"general", "quarantine_retry",
+     offsetof(struct Config, quarantine_retry_s)},
+    {"general", "crash_window", offsetof(struct Config, crash_window_ms)},
+    {"general", "boost_time", offsetof(struct Config, boost_time_ms)},
+    {"general", "background_uclamp",
+     offsetof(struct Config, background_uclamp)},
+    {"general", "reclaim_idle", offsetof(struct Config, reclaim_idle_s)},
+    {"general", "perf_window", offsetof(struct Config, perf_window_ms)},
+    {"log", "log_level", offsetof(struct Config, log_level)},
+};
+
+/* String options of [general] and [log] */
+static const struct {
+  const char *section;
+  const char *key;
+  size_t offset;
+  size_t size;
+} str_options[] = {
+    {"general", "icon_theme", offsetof(struct Config, icon_theme),
+     sizeof(((struct Config *)0)->icon_theme)},
+    {"general", "terminal", offsetof(struct Config, terminal),
+     sizeof(((struct Config *)0)->terminal)},
+    {"general", "terminal_server", offsetof(struct Config, terminal_server),
+     sizeof(((struct Config *)0)->terminal_server)},
+    {"general", "terminal_client", offsetof(struct Config, terminal_client),
+     sizeof(((struct Config *)0)->terminal_client)},
+    {"log", "log_file", offsetof(struct Config, log_file),
+     sizeof(((struct Config *)0)->log_file)},
+};
+
+/* Line of a config file being parsed, for diagnostics */
+struct ConfigLine {
+  const char *path;
+  const struct Token *tok;
+};
+
 /**
- * Loads configuration from a file.
- * Supports sections: [general], [apps], [dirs].
- * @param cfg Pointer to configuration structure to fill.
- * @param path Path to configuration file.
- * @return 0 on success, -1 on failure to open file.
+ * Reports a problem in a config file as path:line:column
+ * @param at Position of the problem in the line
+ * @param fmt Message format
  */
-int config_load(struct Config *cfg, const char *path) {
-  FILE *f = fopen(path, "r");
-  if (!f)
+static void config_error(const struct ConfigLine *l, const char *at,
+                         const char *fmt, ...) {
+  va_list ap;
+  fprintf(stderr, "%s:%u:%d: ", l->path, l->tok->line,
+          (int)(at - l->tok->text) + 1);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+/**
+ * Parses a whole decimal number
+ * @param value Text of the number, inside the line
+ * @param out Receives the number, left alone on error
+ * @return 0 on success, -1 after reporting the error
+ */
+static int parse_number(const struct ConfigLine *l, const char *value,
+                        int *out) {
+  const char *p = value + (*value == '-' || *value == '+');
+  long n = 0;
+  int digits = 0;
+
+  while (*p >= '0' && *p <= '9' && n <= INT_MAX) {
+    n = n * 10 + (*p++ - '0');
+    digits++;
+  }
+  if (!digits || *p || n > INT_MAX) {
+    config_error(l, value, "expected a number, got '%s'", value);
     return -1;
+  }
+  *out = (int)(*value == '-' ? -n : n);
+  return 0;
+}
+
+/**
+ * @return DbusPolicy named by a config value, -1 if unknown
+ */
+static int parse_dbus_policy(const char *value) {
+  if (!strcmp(value, "launch"))
+    return DBUS_LAUNCH;
+  if (!strcmp(value, "defer"))
+    return DBUS_DEFER;
+  if (!strcmp(value, "ping"))
+    return DBUS_PING;
+  return -1;
+}
+
+/**
+ * Parses a D-Bus activation policy, reporting unknown ones
+ * @return The policy, DBUS_LAUNCH if unknown
+ */
+static int parse_dbus(const struct ConfigLine *l, const char *value) {
+  int policy = parse_dbus_policy(value);
+  if (policy < 0) {
+    config_error(l, value, "expected launch, defer or ping, got '%s'", value);
+    return DBUS_LAUNCH;
+  }
+  return policy;
+}
+
+/**
+ * Copies a config value into a fixed size field, always terminating it.
+ * @param dst Destination field.
+ * @param size Size of the destination field.
+ * @param value Value to copy.
+ */
+static void copy_value(char *dst, size_t size, const char *value) {
+  strncpy(dst, value, size - 1);
+  dst[size - 1] = '\0';
+}
+
+/**
+ * Makes room for more rules. Room for many rules at once (a file) is
+ * made exactly, single rules double the array. Arrays that are not
+ * owned (baked configs) are copied on the first growth.
+ * @param array Rule array
+ * @param count Rules in it
+ * @param need Rules to make room for
+ * @param capacity Its capacity, 0 if not owned
+ * @param size Size of a rule
+ * @return The array, possibly moved
+ */
+static void *grow_rules(void *array, int count, int need, int *capacity,
+                        size_t size) {
+  if (count + need <= *capacity)
+    return array;
 
-  char line[MAX_LINE];
-  char section[64] = "";
+  int n = need > 1 ? count + need : *capacity ? *capacity * 2 : 64;
+  void *tmp = realloc(*capacity ? array : NULL, n * size);
+  if (!tmp) {
+    perror("realloc");
+    exit(1);
+  }
+  if (!*capacity && count)
+    memcpy(tmp, array, count * size);
+  *capacity = n;
+  return tmp;
+}
+
+/**
+ * Parses the key of an [apps] rule: a plain application name, or a
+ * pattern written as [name:|id:|exec:]glob:PATTERN or [...]re:REGEX
+ * @param key Rule key.
+ * @param rule Rule receiving name, kind and field.
+ */
+static void parse_app_key(const char *key, struct AppRule *rule) {
+  static const char *const fields[] = {"name:", "id:", "exec:"};
+  const char *p = key;
+
+  rule->kind = MATCH_EXACT;
+  rule->field = FIELD_NAME;
+  rule->name = key;
 
-  while (fgets(line, sizeof(line), f)) {
-    char *s = trim(line);
-    if (*s == 0 || *s == '#')
+  // The first byte rules most keys out without a call
+  for (int f = 0; f < MATCH_FIELDS; f++) {
+    if (*p != fields[f][0])
       continue;
+    size_t len = strlen(fields[f]);
+    if (!strncmp(p, fields[f], len)) {
+      rule->field = f;
+      p += len;
+      break;
+    }
+  }
+
+  if (*p == 'g' && !strncmp(p, "glob:", 5)) {
+    rule->kind = MATCH_GLOB;
+    p += 5;
+  } else if (*p == 'r' && !strncmp(p, "re:", 3)) {
+    rule->kind = MATCH_REGEX;
+    p += 3;
+  } else {
+    rule->kind = MATCH_EXACT;
+    rule->field = FIELD_NAME;
+    p = key;
+  }
+
+  rule->name = p;
+}
+
+/**
+ * Finds the field of an integer token of [apps] rules, NAME:N. The
+ * compares have constant lengths so that they are inlined, a memcmp()
+ * of a length read from a table is a call per token.
+ * @param rule Rule receiving the token
+ * @param t Name of the token
+ * @param len Length of the name
+ * @return The field, NULL if NAME is not an integer token
+ */
+static int *app_int_token(struct AppRule *rule, const char *t, size_t len) {
+  switch (len) {
+  case 3:
+    return !memcmp(t, "ksm", 3) ? &rule->ksm : NULL;
+  case 4:
+    return !memcmp(t, "nice", 4) ? &rule->nice : NULL;
+  case 5:
+    return !memcmp(t, "allow", 5)   ? &rule->allow
+           : !memcmp(t, "delay", 5) ? &rule->delay_ms
+                                    : NULL;
+  case 6:
+    return !memcmp(t, "always", 6) ? &rule->always : NULL;
+  case 8:
+    return !memcmp(t, "critical", 8) ? &rule->critical : NULL;
+  }
+  return NULL;
+}
+
+/**
+ * Parses one NAME:VALUE token of an [apps] rule
+ * @param rule Rule receiving the token
+ * @param t Token, trimmed and NUL terminated
+ * @param colon The ':' of the token, NULL if there is none
+ */
+static void parse_app_token(const struct ConfigLine *l, struct AppRule *rule,
+                            char *t, const char *colon) {
+  size_t len = colon ? (size_t)(colon - t) : 0;
+  int *field = app_int_token(rule, t, len);
+
+  if (field) {
+    parse_number(l, colon + 1, field);
+  } else if (len == 4 && !memcmp(t, "dbus", 4)) {
+    rule->dbus = parse_dbus(l, colon + 1);
+  } else if (len == 3 && !memcmp(t, "env", 3)) {
+    if (rule->env_count < MAX_APP_ENV)
+      rule->env[rule->env_count++] = colon + 1;
+    else
+      config_error(l, t, "more than %d env: tokens", MAX_APP_ENV);
+  } else {
+    config_error(l, t, "unknown token '%s'", t);
+  }
+}
+
+/**
+ * Parses an [apps] rule, Name=token,token,... Tokens are split and
+ * trimmed in place in one pass, plain numbers are taken on the way; the
+ * rule keeps pointing into the file buffer.
+ * @param cfg Configuration receiving the rule
+ * @param l Line of the rule
+ */
+static void parse_app(struct Config *cfg, const struct ConfigLine *l) {
+  cfg->apps = grow_rules(cfg->apps, cfg->app_count, 1, &cfg->app_capacity,
+                         sizeof(*cfg->apps));
+  struct AppRule *rule = &cfg->apps[cfg->app_count++];
+  *rule = (struct AppRule){
+      .allow = 1,     // default policy
+      .delay_ms = -1, // default delay
+      .dbus = -1,     // [general] dbus_activation
+  };
+  parse_app_key(l->tok->key, rule);
+
+  char *p = l->tok->value;
+  while (*p) {
+    while (is_space(*p))
+      p++;
+    char *t = p, *colon = NULL;
+    while (*p && *p != ',' && *p != ':')
+      p++;
+    if (*p == ':') {
+      colon = p;
+      // Anything but a plain number is left to parse_app_token()
+      int *field = app_int_token(rule, t, p - t);
+      if (field) {
+        char *q = p + 1 + (p[1] == '-' || p[1] == '+');
+        const char *digits = q;
+        unsigned long n = 0;
+        while ((unsigned)(*q - '0') < 10 && q - digits < 10)
+          n = n * 10 + (*q++ - '0');
+        if (q != digits && n <= INT_MAX && (*q == ',' || !*q)) {
+          *field = p[1] == '-' ? -(int)n : (int)n;
+          p = q + (*q == ',');
+          continue;
+        }
+      }
+      while (*p && *p != ',')
+        p++;
+    }
 
-    if (*s == '[') {
-      sscanf(s, "[%63[^]]", section);
+    char *end = p;
+    while (end > t && is_space(end[-1]))
+      end--;
+    if (*p)
+      p++;
+    if (end == t)
       continue;
+    *end = '\0';
+    parse_app_token(l, rule, t, colon);
+  }
+}
+
+/**
+ * Parses an option of [general] or [log]
+ * @param cfg Configuration receiving the option
+ * @param section Section of the option
+ * @param l Line of the option
+ */
+static void parse_option(struct Config *cfg, const char *section,
+                         const struct ConfigLine *l) {
+  const char *k = l->tok->key, *v = l->tok->value;
+
+  for (size_t i = 0; i < sizeof(int_options) / sizeof(*int_options); i++) {
+    if (!strcmp(int_options[i].key, k) &&
+        !strcmp(int_options[i].section, section)) {
+      parse_number(l, v, (int *)((char *)cfg + int_options[i].offset));
+      return;
+    }
+  }
+  for (size_t i = 0; i < sizeof(str_options) / sizeof(*str_options); i++) {
+    if (!strcmp(str_options[i].key, k) &&
+        !strcmp(str_options[i].section, section)) {
+      copy_value((char *)cfg + str_options[i].offset, str_options[i].size, v);
+      return;
     }
+  }
+
+  if (!strcmp(section, "general") && !strcmp(k, "quarantine")) {
+    if (!strcmp(v, "skip"))
+      cfg->quarantine = QUARANTINE_SKIP;
+    else if (!strcmp(v, "last"))
+      cfg->quarantine = QUARANTINE_LAST;
+    else if (!strcmp(v, "off"))
+      cfg->quarantine = QUARANTINE_OFF;
+    else
+      config_error(l, v, "expected off, skip or last, got '%s'", v);
+  } else if (!strcmp(section, "general") && !strcmp(k, "restore")) {
+    if (!strcmp(v, "defer"))
+      cfg->restore = RESTORE_DEFER;
+    else if (!strcmp(v, "skip"))
+      cfg->restore = RESTORE_SKIP;
+    else if (!strcmp(v, "off"))
+      cfg->restore = RESTORE_OFF;
+    else
+      config_error(l, v, "expected off, defer or skip, got '%s'", v);
+  } else if (!strcmp(section, "general") && !strcmp(k, "dbus_activation")) {
+    cfg->dbus_activation = parse_dbus(l, v);
+  } else {
+    config_error(l, k, "unknown option '%s' in [%s]", k, section);
+  }
+}
 
-    char key[256], val[256];
-    if (sscanf(s, "%255[^=]=%255[^\n]", key, val) != 2)
+/* A file of one config_load() */
+struct ConfigSource {
+  char *path;
+  int fd;      // open until read
+  size_t size; // its room in the shared text
+  char *buf;   // its text, NUL terminated; NULL if it can't be read
+  size_t len;
+  int own;     // buf is its own allocation, not in the shared text
+};
+
+/**
+ * Opens a config file and sizes its text. Anything but a regular file
+ * has no usable size: it is read at once, into its own buffer.
+ * @return 0 on success, -1 if it can't be read (errno set)
+ */
+static int source_open(struct ConfigSource *src) {
+  struct stat st;
+  src->fd = open(src->path, O_RDONLY | O_CLOEXEC);
+  if (src->fd < 0)
+    return -1;
+  if (fstat(src->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    src->size = st.st_size;
+    return 0;
+  }
+
+  close(src->fd);
+  src->fd = -1;
+  struct Tokenizer t;
+  if (tokenizer_open(&t, src->path, 0) != 0)
+    return -1;
+  src->buf = t.buf;
+  src->len = t.len;
+  src->own = 1;
+  return 0;
+}
+
+/**
+ * Reads an opened config file into its room in the shared text. A file
+ * that grew since it was sized is cut at that size.
+ * @param text Its room, size + 1 bytes
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int source_read(struct ConfigSource *src, char *text) {
+  size_t len = 0;
+  while (len < src->size) {
+    ssize_t n = read(src->fd, text + len, src->size - len);
+    if (n < 0 && errno == EINTR)
       continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    len += n;
+  }
+  text[len] = '\0';
+  src->buf = text;
+  src->len = len;
+  return 0;
+}
 
-    char *k = trim(key);
-    char *v = trim(val);
-
-    if (!strcmp(section, "general")) {
-      if (!strcmp(k, "startup_delay"))
-        cfg->startup_delay_ms = atoi(v);
-      else if (!strcmp(k, "delay"))
-        cfg->delay_ms = atoi(v);
-    } else if (!strcmp(section, "apps") && cfg->app_count < MAX_CFG_APPS) {
-      struct AppRule *app_rule = &cfg->apps[cfg->app_count++];
-      strncpy(app_rule->name, k, sizeof(app_rule->name) - 1);
-      app_rule->name[sizeof(app_rule->name) - 1] = '\0';
-      app_rule->allow = 1; // default policy
-      app_rule->delay_ms = -1;     // default delay
-
-      char *token = strtok(v, ",");
-      while (token) {
-        char *t = trim(token);
-
-        if (!strncmp(t, "allow:", 6)) {
-            app_rule->allow = atoi(t + 6);
-        } else if (!strncmp(t, "delay:", 6)) {
-          app_rule->delay_ms = atoi(t + 6);
-        }
+/* Sections, told apart once per header rather than on every line */
+enum ConfigSection {
+  SECTION_NONE, // before the first header
+  SECTION_APPS,
+  SECTION_DIRS,
+  SECTION_OPTIONS, // [general] and [log]
+  SECTION_UNKNOWN, // reported at its header, its lines skipped
+};
+
+/**
+ * Parses one config file in a single pass over its text. Rule strings
+ * point into the text, room for the rules is made by the caller.
+ * @param cfg Configuration to fill
+ * @param src Config file, read
+ */
+static void parse_source(struct Config *cfg, const struct ConfigSource *src) {
+  struct Tokenizer t = {.buf = src->buf, .len = src->len};
+  struct Token tok;
+  struct ConfigLine l = {src->path, &tok};
+  const char *section = "";
+  enum ConfigSection kind = SECTION_NONE;
 
-        token = strtok(NULL, ",");
+  while (tokenizer_next(&t, &tok) != TOKEN_END) {
+    if (tok.type == TOKEN_SECTION) {
+      section = tok.key;
+      kind = !strcmp(section, "apps")      ? SECTION_APPS
+             : !strcmp(section, "dirs")    ? SECTION_DIRS
+             : !strcmp(section, "general") ? SECTION_OPTIONS
+             : !strcmp(section, "log")     ? SECTION_OPTIONS
+                                           : SECTION_UNKNOWN;
+      if (kind == SECTION_UNKNOWN)
+        config_error(&l, section, "unknown section [%s]", section);
+      continue;
+    }
+    if (kind == SECTION_UNKNOWN)
+      continue;
+
+    if (tok.type != TOKEN_PAIR) {
+      config_error(&l, tok.key, "expected key=value");
+      continue;
+    }
+    if (!*tok.key || !*tok.value)
+      continue;
+
+    if (kind == SECTION_APPS) {
+      parse_app(cfg, &l);
+    } else if (kind == SECTION_DIRS) {
+      int allow = !strcmp(tok.value, "allow");
+      if (!allow && strcmp(tok.value, "block")) {
+        config_error(&l, tok.value, "expected allow or block, got '%s'",
+                     tok.value);
+        continue;
       }
-    } else if (!strcmp(section, "dirs") && cfg->dir_count < MAX_CFG_DIRS) {
+      cfg->dirs = grow_rules(cfg->dirs, cfg->dir_count, 1, &cfg->dir_capacity,
+                             sizeof(*cfg->dirs));
       struct DirRule *dir_rule = &cfg->dirs[cfg->dir_count++];
-      strncpy(dir_rule->path, k, sizeof(dir_rule->path) - 1);
-      dir_rule->allow = !strcmp(v, "block");
+      dir_rule->path = tok.key;
+      dir_rule->allow = allow;
+    } else if (kind == SECTION_OPTIONS) {
+      parse_option(cfg, section, &l);
+    } else {
+      config_error(&l, tok.key, "option '%s' outside of a section", tok.key);
     }
   }
+}
+
+/**
+ * Appends a file to the sources of a load
+ * @param srcs Source array, grown as needed
+ * @param count Sources in it
+ * @param capacity Its capacity
+ * @param path Path of the file, copied
+ */
+static void add_source(struct ConfigSource **srcs, size_t *count,
+                       size_t *capacity, const char *path) {
+  if (*count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 8;
+    struct ConfigSource *tmp = realloc(*srcs, *capacity * sizeof(*tmp));
+    if (!tmp) {
+      perror("realloc");
+      exit(1);
+    }
+    *srcs = tmp;
+  }
+  struct ConfigSource *src = &(*srcs)[(*count)++];
+  memset(src, 0, sizeof(*src));
+  src->fd = -1;
+  src->path = strdup(path);
+  if (!src->path) {
+    perror("strdup");
+    exit(1);
+  }
+}
+
+static int compare_sources(const void *a, const void *b) {
+  return strcmp(((const struct ConfigSource *)a)->path,
+                ((const struct ConfigSource *)b)->path);
+}
+
+/**
+ * Lists the drop-ins of a config file, *.conf files of the directory
+ * named like the file with .conf replaced by .d (config.conf: config.d),
+ * in lexical order
+ * @param path Config file
+ * @param srcs Source array receiving them
+ * @param count Sources in it
+ * @param capacity Its capacity
+ * @return 0 on success, -1 if there is no such directory
+ */
+static int add_dropins(const char *path, struct ConfigSource **srcs,
+                       size_t *count, size_t *capacity) {
+  char dir_path[PATH_MAX], file[PATH_MAX];
+  size_t len = strlen(path);
+  if (len > 5 && !strcmp(path + len - 5, ".conf"))
+    len -= 5;
+  if (snprintf(dir_path, sizeof(dir_path), "%.*s.d", (int)len, path) >=
+      (int)sizeof(dir_path))
+    return -1;
 
-  fclose(f);
+  DIR *dir = opendir(dir_path);
+  if (!dir)
+    return -1;
+
+  size_t first = *count;
+  struct dirent *d;
+  while ((d = readdir(dir)) != NULL) {
+    size_t n = strlen(d->d_name);
+    if (d->d_name[0] == '.' || n <= 5 || strcmp(d->d_name + n - 5, ".conf"))
+      continue;
+    if (snprintf(file, sizeof(file), "%s/%s", dir_path, d->d_name) >=
+        (int)sizeof(file))
+      fprintf(stderr, "%s/%s: path too long\n", dir_path, d->d_name);
+    else
+      add_source(srcs, count, capacity, file);
+  }
+  closedir(dir);
+
+  // Same directory: the paths sort like the names
+  qsort(*srcs + first, *count - first, sizeof(**srcs), compare_sources);
   return 0;
 }
 
+/**
+ * Counts the newlines of a text. The fixed inner loop is vectorized by
+ * the compiler, where a memchr() per line costs a call per rule.
+ * @return Number of '\n' bytes
+ */
+static int count_lines(const char *text, size_t len) {
+  size_t i = 0;
+  int n = 0;
+  for (; i + 64 <= len; i += 64) {
+    unsigned char chunk = 0; // at most 64
+    for (int j = 0; j < 64; j++)
+      chunk += text[i + j] == '\n';
+    n += chunk;
+  }
+  for (; i < len; i++)
+    n += text[i] == '\n';
+  return n;
+}
+
+/**
+ * Reads a config file and its drop-ins. All of them are sized first, so
+ * that their texts share one buffer and the rules one array, each
+ * allocated once.
+ * @param cfg Configuration to fill
+ * @param path Config file
+ * @return 0 on success, -1 if neither the file nor its drop-in
+ *         directory can be read (errno of the file)
+ */
+static int load_files(struct Config *cfg, const char *path) {
+  struct ConfigSource *srcs = NULL;
+  size_t count = 0, capacity = 0;
+  add_source(&srcs, &count, &capacity, path);
+  int has_dir = add_dropins(path, &srcs, &count, &capacity) == 0;
+
+  // The file itself is reported by the caller, if at all
+  int err = 0;
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (source_open(&srcs[i]) != 0) {
+      if (i == 0)
+        err = errno;
+      else
+        perror(srcs[i].path);
+    } else if (srcs[i].fd >= 0) {
+      total += srcs[i].size + 1;
+    }
+  }
+
+  char *text = total ? malloc(total) : NULL;
+  if (total && !text) {
+    perror("malloc");
+    exit(1);
+  }
+
+  int lines = 0, texts = !!text;
+  for (size_t i = 0, used = 0; i < count; i++) {
+    struct ConfigSource *src = &srcs[i];
+    if (src->fd >= 0) {
+      if (source_read(src, text + used) == 0)
+        used += src->size + 1;
+      else if (i == 0)
+        err = errno;
+      else
+        perror(src->path);
+      close(src->fd);
+    }
+    if (!src->buf)
+      continue;
+
+    // A rule per line at most
+    texts += src->own;
+    lines += 1 + count_lines(src->buf, src->len);
+  }
+
+  cfg->apps = grow_rules(cfg->apps, cfg->app_count, lines, &cfg->app_capacity,
+                         sizeof(*cfg->apps));
+  if (texts) {
+    char **tmp = realloc(cfg->texts, (cfg->text_count + texts) * sizeof(*tmp));
+    if (!tmp) {
+      perror("realloc");
+      exit(1);
+    }
+    cfg->texts = tmp;
+  }
+
+  // Kept, the rules point into them
+  if (text)
+    cfg->texts[cfg->text_count++] = text;
+  for (size_t i = 0; i < count; i++) {
+    if (srcs[i].buf)
+      parse_source(cfg, &srcs[i]);
+    if (srcs[i].own)
+      cfg->texts[cfg->text_count++] = srcs[i].buf;
+    free(srcs[i].path);
+  }
+  free(srcs);
+
+  if (err && !has_dir) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+#endif
+
+static int same_app_rule(const struct AppRule *a, const struct AppRule *b) {
+  return a->kind == b->kind && a->field == b->field &&
+         !strcmp(a->name, b->name);
+}
+
+/**
+ * @return FNV-1a hash of a rule key
+ */
+static unsigned rule_hash(enum MatchKind kind, enum MatchField field,
+                          const char *name) {
+  unsigned h = 2166136261u ^ (kind * MATCH_FIELDS + field);
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+    h = (h ^ *p) * 16777619u;
+  return h;
+}
+
+/**
+ * Empties the rule index, growing it so that count rules keep it at
+ * most half full
+ * @param count Rules it will hold
+ */
+static void reset_index(struct Config *cfg, int count) {
+  unsigned slots = 16;
+  while (slots < 2 * (unsigned)count)
+    slots *= 2;
+
+  if (!cfg->app_index || cfg->app_index_mask + 1 < slots) {
+    free(cfg->app_index);
+    cfg->app_index = malloc(slots * sizeof(*cfg->app_index));
+    if (!cfg->app_index) {
+      perror("malloc");
+      exit(1);
+    }
+    cfg->app_index_mask = slots - 1;
+  }
+  memset(cfg->app_index, 0xff,
+         (cfg->app_index_mask + 1) * sizeof(*cfg->app_index));
+}
+
+/**
+ * Indexes the rules by key (kind, field and name), hashing each once. A
+ * repeated key is held by its last rule: the last one read wins, so
+ * drop-ins override config.conf and each other in lexical order. When
+ * the array is owned the replaced rules are dropped, the others keep
+ * their file order, which is the priority of the pattern rules.
+ * @param cfg Pointer to configuration structure.
+ */
+static void index_apps(struct Config *cfg) {
+  int dropped = 0;
+
+  reset_index(cfg, cfg->app_count);
+  for (int i = 0; i < cfg->app_count; i++) {
+    const struct AppRule *rule = &cfg->apps[i];
+    unsigned mask = cfg->app_index_mask;
+    unsigned h = rule_hash(rule->kind, rule->field, rule->name) & mask;
+    while (cfg->app_index[h] >= 0 &&
+           !same_app_rule(&cfg->apps[cfg->app_index[h]], rule))
+      h = (h + 1) & mask;
+    if (cfg->app_index[h] >= 0 && cfg->app_capacity) {
+      cfg->apps[cfg->app_index[h]].name = NULL; // until compacted below
+      dropped++;
+    }
+    cfg->app_index[h] = i;
+  }
+  if (!dropped)
+    return;
+
+  // Indexes moved: index the survivors again, now without repeats
+  int n = 0;
+  for (int i = 0; i < cfg->app_count; i++)
+    if (cfg->apps[i].name)
+      cfg->apps[n++] = cfg->apps[i];
+  cfg->app_count = n;
+  index_apps(cfg);
+}
+
+/**
+ * Loads configuration from a file and its drop-in directory.
+ * Supports sections: [general], [apps], [dirs], [log]. Problems are
+ * reported as path:line:column and the offending line is skipped.
+ * @param cfg Pointer to configuration structure to fill.
+ * @param path Path to configuration file.
+ * Baked builds never read configuration files, they warn that the path
+ * is ignored.
+ * @return 0 on success, -1 if neither the file nor its drop-in
+ *         directory can be read (errno of the file).
+ */
+int config_load(struct Config *cfg, const char *path) {
+#ifdef AUTOSTART_BAKED_CONFIG
+  (void)cfg;
+  if (path)
+    fprintf(stderr, "Warning: configuration baked in, ignoring %s\n", path);
+#else
+  if (load_files(cfg, path) != 0)
+    return -1;
+
+  config_compile(cfg);
+#endif
+  return 0;
+}
+
+/**
+ * Releases the compiled rules of a configuration. The index of the
+ * exact rules is kept for the next compilation.
+ * @param cfg Pointer to configuration structure.
+ */
+static void free_compiled(struct Config *cfg) {
+  for (int f = 0; f < MATCH_FIELDS; f++) {
+    matcher_free(cfg->matchers[f]);
+    cfg->matchers[f] = NULL;
+  }
+  dirtrie_free(cfg->dir_trie);
+  cfg->dir_trie = NULL;
+}
+
+/**
+ * Indexes the rules by key, dropping those a later rule repeats, so an
+ * exact name is found by hash; compiles the pattern rules into one
+ * matcher per matched field, so an entry is checked against all of
+ * them in a single pass, and the directory rules into a path trie.
+ * Invalid patterns are reported and never match.
+ * @param cfg Pointer to configuration structure.
+ * @return Number of compiled patterns.
+ */
+int config_compile(struct Config *cfg) {
+  int compiled = 0;
+
+  free_compiled(cfg);
+  if (cfg->app_count) {
+    index_apps(cfg);
+  } else {
+    free(cfg->app_index);
+    cfg->app_index = NULL;
+  }
+
+  for (int i = 0; i < cfg->app_count; i++) {
+    struct AppRule *app = &cfg->apps[i];
+    if (app->kind == MATCH_EXACT)
+      continue;
+
+    if (!cfg->matchers[app->field]) {
+      cfg->matchers[app->field] = matcher_new();
+      if (!cfg->matchers[app->field]) {
+        perror("matcher_new");
+        exit(1);
+      }
+    }
+
+    if (matcher_add(cfg->matchers[app->field], app->name, app->kind, i) != 0)
+      fprintf(stderr, "Invalid %s pattern in [apps]: %s\n",
+              app->kind == MATCH_GLOB ? "glob" : "regex", app->name);
+    else
+      compiled++;
+  }
+
+  if (cfg->dir_count) {
+    cfg->dir_trie = dirtrie_new();
+    if (!cfg->dir_trie) {
+      perror("dirtrie_new");
+      exit(1);
+    }
+    for (int i = 0; i < cfg->dir_count; i++)
+      if (dirtrie_add(cfg->dir_trie, cfg->dirs[i].path, cfg->dirs[i].allow,
+                      i) != 0) {
+        perror("dirtrie_add");
+        exit(1);
+      }
+  }
+  return compiled;
+}
+
+/**
+ * Releases everything a configuration owns.
+ * @param cfg Pointer to configuration structure.
+ */
+void config_free(struct Config *cfg) {
+  free_compiled(cfg);
+  free(cfg->app_index);
+  cfg->app_index = NULL;
+  if (cfg->app_capacity)
+    free(cfg->apps);
+  if (cfg->dir_capacity)
+    free(cfg->dirs);
+  for (int i = 0; i < cfg->text_count; i++)
+    free(cfg->texts[i]);
+  free(cfg->texts);
+  cfg->apps = NULL;
+  cfg->dirs = NULL;
+  cfg->texts = NULL;
+  cfg->app_count = cfg->app_capacity = 0;
+  cfg->dir_count = cfg->dir_capacity = cfg->text_count = 0;
+}
+
 /**
  * Prints the current configuration to stdout.
  * @param cfg Pointer to configuration structure.
  */
 void print_config(const struct Config *cfg) {
+  static const char *const dbus_policies[] = {"launch", "defer", "ping"};
   printf("=== Current Config =====================\n");
   printf("Startup delay: %d ms\n", cfg->startup_delay_ms);
   printf("Delay between apps: %d ms\n", cfg->delay_ms);
+  printf("Prefetch: %s\n", cfg->prefetch ? "on" : "off");
+  printf("System cache: %s\n", cfg->system_cache ? "on" : "off");
+  printf("Skip running: %s\n", cfg->skip_running ? "on" : "off");
+  printf("Stop timeout: %d ms\n", cfg->stop_timeout_ms);
+  if (cfg->scan_timeout_ms > 0)
+    printf("Scan timeout: %d ms\n", cfg->scan_timeout_ms);
+  else
+    printf("Scan timeout: off\n");
+  static const char *const quarantines[] = {"off", "skip", "last"};
+  printf("Quarantine: %s after %d failed starts within %d ms",
+         quarantines[cfg->quarantine], cfg->quarantine_after,
+         cfg->crash_window_ms);
+  if (cfg->quarantine_retry_s > 0)
+    printf(", retried after %d s\n", cfg->quarantine_retry_s);
+  else
+    printf(", never retried\n");
+  static const char *const restores[] = {"off", "defer", "skip"};
+  printf("Restore closed apps: %s\n", restores[cfg->restore]);
+  printf("D-Bus activation: %s\n", dbus_policies[cfg->dbus_activation]);
+  if (cfg->boost_time_ms > 0)
+    printf("Startup boost: %d ms, background uclamp.max %d\n",
+           cfg->boost_time_ms, cfg->background_uclamp);
+  else
+    printf("Startup boost: off\n");
+  if (cfg->reclaim_idle_s > 0)
+    printf("Reclaim idle apps after: %d s\n", cfg->reclaim_idle_s);
+  if (cfg->perf_window_ms > 0)
+    printf("Cold start counters: first %d ms\n", cfg->perf_window_ms);
+  printf("Icon theme: %s\n", *cfg->icon_theme ? cfg->icon_theme : "hicolor");
+  printf("Terminal: %s\n", cfg->terminal);
+  if (*cfg->terminal_server)
+    printf("Terminal server: %s (client: %s)\n", cfg->terminal_server,
+           cfg->terminal_client);
   printf("Log level: %d\n", cfg->log_level);
   printf("Log file: %s\n", cfg->log_file);
 
   printf("\nApplications rules (%d):\n", cfg->app_count);
   for (int i = 0; i < cfg->app_count; i++) {
     struct AppRule *app = &cfg->apps[i];
-    printf("  - %s: %s", app->name,
-           app->allow ? "ALLOW" : "BLOCK");
+    static const char *const kinds[] = {"", "glob:", "re:"};
+    static const char *const fields[] = {"", "id:", "exec:"};
+    printf("  - %s%s%s: %s", app->kind ? fields[app->field] : "",
+           kinds[app->kind], app->name, app->allow ? "ALLOW" : "BLOCK");
     if (app->delay_ms >= 0) {
       printf(", delay: %d ms", app->delay_ms);
     }
+    if (app->nice)
+      printf(", nice: %d", app->nice);
+    if (app->dbus >= 0)
+      printf(", dbus: %s", dbus_policies[app->dbus]);
+    if (app->critical)
+      printf(", critical");
+    if (app->ksm)
+      printf(", ksm");
+    if (app->always)
+      printf(", always");
+    for (int e = 0; e < app->env_count; e++)
+      printf(", env: %s", app->env[e]);
     printf("\n");
   }
 
@@ -114,27 +973,98 @@ void print_config(const struct Config *cfg) {
 }
 
 /**
- * Finds an application rule by name.
+ * Finds the exact rule of an application name.
  * @param cfg Pointer to configuration structure.
  * @param name Name of the application to find.
  * @return Pointer to AppRule if found, NULL otherwise.
  */
-struct AppRule *config_find_app(struct Config *cfg, const char *name) {
-  for (int i = 0; i < cfg->app_count; i++)
-    if (!strcmp(cfg->apps[i].name, name))
-      return &cfg->apps[i];
+static struct AppRule *find_exact(struct Config *cfg, const char *name) {
+  if (!cfg->app_index)
+    return NULL;
+
+  // The index holds the pattern rules too, under their own kind
+  unsigned mask = cfg->app_index_mask;
+  unsigned h = rule_hash(MATCH_EXACT, FIELD_NAME, name) & mask;
+  for (; cfg->app_index[h] >= 0; h = (h + 1) & mask) {
+    struct AppRule *rule = &cfg->apps[cfg->app_index[h]];
+    if (rule->kind == MATCH_EXACT && !strcmp(rule->name, name))
+      return rule;
+  }
   return NULL;
 }
 
 /**
- * Checks if a directory is blocked.
+ * Finds the rule of an application. An exact name rule wins, otherwise
+ * the first pattern rule (in file order) matching any of the fields.
+ * @param cfg Pointer to configuration structure.
+ * @param name Name of the application.
+ * @param id Desktop file ID (may be NULL).
+ * @param exec Basename of the Exec program (may be NULL).
+ * @return Pointer to AppRule if found, NULL otherwise.
+ */
+struct AppRule *config_match_app(struct Config *cfg, const char *name,
+                                 const char *id, const char *exec) {
+  struct AppRule *rule = find_exact(cfg, name);
+  if (rule)
+    return rule;
+
+  const char *values[MATCH_FIELDS] = {name, id, exec};
+  int best = -1;
+  for (int f = 0; f < MATCH_FIELDS; f++) {
+    if (!values[f] || !cfg->matchers[f])
+      continue;
+    int r = matcher_match(cfg->matchers[f], values[f]);
+    if (r >= 0 && (best < 0 || r < best))
+      best = r;
+  }
+  return best >= 0 ? &cfg->apps[best] : NULL;
+}
+
+/**
+ * Finds an application rule by name, exact or name pattern.
+ * @param cfg Pointer to configuration structure.
+ * @param name Name of the application to find.
+ * @return Pointer to AppRule if found, NULL otherwise.
+ */
+struct AppRule *config_find_app(struct Config *cfg, const char *name) {
+  return config_match_app(cfg, name, NULL, NULL);
+}
+
+/**
+ * Gets the delay before launching an application.
+ * @param cfg Pointer to configuration structure.
+ * @param rule Rule of the application (may be NULL).
+ * @param first Non-zero for the first application of the session.
+ * @return Per-application delay if set, otherwise the global one.
+ */
+int config_app_delay(struct Config *cfg, const struct AppRule *rule,
+                     int first) {
+  if (rule && rule->delay_ms >= 0)
+    return rule->delay_ms;
+  return first ? cfg->startup_delay_ms : cfg->delay_ms;
+}
+
+/**
+ * How a DBusActivatable entry is started
+ * @param cfg Pointer to configuration structure.
+ * @param rule Matching rule of the entry, NULL if none.
+ * @return Policy of the rule, or the [general] dbus_activation default.
+ */
+enum DbusPolicy config_app_dbus(const struct Config *cfg,
+                                const struct AppRule *rule) {
+  if (rule && rule->dbus >= 0)
+    return rule->dbus;
+  return cfg->dbus_activation;
+}
+
+/**
+ * Checks if a directory is blocked, without touching the filesystem.
+ * The deepest [dirs] rule covering the path decides; directories
+ * without a rule are allowed.
  * @param cfg Pointer to configuration structure.
  * @param path Directory path to check.
  * @return 1 if blocked, 0 otherwise.
  */
-int config_dir_allowed(struct Config *cfg, const char *path) {
-  for (int i = 0; i < cfg->dir_count; i++)
-    if (!strcmp(cfg->dirs[i].path, path))
-      return cfg->dirs[i].allow;
-  return 0;
+int config_dir_blocked(struct Config *cfg, const char *path) {
+  return dirtrie_lookup(cfg->dir_trie, path) == 0;
 }
@@ -0,0 +1,403 @@
+/**
+ * daemon.c
+ *
+ * Multi-session daemon. It only admits and orders logins: each session
+ * runs its own launcher (--connect), which asks the daemon for a slot,
+ * launches its applications itself, as the user and inside the user's
+ * login session and cgroup, and gives the slot back by closing the
+ * connection. The daemon keeps the shared system entry cache in /run
+ * fresh, so the launchers map it instead of parsing: it is rebuilt when
+ * inotify reports a change in a system directory, off the admission
+ * path, or every DAEMON_REFRESH_INTERVAL_MS where inotify can't watch.
+ *
+ * A client sends DAEMON_REQUEST and gets "go" once admitted, or "busy"
+ * when its user holds too many connections already. Everything runs on
+ * one reactor, so a client that sends nothing only occupies its own
+ * connection, until its request deadline.
+ */
+
+#define _GNU_SOURCE
+#include "daemon.h"
+#include "reactor.h"
+#include "supervise.h"
+#include "syscache.h"
+#include <errno.h>
+#include <grp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum ClientState {
+  CLIENT_READING, // request not complete yet, counts against nothing
+  CLIENT_WAITING, // queued for a slot
+  CLIENT_ACTIVE,  // holds a slot while its launcher runs
+};
+
+struct Daemon;
+
+/* One connected launcher, in arrival order */
+struct Client {
+  struct Daemon *d;
+  int fd;
+  uid_t uid;
+  enum ClientState state;
+  struct ReactorSource *src;
+  struct ReactorSource *timer; // request or slot deadline
+  char buf[sizeof(DAEMON_REQUEST)];
+  size_t len;
+  struct Client *next;
+};
+
+struct Daemon {
+  struct Reactor reactor;
+  struct Client *clients;
+  int active;
+  int max_sessions;
+  struct ReactorSource *refresh; // rebuilds the system entry cache
+  int watched;                   // every system directory is watched
+};
+
+/**
+ * Republishes the shared cache of system entries if it is stale, so
+ * that launchers admitted later map a fresh one
+ */
+static void refresh_system_entries(void) {
+  struct SysCache cache;
+  if (!syscache_open(&cache)) {
+    printf("Published %zu system entries\n", cache.entries.count);
+    fflush(stdout);
+  }
+  syscache_close(&cache);
+}
+
+/**
+ * Rebuilds the system entry cache once changes settled, and re-arms
+ * itself where inotify can't watch every directory
+ */
+static void on_refresh(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  struct Daemon *d = src->data;
+  refresh_system_entries();
+  if (!d->watched)
+    reactor_timer_set(src, now_ms() + DAEMON_REFRESH_INTERVAL_MS);
+}
+
+/**
+ * Schedules a rebuild of the cache after a change in a system
+ * directory; a package installing many files causes one rebuild
+ */
+static void on_system_dir(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct Daemon *d = src->data;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (read(src->fd, buf, sizeof(buf)) > 0)
+    ;
+  reactor_timer_set(d->refresh, now_ms() + DAEMON_REFRESH_DELAY_MS);
+}
+
+/**
+ * Watches the system directories for changes to their entries
+ * @return 0 if every directory is watched, -1 otherwise
+ */
+static int watch_system_dirs(struct Daemon *d) {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  int ret = 0;
+  for (int i = 0; system_autostart_dirs[i]; i++)
+    if (inotify_add_watch(fd, system_autostart_dirs[i],
+                          IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                              IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB |
+                              IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+      ret = -1;
+  if (!reactor_add(&d->reactor, fd, 1, on_system_dir, d))
+    return -1;
+  return ret;
+}
+
+/**
+ * Counts the clients of a user in a state
+ * @param state State to count, -1 for all
+ */
+static int user_clients(const struct Daemon *d, uid_t uid, int state) {
+  int n = 0;
+  for (const struct Client *c = d->clients; c; c = c->next)
+    n += c->uid == uid && ((int)c->state == state || state < 0);
+  return n;
+}
+
+static void client_drop(struct Client *c);
+
+/**
+ * Grants free slots to waiting clients in arrival order, skipping users
+ * that already hold DAEMON_SESSIONS_PER_UID slots
+ */
+static void admit(struct Daemon *d) {
+  for (struct Client *c = d->clients; c && d->active < d->max_sessions;) {
+    struct Client *next = c->next;
+    if (c->state == CLIENT_WAITING &&
+        user_clients(d, c->uid, CLIENT_ACTIVE) < DAEMON_SESSIONS_PER_UID) {
+      if (send(c->fd, "go\n", 3, MSG_NOSIGNAL | MSG_DONTWAIT) != 3) {
+        client_drop(c);
+      } else {
+        c->state = CLIENT_ACTIVE;
+        d->active++;
+        reactor_timer_set(c->timer, now_ms() + DAEMON_SLOT_TIMEOUT_MS);
+      }
+    }
+    c = next;
+  }
+}
+
+/**
+ * Forgets a client, giving its slot back
+ */
+static void client_drop(struct Client *c) {
+  struct Daemon *d = c->d;
+
+  for (struct Client **p = &d->clients; *p; p = &(*p)->next) {
+    if (*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+  if (c->state == CLIENT_ACTIVE)
+    d->active--;
+  reactor_remove(c->src);
+  reactor_remove(c->timer);
+  free(c);
+}
+
+/**
+ * Reads the request of a client; once admitted, any input or EOF means
+ * the launcher is done with its slot
+ */
+static void on_client(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct Client *c = src->data;
+  struct Daemon *d = c->d;
+
+  if (c->state != CLIENT_READING) {
+    client_drop(c);
+    admit(d);
+    return;
+  }
+
+  ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return;
+  if (n <= 0) {
+    client_drop(c);
+    return;
+  }
+
+  c->len += n;
+  if (c->len < sizeof(c->buf) - 1)
+    return;
+
+  // Only a complete request queues the client
+  if (memcmp(c->buf, DAEMON_REQUEST, sizeof(c->buf) - 1) != 0) {
+    client_drop(c);
+    return;
+  }
+  c->state = CLIENT_WAITING;
+  reactor_timer_set(c->timer, 0);
+  admit(d);
+}
+
+/**
+ * Drops a client that did not finish its request in time, or that kept
+ * its slot longer than a launch takes
+ */
+static void on_client_timer(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  struct Client *c = src->data;
+  struct Daemon *d = c->d;
+
+  if (c->state == CLIENT_ACTIVE)
+    fprintf(stderr, "Slot of uid %u expired after %dms\n", (unsigned)c->uid,
+            DAEMON_SLOT_TIMEOUT_MS);
+  client_drop(c);
+  admit(d);
+}
+
+/**
+ * Accepts a launcher, identified by SO_PEERCRED
+ */
+static void on_listen(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct Daemon *d = src->data;
+
+  int fd = accept4(src->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (fd < 0) {
+    if (errno != EAGAIN && errno != EINTR)
+      perror("accept");
+    return;
+  }
+
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+    close(fd);
+    return;
+  }
+  if (user_clients(d, cred.uid, -1) >= DAEMON_CLIENTS_PER_UID) {
+    send(fd, "busy\n", 5, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+    return;
+  }
+
+  struct Client *c = calloc(1, sizeof(*c));
+  if (!c) {
+    perror("calloc");
+    exit(1);
+  }
+  c->d = d;
+  c->fd = fd;
+  c->uid = cred.uid;
+  c->state = CLIENT_READING;
+  c->src = reactor_add(&d->reactor, fd, 1, on_client, c);
+  c->timer = reactor_timer(&d->reactor, on_client_timer, c);
+  if (!c->src || !c->timer) {
+    perror("epoll");
+    if (c->src) // an owned fd is closed on failure too
+      reactor_remove(c->src);
+    if (c->timer)
+      reactor_remove(c->timer);
+    free(c);
+    return;
+  }
+  reactor_timer_set(c->timer, now_ms() + DAEMON_REQUEST_TIMEOUT_MS);
+
+  // Appended, so that slots are granted in arrival order
+  struct Client **p = &d->clients;
+  while (*p)
+    p = &(*p)->next;
+  *p = c;
+}
+
+/**
+ * Runs the multi-session daemon: at most max_sessions launchers run at
+ * a time, further logins wait for a slot in arrival order
+ * @param socket_path Path of the listening socket
+ * @param max_sessions Host-wide admission limit (<= 0 for online CPUs)
+ * @param group Group allowed to connect, NULL for every user
+ * @return Exit status
+ */
+int daemon_run(const char *socket_path, int max_sessions, const char *group) {
+  struct Daemon d = {.max_sessions = max_sessions};
+  if (d.max_sessions <= 0)
+    d.max_sessions = sysconf(_SC_NPROCESSORS_ONLN);
+  if (d.max_sessions <= 0)
+    d.max_sessions = 1;
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", socket_path);
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  // Every user's login connects by default. A connection only gets a
+  // place in the admission queue, limited per SO_PEERCRED uid, and the
+  // launch itself runs as the user, so the socket grants no privilege
+  gid_t gid = (gid_t)-1;
+  mode_t mode = 0666;
+  if (group) {
+    struct group *gr = getgrnam(group);
+    if (!gr) {
+      fprintf(stderr, "Unknown group: %s\n", group);
+      return 1;
+    }
+    gid = gr->gr_gid;
+    mode = 0660;
+  }
+
+  int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (lfd < 0) {
+    perror("socket");
+    return 1;
+  }
+
+  unlink(socket_path);
+  if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      chown(socket_path, (uid_t)-1, gid) != 0 ||
+      chmod(socket_path, mode) != 0 || listen(lfd, SOMAXCONN) != 0) {
+    perror(socket_path);
+    close(lfd);
+    return 1;
+  }
+
+  if (reactor_init(&d.reactor) != 0 ||
+      !reactor_add(&d.reactor, lfd, 1, on_listen, &d)) {
+    perror("epoll");
+    close(lfd);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  refresh_system_entries();
+  d.refresh = reactor_timer(&d.reactor, on_refresh, &d);
+  if (!d.refresh) {
+    perror("timerfd");
+    reactor_free(&d.reactor);
+    return 1;
+  }
+  d.watched = watch_system_dirs(&d) == 0;
+  if (!d.watched)
+    reactor_timer_set(d.refresh, now_ms() + DAEMON_REFRESH_INTERVAL_MS);
+
+  printf("Listening on %s, max %d concurrent sessions\n", socket_path,
+         d.max_sessions);
+  fflush(stdout);
+
+  int ret = reactor_run(&d.reactor) != 0;
+  if (ret)
+    perror("epoll_wait");
+  while (d.clients)
+    client_drop(d.clients);
+  reactor_free(&d.reactor);
+  return ret;
+}
+
+/**
+ * Asks a running daemon for a launch slot and waits until it is granted
+ * @param socket_path Daemon socket
+ * @return Connection holding the slot, close it once launched; -1 if
+ *         the daemon is unreachable, rejects the session or does not
+ *         answer within DAEMON_WAIT_MS
+ */
+int daemon_connect(const char *socket_path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socket_path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, socket_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  struct timeval tv = {DAEMON_WAIT_MS / 1000, DAEMON_WAIT_MS % 1000 * 1000};
+  char reply[8];
+  ssize_t n = -1;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+      send(fd, DAEMON_REQUEST, sizeof(DAEMON_REQUEST) - 1, MSG_NOSIGNAL) ==
+          (ssize_t)sizeof(DAEMON_REQUEST) - 1)
+    n = recv(fd, reply, sizeof(reply) - 1, 0);
+
+  if (n != 3 || memcmp(reply, "go\n", 3) != 0) {
+    if (n == 5 && memcmp(reply, "busy\n", 5) == 0)
+      fprintf(stderr, "Daemon rejected the session: too many connections\n");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
@@ -0,0 +1,507 @@
+/**
+ * dbus.c
+ *
+ * Just enough of the D-Bus session bus protocol to ask which names the
+ * bus can activate: SASL EXTERNAL authentication, Hello() and
+ * ListActivatableNames() over the unix socket of
+ * $DBUS_SESSION_BUS_ADDRESS, without libdbus. The whole exchange shares
+ * one DBUS_TIMEOUT_MS deadline, so a stuck or trickling bus cannot stall
+ * the login.
+ *
+ * Also locates the activation (.service) files the bus reads, so that
+ * entries can be checked without talking to the bus at all.
+ */
+
+#define _GNU_SOURCE
+#include "dbus.h"
+#include "supervise.h"
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MSG_METHOD_CALL 1
+#define MSG_METHOD_RETURN 2
+#define MSG_ERROR 3
+
+#define FIELD_PATH 1
+#define FIELD_INTERFACE 2
+#define FIELD_MEMBER 3
+#define FIELD_REPLY_SERIAL 5
+#define FIELD_DESTINATION 6
+
+/* Largest reply accepted from the bus */
+#define MAX_MESSAGE (4u << 20)
+
+/**
+ * Derives the bus name of a DBusActivatable entry from its desktop file
+ * ID, org.example.App.desktop -> org.example.App
+ * @return 0 on success, -1 if the ID is no valid bus name
+ */
+int dbus_name_from_id(const char *id, char *buf, size_t size) {
+  size_t len = strlen(id);
+  if (len > 8 && !strcmp(id + len - 8, ".desktop"))
+    len -= 8;
+  if (len == 0 || len >= size || !memchr(id, '.', len))
+    return -1;
+
+  memcpy(buf, id, len);
+  buf[len] = '\0';
+  return 0;
+}
+
+/**
+ * Looks for NAME.service in the dbus-1/services directory of the user's
+ * data directory and every $XDG_DATA_DIRS entry
+ * @param name Bus name
+ * @param data_home Data directory of the user, NULL for $XDG_DATA_HOME
+ *                  of the caller, "" for the system directories only
+ * @param buf Receives the path of the service file
+ * @param size Size of buf
+ * @return 0 if a service file exists, -1 otherwise
+ */
+int dbus_service_file(const char *name, const char *data_home, char *buf,
+                      size_t size) {
+  char dirs[4096];
+  const char *data_dirs = getenv("XDG_DATA_DIRS");
+  const char *home = getenv("HOME");
+  struct stat st;
+
+  if (!data_home)
+    data_home = getenv("XDG_DATA_HOME");
+  else if (!*data_home)
+    home = NULL;
+  if (data_home && *data_home)
+    snprintf(dirs, sizeof(dirs), "%s:", data_home);
+  else if (home)
+    snprintf(dirs, sizeof(dirs), "%s/.local/share:", home);
+  else
+    dirs[0] = '\0';
+  size_t len = strlen(dirs);
+  snprintf(dirs + len, sizeof(dirs) - len, "%s",
+           data_dirs && *data_dirs ? data_dirs : "/usr/local/share:/usr/share");
+
+  char *save = NULL;
+  for (char *dir = strtok_r(dirs, ":", &save); dir;
+       dir = strtok_r(NULL, ":", &save)) {
+    if (snprintf(buf, size, "%s/dbus-1/services/%s.service", dir, name) >=
+        (int)size)
+      continue;
+    if (stat(buf, &st) == 0 && S_ISREG(st.st_mode))
+      return 0;
+  }
+  return -1;
+}
+
+/**
+ * Copies a D-Bus address value, decoding %XX escapes
+ */
+static void address_value(const char *v, size_t n, char *buf, size_t size) {
+  size_t o = 0;
+  for (size_t i = 0; i < n && o + 1 < size; i++) {
+    if (v[i] == '%' && i + 2 < n && isxdigit((unsigned char)v[i + 1]) &&
+        isxdigit((unsigned char)v[i + 2])) {
+      char hex[3] = {v[i + 1], v[i + 2], '\0'};
+      buf[o++] = (char)strtol(hex, NULL, 16);
+      i += 2;
+    } else {
+      buf[o++] = v[i];
+    }
+  }
+  buf[o] = '\0';
+}
+
+/**
+ * Connects to the first unix: address of the session bus. The socket is
+ * non-blocking, a bus whose backlog is full counts as unreachable.
+ * @return Connected socket, -1 on failure
+ */
+static int bus_connect(void) {
+  const char *address = getenv("DBUS_SESSION_BUS_ADDRESS");
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  char fallback[256];
+
+  if (!address || !*address) {
+    if (!runtime || !*runtime)
+      return -1;
+    snprintf(fallback, sizeof(fallback), "unix:path=%s/bus", runtime);
+    address = fallback;
+  }
+
+  for (const char *a = address; *a;) {
+    size_t alen = strcspn(a, ";");
+    struct sockaddr_un sa;
+    socklen_t salen = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+
+    if (!strncmp(a, "unix:", 5)) {
+      for (const char *kv = a + 5; kv < a + alen;) {
+        size_t kvlen = strcspn(kv, ",;");
+        const char *eq = memchr(kv, '=', kvlen);
+        if (eq) {
+          size_t klen = eq - kv, vlen = kvlen - klen - 1;
+          if (klen == 4 && !strncmp(kv, "path", 4)) {
+            address_value(eq + 1, vlen, sa.sun_path, sizeof(sa.sun_path));
+            salen = sizeof(sa);
+          } else if (klen == 8 && !strncmp(kv, "abstract", 8)) {
+            address_value(eq + 1, vlen, sa.sun_path + 1,
+                          sizeof(sa.sun_path) - 1);
+            salen = offsetof(struct sockaddr_un, sun_path) + 1 +
+                    strlen(sa.sun_path + 1);
+          }
+        }
+        kv += kvlen + (kv[kvlen] == ',');
+      }
+    }
+
+    if (salen) {
+      int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+      if (fd < 0)
+        return -1;
+      if (connect(fd, (struct sockaddr *)&sa, salen) == 0)
+        return fd;
+      close(fd);
+    }
+
+    a += alen + (a[alen] == ';');
+  }
+  return -1;
+}
+
+/**
+ * Waits until the socket is ready for events or the deadline passes
+ * @param deadline now_ms() at which the exchange is given up
+ * @return 0 once ready, -1 on timeout or error
+ */
+static int bus_wait(int fd, short events, long deadline) {
+  struct pollfd pfd = {.fd = fd, .events = events};
+  for (;;) {
+    long left = deadline - now_ms();
+    if (left <= 0)
+      return -1;
+    int n = poll(&pfd, 1, (int)left);
+    if (n > 0)
+      return 0;
+    if (n == 0 || errno != EINTR)
+      return -1;
+  }
+}
+
+static int send_all(int fd, const void *buf, size_t len, long deadline) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+      if (bus_wait(fd, POLLOUT, deadline) != 0)
+        return -1;
+      continue;
+    }
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len, long deadline) {
+  char *p = buf;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+      if (bus_wait(fd, POLLIN, deadline) != 0)
+        return -1;
+      continue;
+    }
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * SASL EXTERNAL authentication with the connecting uid
+ * @return 0 once the bus accepted, -1 otherwise
+ */
+static int bus_auth(int fd, long deadline) {
+  char uid[32], hex[64], line[256];
+  snprintf(uid, sizeof(uid), "%u", (unsigned)geteuid());
+  for (size_t i = 0; uid[i]; i++)
+    snprintf(hex + 2 * i, 3, "%02x", (unsigned char)uid[i]);
+
+  int n = snprintf(line, sizeof(line), "AUTH EXTERNAL %s\r\n", hex);
+  if (send_all(fd, "", 1, deadline) != 0 ||
+      send_all(fd, line, n, deadline) != 0)
+    return -1;
+
+  size_t len = 0;
+  while (len + 1 < sizeof(line)) {
+    if (recv_all(fd, line + len, 1, deadline) != 0)
+      return -1;
+    if (line[len++] == '\n')
+      break;
+  }
+  line[len] = '\0';
+  if (strncmp(line, "OK ", 3) != 0)
+    return -1;
+
+  return send_all(fd, "BEGIN\r\n", 7, deadline);
+}
+
+/* Outgoing message, native byte order */
+struct Msg {
+  unsigned char buf[512];
+  size_t len;
+};
+
+static void put_align(struct Msg *m, size_t a) {
+  while (m->len % a)
+    m->buf[m->len++] = 0;
+}
+
+static void put_u32(struct Msg *m, uint32_t v) {
+  put_align(m, 4);
+  memcpy(m->buf + m->len, &v, 4);
+  m->len += 4;
+}
+
+static void put_field(struct Msg *m, unsigned char code, char type,
+                      const char *value) {
+  size_t len = strlen(value);
+  put_align(m, 8);
+  m->buf[m->len++] = code;
+  m->buf[m->len++] = 1; // signature "s" or "o"
+  m->buf[m->len++] = type;
+  m->buf[m->len++] = 0;
+  put_u32(m, (uint32_t)len);
+  memcpy(m->buf + m->len, value, len + 1);
+  m->len += len + 1;
+}
+
+/**
+ * Sends an argument-less method call to the bus driver
+ */
+static int bus_call(int fd, uint32_t serial, const char *member,
+                    long deadline) {
+  static const uint16_t one = 1;
+  struct Msg m = {.len = 0};
+
+  m.buf[m.len++] = *(const unsigned char *)&one ? 'l' : 'B';
+  m.buf[m.len++] = MSG_METHOD_CALL;
+  m.buf[m.len++] = 0;
+  m.buf[m.len++] = 1; // protocol version
+  put_u32(&m, 0);     // no body
+  put_u32(&m, serial);
+  put_u32(&m, 0); // header fields length, set below
+
+  put_field(&m, FIELD_PATH, 'o', "/org/freedesktop/DBus");
+  put_field(&m, FIELD_INTERFACE, 's', "org.freedesktop.DBus");
+  put_field(&m, FIELD_MEMBER, 's', member);
+  put_field(&m, FIELD_DESTINATION, 's', "org.freedesktop.DBus");
+
+  uint32_t fields = (uint32_t)(m.len - 16);
+  memcpy(m.buf + 12, &fields, 4);
+  put_align(&m, 8);
+  return send_all(fd, m.buf, m.len, deadline);
+}
+
+/* Incoming message */
+struct Reply {
+  unsigned char *buf;
+  size_t len;
+  size_t body; // offset of the body
+  int swap;    // sender's byte order differs from ours
+  unsigned char type;
+  uint32_t reply_serial;
+};
+
+static uint32_t load_u32(const unsigned char *p, int swap) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return swap ? __builtin_bswap32(v) : v;
+}
+
+static int get_u32(const struct Reply *r, size_t pos, uint32_t *v) {
+  if (pos + 4 > r->len)
+    return -1;
+  *v = load_u32(r->buf + pos, r->swap);
+  return 0;
+}
+
+static size_t align(size_t pos, size_t a) { return (pos + a - 1) & ~(a - 1); }
+
+/**
+ * Reads one message and the header fields needed to match replies
+ * @param r Receives the message, free r->buf after use
+ * @param deadline now_ms() at which the exchange is given up
+ * @return 0 on success, -1 on I/O or format errors
+ */
+static int bus_read(int fd, struct Reply *r, long deadline) {
+  static const uint16_t one = 1;
+  unsigned char head[16];
+  uint32_t body_len, fields_len;
+
+  memset(r, 0, sizeof(*r));
+  if (recv_all(fd, head, sizeof(head), deadline) != 0 ||
+      (head[0] != 'l' && head[0] != 'B'))
+    return -1;
+
+  r->swap = (head[0] == 'l') != (*(const unsigned char *)&one == 1);
+  r->type = head[1];
+  body_len = load_u32(head + 4, r->swap);
+  fields_len = load_u32(head + 12, r->swap);
+  if (body_len > MAX_MESSAGE || fields_len > MAX_MESSAGE)
+    return -1;
+
+  r->body = align(16 + fields_len, 8);
+  r->len = r->body + body_len;
+  r->buf = malloc(r->len);
+  if (!r->buf) {
+    perror("malloc");
+    return -1;
+  }
+  memcpy(r->buf, head, sizeof(head));
+  if (recv_all(fd, r->buf + 16, r->len - 16, deadline) != 0)
+    return -1;
+
+  for (size_t pos = 16; pos < 16 + fields_len;) {
+    pos = align(pos, 8);
+    if (pos + 2 > r->len)
+      return -1;
+    unsigned char code = r->buf[pos++];
+    unsigned char sig_len = r->buf[pos++];
+    if (sig_len != 1 || pos + 2 > r->len)
+      return -1;
+    char type = (char)r->buf[pos];
+    pos += 2;
+
+    uint32_t v;
+    switch (type) {
+    case 'u':
+      pos = align(pos, 4);
+      if (get_u32(r, pos, &v) != 0)
+        return -1;
+      if (code == FIELD_REPLY_SERIAL)
+        r->reply_serial = v;
+      pos += 4;
+      break;
+    case 's':
+    case 'o':
+      pos = align(pos, 4);
+      if (get_u32(r, pos, &v) != 0)
+        return -1;
+      pos += 4 + (size_t)v + 1;
+      break;
+    case 'g':
+      if (pos >= r->len)
+        return -1;
+      pos += 1 + (size_t)r->buf[pos] + 1;
+      break;
+    default:
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Appends the strings of an "as" reply body
+ */
+static int parse_names(const struct Reply *r, struct BusNames *out) {
+  uint32_t array_len, len;
+  size_t pos = r->body;
+
+  if (get_u32(r, pos, &array_len) != 0)
+    return -1;
+  pos += 4;
+  size_t end = pos + array_len;
+  if (end > r->len)
+    return -1;
+
+  while (pos < end) {
+    pos = align(pos, 4);
+    if (get_u32(r, pos, &len) != 0 || pos + 4 + (size_t)len + 1 > end)
+      return -1;
+    pos += 4;
+
+    char **names = realloc(out->names, (out->count + 1) * sizeof(char *));
+    if (!names) {
+      perror("realloc");
+      return -1;
+    }
+    out->names = names;
+    out->names[out->count] = strndup((const char *)r->buf + pos, len);
+    if (!out->names[out->count]) {
+      perror("strndup");
+      return -1;
+    }
+    out->count++;
+    pos += len + 1;
+  }
+  return 0;
+}
+
+/**
+ * Asks the session bus which names it can activate
+ * @param out Receives the names, release with dbus_names_free()
+ * @return 0 on success, -1 if the bus is unreachable or misbehaves
+ */
+int dbus_list_activatable(struct BusNames *out) {
+  memset(out, 0, sizeof(*out));
+
+  long deadline = now_ms() + DBUS_TIMEOUT_MS;
+  int fd = bus_connect();
+  if (fd < 0)
+    return -1;
+
+  int ret = -1;
+  if (bus_auth(fd, deadline) != 0 || bus_call(fd, 1, "Hello", deadline) != 0 ||
+      bus_call(fd, 2, "ListActivatableNames", deadline) != 0)
+    goto out;
+
+  // Skip the Hello() reply and NameAcquired signals
+  for (int i = 0; i < 16; i++) {
+    struct Reply r;
+    int err = bus_read(fd, &r, deadline);
+    int done = !err && r.reply_serial == 2 &&
+               (r.type == MSG_METHOD_RETURN || r.type == MSG_ERROR);
+    if (done && r.type == MSG_METHOD_RETURN)
+      ret = parse_names(&r, out);
+    free(r.buf);
+    if (err || done)
+      break;
+  }
+
+out:
+  close(fd);
+  if (ret != 0)
+    dbus_names_free(out);
+  return ret;
+}
+
+/**
+ * @return 1 if name is in the list
+ */
+int dbus_names_has(const struct BusNames *names, const char *name) {
+  for (size_t i = 0; i < names->count; i++)
+    if (!strcmp(names->names[i], name))
+      return 1;
+  return 0;
+}
+
+void dbus_names_free(struct BusNames *names) {
+  for (size_t i = 0; i < names->count; i++)
+    free(names->names[i]);
+  free(names->names);
+  memset(names, 0, sizeof(*names));
+}
@@ -0,0 +1,165 @@
+/**
+ * dirtrie.c
+ *
+ * Directory policy as a trie of path components. A rule applies to its
+ * path and everything below it; components may be fnmatch() globs
+ * (/run/media/?*, /mnt/nfs-?). Lookups walk the components of a path
+ * without touching the filesystem, the deepest matching rule wins.
+ */
+
+#include "dirtrie.h"
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct DirNode {
+  char *name;
+  int glob;   // name holds glob characters
+  int policy; // -1 none, 0 block, 1 allow
+  int rule;   // config order, the first rule wins among equals
+  struct DirNode *children;
+  struct DirNode *next;
+};
+
+struct DirTrie {
+  struct DirNode root;
+};
+
+static void node_free(struct DirNode *n) {
+  while (n) {
+    struct DirNode *next = n->next;
+    node_free(n->children);
+    free(n->name);
+    free(n);
+    n = next;
+  }
+}
+
+/**
+ * @return Empty trie, NULL on allocation failure
+ */
+struct DirTrie *dirtrie_new(void) {
+  struct DirTrie *t = calloc(1, sizeof(*t));
+  if (t)
+    t->root.policy = -1;
+  return t;
+}
+
+void dirtrie_free(struct DirTrie *t) {
+  if (!t)
+    return;
+  node_free(t->root.children);
+  free(t);
+}
+
+/**
+ * Returns the next non-empty path component that is not "."
+ * @param p In/out: position in the path
+ * @param len Receives the component length
+ * @return Component start, NULL at the end of the path
+ */
+static const char *next_component(const char **p, size_t *len) {
+  for (;;) {
+    while (**p == '/')
+      (*p)++;
+    if (!**p)
+      return NULL;
+
+    const char *start = *p;
+    while (**p && **p != '/')
+      (*p)++;
+    *len = *p - start;
+    if (*len != 1 || *start != '.')
+      return start;
+  }
+}
+
+/**
+ * Adds a rule for a directory tree
+ * @param t Trie
+ * @param path Directory, components may be globs
+ * @param allow 1 to allow, 0 to block the tree
+ * @param rule Rule order, the lowest wins between rules of equal depth
+ * @return 0 on success, -1 on allocation failure
+ */
+int dirtrie_add(struct DirTrie *t, const char *path, int allow, int rule) {
+  struct DirNode *node = &t->root;
+  const char *p = path, *comp;
+  size_t len;
+
+  while ((comp = next_component(&p, &len))) {
+    struct DirNode *child = node->children;
+    while (child && (strlen(child->name) != len ||
+                     strncmp(child->name, comp, len) != 0))
+      child = child->next;
+
+    if (!child) {
+      child = calloc(1, sizeof(*child));
+      if (!child || !(child->name = strndup(comp, len))) {
+        free(child);
+        return -1;
+      }
+      child->glob = strpbrk(child->name, "*?[") != NULL;
+      child->policy = -1;
+      child->next = node->children;
+      node->children = child;
+    }
+    node = child;
+  }
+
+  if (node->policy < 0 || rule < node->rule) {
+    node->policy = allow;
+    node->rule = rule;
+  }
+  return 0;
+}
+
+struct Best {
+  int depth;
+  int rule;
+  int policy;
+};
+
+static void lookup(const struct DirNode *node, const char *p, int depth,
+                   struct Best *best) {
+  if (node->policy >= 0 &&
+      (depth > best->depth ||
+       (depth == best->depth && node->rule < best->rule))) {
+    best->depth = depth;
+    best->rule = node->rule;
+    best->policy = node->policy;
+  }
+
+  size_t len;
+  const char *comp = next_component(&p, &len);
+  if (!comp || !node->children)
+    return;
+
+  char name[256];
+  if (len >= sizeof(name))
+    return;
+  memcpy(name, comp, len);
+  name[len] = '\0';
+
+  for (const struct DirNode *c = node->children; c; c = c->next) {
+    int match = c->glob ? fnmatch(c->name, name, FNM_PERIOD) == 0
+                        : strcmp(c->name, name) == 0;
+    if (match)
+      lookup(c, p, depth + 1, best);
+  }
+}
+
+/**
+ * Finds the policy of a directory from the deepest rule covering it
+ * @param t Trie (may be NULL)
+ * @param path Absolute directory path
+ * @return 1 if allowed, 0 if blocked, -1 if no rule applies
+ */
+int dirtrie_lookup(const struct DirTrie *t, const char *path) {
+  if (!t)
+    return -1;
+
+  struct Best best = {-1, 0, -1};
+  lookup(&t->root, path, 0, &best);
+  return best.policy;
+}
@@ -0,0 +1,283 @@
+#include "generate.h"
+#include "util.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define UNIT_HEADER "# Generated by autostart, do not edit\n"
+#define UNIT_NAME_MAX 512
+
+/**
+ * Builds a unit name from an application name, keeping only characters
+ * systemd accepts in unit names
+ * @param name Application name
+ * @param index Queue index, appended on collisions
+ * @param units Unit names of the earlier entries; different names may
+ *        sanitize to the same unit
+ * @param buf Output buffer
+ * @param size Size of buf
+ */
+static void unit_name(const char *name, size_t index,
+                      char (*units)[UNIT_NAME_MAX], char *buf, size_t size) {
+  char safe[256];
+  size_t n = 0;
+
+  for (const char *p = name; *p && n < sizeof(safe) - 1; p++) {
+    char c = *p;
+    int ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+             (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' ||
+             c == ':';
+    safe[n++] = ok ? c : '_';
+  }
+  safe[n] = '\0';
+
+  snprintf(buf, size, UNIT_PREFIX "%s.service", safe);
+  for (size_t i = 0; i < index; i++) {
+    if (strcmp(units[i], buf) == 0) {
+      snprintf(buf, size, UNIT_PREFIX "%s-%zu.service", safe, index);
+      break;
+    }
+  }
+}
+
+/**
+ * Writes a value with % doubled, so systemd does not expand specifiers
+ * @param f Output file
+ * @param s Value
+ */
+static void write_escaped(FILE *f, const char *s) {
+  for (; *s; s++) {
+    if (*s == '%')
+      fputc('%', f);
+    fputc(*s, f);
+  }
+}
+
+/**
+ * Writes a string double quoted: backslash and quote are escaped and %
+ * is doubled. In command lines $ is doubled too; Environment= does not
+ * expand variables, there it stays as is.
+ * @param f Output file
+ * @param s Argument
+ * @param command Quote for an Exec*= command line
+ */
+static void write_quoted(FILE *f, const char *s, int command) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '\\' || *s == '"')
+      fputc('\\', f);
+    else if (*s == '%' || (command && *s == '$'))
+      fputc(*s, f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+/**
+ * Writes one service unit for a queued application
+ * @param dir Output directory
+ * @param unit Unit file name
+ * @param de Desktop entry
+ * @param cfg Configuration (terminal and per-app knobs)
+ * @param offset_ms Start offset since session start
+ * @return 0 on success, -1 on error
+ */
+static int write_unit(const char *dir, const char *unit,
+                      const struct DesktopEntry *de, struct Config *cfg,
+                      long offset_ms) {
+  char path[MAX_PATH];
+  if (snprintf(path, sizeof(path), "%s/%s", dir, unit) >= (int)sizeof(path))
+    return -1;
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  char cmd[MAX_PATH];
+  if (de->terminal)
+    snprintf(cmd, sizeof(cmd), "%s %s", cfg->terminal, de->exec);
+  else
+    snprintf(cmd, sizeof(cmd), "%s", de->exec);
+  remove_desktop_specifiers(cmd);
+
+  fprintf(f, UNIT_HEADER);
+  fprintf(f, "[Unit]\n");
+  fprintf(f, "Description=");
+  write_escaped(f, de->name);
+  fprintf(f, " (autostart)\n");
+  fprintf(f, "PartOf=" UNIT_TARGET "\n");
+  fprintf(f, "After=" UNIT_TARGET "\n");
+
+  fprintf(f, "\n[Service]\n");
+  fprintf(f, "Type=exec\n");
+  fprintf(f, "Slice=app.slice\n");
+  // Stagger delays become absolute start offsets, starts run in parallel
+  if (offset_ms > 0)
+    fprintf(f, "ExecStartPre=/bin/sleep %ld.%03ld\n", offset_ms / 1000,
+            offset_ms % 1000);
+  fprintf(f, "ExecStart=/bin/sh -c ");
+  write_quoted(f, cmd, 1);
+  fprintf(f, "\n");
+  if (*de->path) {
+    fprintf(f, "WorkingDirectory=-");
+    write_escaped(f, de->path);
+    fprintf(f, "\n");
+  }
+
+  struct AppRule *rule = entry_rule(cfg, de);
+  if (rule) {
+    if (rule->nice)
+      fprintf(f, "Nice=%d\n", rule->nice);
+    for (int i = 0; i < rule->env_count; i++) {
+      if (strchr(rule->env[i], '=')) {
+        fprintf(f, "Environment=");
+        write_quoted(f, rule->env[i], 0);
+        fprintf(f, "\n");
+      } else {
+        fprintf(f, "UnsetEnvironment=");
+        write_escaped(f, rule->env[i]);
+        fprintf(f, "\n");
+      }
+    }
+  }
+
+  fprintf(f, "\n[Install]\n");
+  fprintf(f, "WantedBy=" UNIT_TARGET "\n");
+
+  int ret = ferror(f) ? -1 : 0;
+  if (fclose(f) != 0)
+    ret = -1;
+  return ret;
+}
+
+/**
+ * @return 1 if a unit file in dir starts with UNIT_HEADER
+ */
+static int unit_generated(const char *dir, const char *unit) {
+  char path[MAX_PATH], line[sizeof(UNIT_HEADER)];
+  if (snprintf(path, sizeof(path), "%s/%s", dir, unit) >= (int)sizeof(path))
+    return 0;
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+  int ours = fgets(line, sizeof(line), f) && strcmp(line, UNIT_HEADER) == 0;
+  fclose(f);
+  return ours;
+}
+
+/**
+ * Removes the units of earlier runs that this run no longer produces,
+ * e.g. of entries deleted or hidden since, with their .wants links.
+ * Only autostart-*.service files that carry UNIT_HEADER are touched.
+ * @param dir Output directory
+ * @param wants Its UNIT_TARGET.wants directory
+ * @param units Unit names produced by this run
+ * @param count Number of units
+ * @return Number of removed units
+ */
+static int remove_stale_units(const char *dir, const char *wants,
+                              char (*units)[UNIT_NAME_MAX], size_t count) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return 0;
+
+  int removed = 0;
+  struct dirent *e;
+  char path[MAX_PATH + UNIT_NAME_MAX];
+
+  while ((e = readdir(d)) != NULL) {
+    size_t len = strlen(e->d_name);
+    if (strncmp(e->d_name, UNIT_PREFIX, strlen(UNIT_PREFIX)) != 0 ||
+        len < 8 || strcmp(e->d_name + len - 8, ".service") != 0)
+      continue;
+
+    int current = 0;
+    for (size_t i = 0; i < count && !current; i++)
+      current = strcmp(units[i], e->d_name) == 0;
+    if (current || !unit_generated(dir, e->d_name))
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%s", wants, e->d_name);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    if (unlink(path) == 0) {
+      printf("Removed stale %s\n", e->d_name);
+      removed++;
+    }
+  }
+
+  closedir(d);
+  return removed;
+}
+
+/**
+ * Writes one systemd user service per queued application, plus the
+ * UNIT_TARGET.wants/ links a generator directory needs. Units of
+ * earlier runs that are no longer produced are removed.
+ * @param dir Output directory (created if missing)
+ * @param queue Filtered application queue
+ * @param cfg Configuration used for delays, terminal and knobs
+ * @return Number of generated units, -1 on error
+ */
+int generate_units(const char *dir, const struct AppQueue *queue,
+                   struct Config *cfg) {
+  char wants[MAX_PATH];
+  if (snprintf(wants, sizeof(wants), "%s/" UNIT_TARGET ".wants", dir) >=
+      (int)sizeof(wants))
+    return -1;
+
+  if ((mkdir(dir, 0755) != 0 && errno != EEXIST) ||
+      (mkdir(wants, 0755) != 0 && errno != EEXIST)) {
+    fprintf(stderr, "Failed to create %s: %s\n", wants, strerror(errno));
+    return -1;
+  }
+
+  printf("\n========================================\n");
+  printf("Generating %zu units in %s\n", queue->count, dir);
+
+  int generated = 0;
+  long offset_ms = 0;
+  char(*units)[UNIT_NAME_MAX] = calloc(queue->count + 1, sizeof(*units));
+  if (!units) {
+    perror("calloc");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < queue->count; i++) {
+    const struct DesktopEntry *de = &queue->apps[i];
+    offset_ms += config_app_delay(cfg, entry_rule(cfg, de), i == 0);
+
+    char *unit = units[i];
+    unit_name(de->name, i, units, unit, UNIT_NAME_MAX);
+
+    if (write_unit(dir, unit, de, cfg, offset_ms) != 0)
+      continue;
+
+    char link[MAX_PATH + UNIT_NAME_MAX];
+    char target[UNIT_NAME_MAX + 3];
+    snprintf(link, sizeof(link), "%s/%s", wants, unit);
+    snprintf(target, sizeof(target), "../%s", unit);
+    unlink(link);
+    if (symlink(target, link) != 0)
+      fprintf(stderr, "Failed to link %s: %s\n", link, strerror(errno));
+
+    printf("[%zu/%zu] %s: %s (+%ldms)\n", i + 1, queue->count, de->name, unit,
+           offset_ms);
+    generated++;
+  }
+
+  remove_stale_units(dir, wants, units, queue->count);
+  free(units);
+
+  printf("========================================\n");
+  printf("Generated: %d\n", generated);
+
+  return generated;
+}
@@ -0,0 +1,474 @@
+/**
+ * history.c
+ *
+ * Startup history for the crash-loop quarantine and the launch
+ * simulator. After a launch the launcher watches its applications for
+ * crash_window; an application that exits non-zero or dies from a signal
+ * in that window failed its start. Entries that failed quarantine_after
+ * sessions in a row are quarantined: skipped, or launched once every
+ * other application has started. A skipped entry is tried again once
+ * quarantine_retry has passed since its last start. The CPU time and
+ * peak RSS of each start are kept as the cost model of --simulate.
+ * Supervised sessions also record which applications were still
+ * running when they ended, for the restore policy of the next login,
+ * and sessions with perf_window the cold start counters of each
+ * application.
+ *
+ * The history is a small key=value file under $XDG_STATE_HOME, one line
+ * per desktop file ID:
+ *
+ *   ID=STREAK STATUS RUNTIME_MS TIME CPU_MS RSS_KB ALIVE \
+ *      TASK_CLOCK_MS FAULTS MAJOR_FAULTS CSWITCHES CYCLES INSTRUCTIONS
+ *
+ * A good start resets the streak; removing the line (or the file) by
+ * hand lifts a quarantine as well. Lines older than HISTORY_MAX_AGE are
+ * dropped.
+ */
+
+#define _GNU_SOURCE
+#include "history.h"
+#include "supervise.h"
+#include "util.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Builds the history file path, $XDG_STATE_HOME/autostart/history or
+ * ~/.local/state/autostart/history
+ * @param home User home directory
+ * @param buf Output buffer
+ * @param size Size of the output buffer
+ * @return 0 on success, -1 if the path does not fit
+ */
+int history_path(const char *home, char *buf, size_t size) {
+  const char *state = getenv("XDG_STATE_HOME");
+  int n;
+
+  if (state && *state == '/')
+    n = snprintf(buf, size, "%s/autostart/history", state);
+  else
+    n = snprintf(buf, size, "%s/.local/state/autostart/history", home);
+  return n >= 0 && (size_t)n < size ? 0 : -1;
+}
+
+/**
+ * Finds or adds the record of a desktop file ID
+ * @return Record, NULL if it can't be added
+ */
+static struct HistoryEntry *history_get(struct History *h, const char *id) {
+  struct HistoryEntry *e = history_find(h, id);
+  if (e)
+    return e;
+
+  if (h->count == h->capacity) {
+    size_t capacity = h->capacity ? h->capacity * 2 : 16;
+    struct HistoryEntry *tmp = realloc(h->entries, capacity * sizeof(*tmp));
+    if (!tmp) {
+      perror("realloc");
+      return NULL;
+    }
+    h->entries = tmp;
+    h->capacity = capacity;
+  }
+
+  e = &h->entries[h->count++];
+  memset(e, 0, sizeof(*e));
+  snprintf(e->id, sizeof(e->id), "%s", id);
+  e->cpu_ms = e->rss_kb = -1;
+  e->alive = -1;
+  for (int i = 0; i < PSTAT_EVENTS; i++)
+    e->perf[i] = -1;
+  e->time = time(NULL);
+  return e;
+}
+
+/**
+ * @return Record of a desktop file ID, NULL if it has none
+ */
+struct HistoryEntry *history_find(struct History *h, const char *id) {
+  for (size_t i = 0; i < h->count; i++)
+    if (!strcmp(h->entries[i].id, id))
+      return &h->entries[i];
+  return NULL;
+}
+
+/**
+ * Reads the history file. A missing file is an empty history. It lives
+ * in the user's home, so a symbolic link, FIFO or oversized file in its
+ * place is refused rather than followed, waited on or slurped.
+ * @param h History to fill, zero initialized
+ * @param home User home directory
+ * @return 0 on success, -1 if the file exists but can't be read or held
+ */
+int history_load(struct History *h, const char *home) {
+  char path[4096];
+  struct Tokenizer t;
+  struct Token tok;
+
+  if (history_path(home, path, sizeof(path)) != 0)
+    return -1;
+  if (tokenizer_open(&t, path, TOKENIZER_REGULAR | TOKENIZER_NOFOLLOW) != 0)
+    return errno == ENOENT ? 0 : -1;
+
+  while (tokenizer_next(&t, &tok) != TOKEN_END) {
+    struct HistoryEntry e = {.cpu_ms = -1, .rss_kb = -1, .alive = -1};
+    long long when;
+    for (int i = 0; i < PSTAT_EVENTS; i++)
+      e.perf[i] = -1;
+    // Files of older versions lack the cost, alive and counter fields
+    if (tok.type != TOKEN_PAIR || !*tok.key ||
+        sscanf(tok.value, "%d %d %ld %lld %ld %ld %d %lld %lld %lld %lld %lld "
+                          "%lld",
+               &e.streak, &e.status, &e.runtime_ms, &when, &e.cpu_ms,
+               &e.rss_kb, &e.alive, &e.perf[0], &e.perf[1], &e.perf[2],
+               &e.perf[3], &e.perf[4], &e.perf[5]) < 4)
+      continue;
+
+    struct HistoryEntry *dst = history_get(h, tok.key);
+    if (!dst) {
+      tokenizer_close(&t);
+      return -1;
+    }
+    dst->streak = e.streak;
+    dst->status = e.status;
+    dst->runtime_ms = e.runtime_ms;
+    dst->time = (time_t)when;
+    dst->cpu_ms = e.cpu_ms;
+    dst->rss_kb = e.rss_kb;
+    dst->alive = e.alive;
+    memcpy(dst->perf, e.perf, sizeof(dst->perf));
+  }
+
+  tokenizer_close(&t);
+  return 0;
+}
+
+/**
+ * Creates the parent directories of a file path
+ */
+static int make_parents(const char *path) {
+  char dir[4096];
+  snprintf(dir, sizeof(dir), "%s", path);
+
+  for (char *p = dir + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+      return -1;
+    *p = '/';
+  }
+  return 0;
+}
+
+/**
+ * Atomically replaces the history file, dropping stale entries
+ * @param h History
+ * @param home User home directory
+ * @return 0 on success, -1 on failure
+ */
+int history_save(const struct History *h, const char *home) {
+  char path[4096], tmp[4096 + 8];
+
+  if (history_path(home, path, sizeof(path)) != 0 || make_parents(path) != 0)
+    return -1;
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+  int fd = mkstemp(tmp);
+  if (fd < 0)
+    return -1;
+  FILE *f = fdopen(fd, "w");
+  if (!f) {
+    close(fd);
+    unlink(tmp);
+    return -1;
+  }
+
+  time_t oldest = time(NULL) - HISTORY_MAX_AGE;
+  fprintf(f, "# autostart startup history: "
+             "ID=STREAK STATUS RUNTIME_MS TIME CPU_MS RSS_KB ALIVE "
+             "TASK_CLOCK_MS FAULTS MAJOR_FAULTS CSWITCHES CYCLES "
+             "INSTRUCTIONS\n");
+  for (size_t i = 0; i < h->count; i++) {
+    const struct HistoryEntry *e = &h->entries[i];
+    if (e->time < oldest)
+      continue;
+    fprintf(f, "%s=%d %d %ld %lld %ld %ld %d", e->id, e->streak, e->status,
+            e->runtime_ms, (long long)e->time, e->cpu_ms, e->rss_kb,
+            e->alive);
+    for (int k = 0; k < PSTAT_EVENTS; k++)
+      fprintf(f, " %lld", e->perf[k]);
+    fputc('\n', f);
+  }
+
+  int ok = fflush(f) == 0 && !ferror(f);
+  if (fclose(f) != 0)
+    ok = 0;
+  if (!ok || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Releases the history records
+ */
+void history_free(struct History *h) {
+  free(h->entries);
+  memset(h, 0, sizeof(*h));
+}
+
+/**
+ * @return 1 if the entry failed quarantine_after starts in a row
+ */
+int history_quarantined(struct History *h, const struct Config *cfg,
+                        const char *id) {
+  if (cfg->quarantine == QUARANTINE_OFF || cfg->quarantine_after <= 0)
+    return 0;
+
+  struct HistoryEntry *e = history_find(h, id);
+  return e && e->streak >= cfg->quarantine_after;
+}
+
+/**
+ * @return 1 if the entry is quarantined but its last start is older than
+ *         quarantine_retry, so that it gets another try
+ */
+int history_retry_due(struct History *h, const struct Config *cfg,
+                      const char *id) {
+  if (cfg->quarantine_retry_s <= 0 || !history_quarantined(h, cfg, id))
+    return 0;
+
+  struct HistoryEntry *e = history_find(h, id);
+  return time(NULL) - e->time >= cfg->quarantine_retry_s;
+}
+
+/**
+ * Records the outcome of each launched application. Exits within the
+ * window are good only with status 0; applications still running after
+ * the window are good, the ones still younger than it are not judged.
+ * @param h History
+ * @param children Tracked children after watch_startup()
+ * @param window_ms Crash window
+ */
+void history_update(struct History *h, const struct ChildList *children,
+                    int window_ms) {
+  long now = now_ms();
+
+  for (size_t i = 0; i < children->count; i++) {
+    const struct Child *c = &children->items[i];
+    // Helpers have no ID, the exit status of foreign reaps is lost
+    if (!*c->id || (c->exited && c->status < 0))
+      continue;
+
+    long runtime = (c->exited ? c->exited_ms : now) - c->started_ms;
+    if (!c->exited && runtime < window_ms)
+      continue;
+
+    int status = 0;
+    if (c->exited)
+      status = WIFSIGNALED(c->status) ? -WTERMSIG(c->status)
+                                      : WEXITSTATUS(c->status);
+
+    struct HistoryEntry *e = history_get(h, c->id);
+    if (!e)
+      break;
+    e->streak = runtime < window_ms && status != 0 ? e->streak + 1 : 0;
+    e->status = status;
+    e->runtime_ms = runtime;
+    e->time = time(NULL) - (now - c->started_ms) / 1000;
+    if (c->cpu_ms >= 0) {
+      e->cpu_ms = c->cpu_ms;
+      e->rss_kb = c->rss_kb;
+    }
+  }
+}
+
+static int mark_session(pid_t pid, size_t session, void *data) {
+  (void)pid;
+  char *running = data;
+  running[session] = 1;
+  return 0;
+}
+
+/**
+ * Records which launched applications are still running as a supervised
+ * session ends. Applications are session leaders, so one still runs as
+ * long as any process of its session does, even after the process that
+ * was launched forked into the background and exited.
+ * @param h History
+ * @param children Tracked children, before the teardown
+ */
+void history_session_end(struct History *h, const struct ChildList *children) {
+  pid_t *sessions = calloc(children->count + 1, sizeof(*sessions));
+  char *running = calloc(children->count + 1, 1);
+  if (!sessions || !running) {
+    perror("calloc");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < children->count; i++)
+    sessions[i] = children->items[i].pid;
+  proc_session_walk(sessions, children->count, mark_session, running);
+
+  // An ID launched twice runs if either of its instances does
+  for (size_t i = 0; i < children->count; i++)
+    if (*children->items[i].id)
+      history_set_alive(h, children->items[i].id, 0);
+  for (size_t i = 0; i < children->count; i++)
+    if (*children->items[i].id && running[i])
+      history_set_alive(h, children->items[i].id, 1);
+
+  free(sessions);
+  free(running);
+}
+
+/**
+ * Records whether an application ran at the end of the session
+ * @param h History
+ * @param id Desktop file ID
+ * @param alive 1 if it was running, 0 if not
+ */
+void history_set_alive(struct History *h, const char *id, int alive) {
+  struct HistoryEntry *e = history_get(h, id);
+  if (e)
+    e->alive = alive;
+}
+
+/**
+ * @return 1 if the entry was closed before the last supervised session
+ *         ended
+ */
+int history_closed(struct History *h, const char *id) {
+  struct HistoryEntry *e = history_find(h, id);
+  return e && e->alive == 0;
+}
+
+/**
+ * Prints one line per failing entry explaining its quarantine state
+ * @param out Output stream
+ * @param h History
+ * @param cfg Configuration (quarantine policy)
+ */
+void history_report(FILE *out, struct History *h, const struct Config *cfg) {
+  static const char *const actions[] = {"not quarantined", "skipped",
+                                        "launched last"};
+  int failing = 0;
+
+  for (size_t i = 0; i < h->count; i++) {
+    const struct HistoryEntry *e = &h->entries[i];
+    if (e->streak <= 0)
+      continue;
+    failing++;
+
+    char when[32] = "";
+    struct tm tm;
+    if (localtime_r(&e->time, &tm))
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+
+    char status[64];
+    if (e->status < 0)
+      snprintf(status, sizeof(status), "killed by signal %d (%s)", -e->status,
+               strsignal(-e->status));
+    else
+      snprintf(status, sizeof(status), "exited with status %d", e->status);
+
+    if (history_retry_due(h, cfg, e->id))
+      fprintf(out, "%s: quarantined, tried again at the next login: ",
+              e->id);
+    else if (history_quarantined(h, cfg, e->id))
+      fprintf(out, "%s: quarantined (%s): ", e->id,
+              actions[cfg->quarantine]);
+    else
+      fprintf(out, "%s: failing (%d of %d): ", e->id, e->streak,
+              cfg->quarantine_after);
+    fprintf(out,
+            "failed %d start%s in a row, last %s after %ldms on %s\n",
+            e->streak, e->streak == 1 ? "" : "s", status, e->runtime_ms,
+            when);
+  }
+
+  if (!failing)
+    fprintf(out, "No applications failed at startup.\n");
+
+  if (cfg->restore == RESTORE_OFF)
+    return;
+  for (size_t i = 0; i < h->count; i++)
+    if (h->entries[i].alive == 0)
+      fprintf(out,
+              "%s: closed before the last session ended, %s unless marked "
+              "always:1\n",
+              h->entries[i].id,
+              cfg->restore == RESTORE_DEFER ? "launched last"
+                                            : "not launched until started "
+                                              "by hand");
+}
+
+/**
+ * Records the cold start counters of the applications that had them
+ * @param h History
+ * @param children Tracked children, counters read
+ */
+void history_perf(struct History *h, const struct ChildList *children) {
+  for (size_t i = 0; i < children->count; i++) {
+    const struct Child *c = &children->items[i];
+    struct HistoryEntry *e;
+    if (*c->id && c->perf.value[PSTAT_TASK_CLOCK] >= 0 &&
+        (e = history_get(h, c->id)))
+      memcpy(e->perf, c->perf.value, sizeof(c->perf.value));
+  }
+}
+
+static int compare_major_faults(const void *a, const void *b) {
+  const struct HistoryEntry *x = *(const struct HistoryEntry *const *)a;
+  const struct HistoryEntry *y = *(const struct HistoryEntry *const *)b;
+  long long fx = x->perf[PSTAT_MAJOR_FAULTS], fy = y->perf[PSTAT_MAJOR_FAULTS];
+  return (fy > fx) - (fy < fx);
+}
+
+/**
+ * Prints the cold start counters of the last start of each application,
+ * the ones that read most from disk first
+ * @param out Output stream
+ * @param h History
+ */
+void history_perf_report(FILE *out, struct History *h) {
+  const struct HistoryEntry **sorted =
+      malloc((h->count + 1) * sizeof(*sorted));
+  if (!sorted) {
+    perror("malloc");
+    exit(1);
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < h->count; i++)
+    if (h->entries[i].perf[PSTAT_TASK_CLOCK] >= 0)
+      sorted[count++] = &h->entries[i];
+  qsort(sorted, count, sizeof(*sorted), compare_major_faults);
+
+  if (count > 0)
+    fprintf(out, "\nCold start counters (perf_window):\n"
+                 "  %-32s %8s %9s %7s %8s %5s\n",
+            "Application", "CPU ms", "faults", "major", "switches", "IPC");
+  for (size_t i = 0; i < count; i++) {
+    const long long *v = sorted[i]->perf;
+    char ipc[16] = "-", switches[24] = "-";
+    if (v[PSTAT_CSWITCHES] >= 0)
+      snprintf(switches, sizeof(switches), "%lld", v[PSTAT_CSWITCHES]);
+    if (v[PSTAT_CYCLES] > 0 && v[PSTAT_INSTRUCTIONS] >= 0)
+      snprintf(ipc, sizeof(ipc), "%.2f",
+               (double)v[PSTAT_INSTRUCTIONS] / v[PSTAT_CYCLES]);
+    fprintf(out, "  %-32s %8lld %9lld %7lld %8s %5s%s\n", sorted[i]->id,
+            v[PSTAT_TASK_CLOCK], v[PSTAT_FAULTS], v[PSTAT_MAJOR_FAULTS],
+            switches, ipc,
+            v[PSTAT_MAJOR_FAULTS] >= PSTAT_IO_BOUND_FAULTS
+                ? "  I/O bound, worth prefetching"
+                : "");
+  }
+  free(sorted);
+}
@@ -0,0 +1,175 @@
+/**
+ * ksm.c
+ *
+ * Kernel same-page merging for ksm:1 applications. The spawn path sets
+ * PR_SET_MEMORY_MERGE in the child, which makes all of its anonymous
+ * memory mergeable and is inherited by everything it forks, so ksmd
+ * can fold the identical pages of similar applications (Electron and
+ * Chromium based ones). This file checks the kernel side and reports
+ * the pages merged per application.
+ */
+
+#define _GNU_SOURCE
+#include "ksm.h"
+#include "util.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef PR_GET_MEMORY_MERGE
+#define PR_GET_MEMORY_MERGE 68
+#endif
+
+/* Merged pages of one application, i.e. of one session */
+struct KsmSession {
+  pid_t sid;
+  long pages;
+  int processes;
+};
+
+/**
+ * @return Value of a KSM sysfs counter, -1 if it can't be read
+ */
+static long ksm_counter(const char *name) {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", KSM_SYSFS, name);
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+  long value = -1;
+  if (fscanf(f, "%ld", &value) != 1)
+    value = -1;
+  fclose(f);
+  return value;
+}
+
+/**
+ * Checks whether ksm:1 can have an effect
+ * @param why Receives the reason when it can't
+ * @param size Size of why
+ * @return 1 if usable, 0 if ksmd is not running, -1 if the kernel lacks
+ *         PR_SET_MEMORY_MERGE
+ */
+int ksm_probe(char *why, size_t size) {
+  *why = '\0';
+  if (prctl(PR_GET_MEMORY_MERGE, 0, 0, 0, 0) < 0) {
+    snprintf(why, size, "kernel without PR_SET_MEMORY_MERGE (Linux 6.4+)");
+    return -1;
+  }
+
+  long run = ksm_counter("run");
+  if (run != 1) {
+    snprintf(why, size, "ksmd not running (%s/run is %ld)", KSM_SYSFS, run);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * @return Pages of a process merged by KSM, 0 if none or unknown
+ */
+static long merging_pages(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/ksm_merging_pages", (int)pid);
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+  long pages = 0;
+  if (fscanf(f, "%ld", &pages) != 1)
+    pages = 0;
+  fclose(f);
+  return pages;
+}
+
+static int compare_pages(const void *a, const void *b) {
+  const struct KsmSession *x = a, *y = b;
+  return (y->pages > x->pages) - (y->pages < x->pages);
+}
+
+/**
+ * Prints the host-wide KSM savings and the pages merged in each of the
+ * user's sessions, largest first
+ * @param out Output stream
+ */
+void ksm_report(FILE *out) {
+  char why[128];
+  long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+  fprintf(out, "\nMemory merging (KSM):\n");
+  if (ksm_probe(why, sizeof(why)) <= 0)
+    fprintf(out, "  Not effective: %s\n", why);
+
+  long sharing = ksm_counter("pages_sharing");
+  if (sharing >= 0)
+    fprintf(out, "  Host: %ld pages shared by %ld mappings, %ld kB saved\n",
+            ksm_counter("pages_shared"), sharing, sharing * page_kb);
+
+  DIR *dir = opendir("/proc");
+  if (!dir)
+    return;
+
+  int proc_fd = dirfd(dir);
+  uid_t uid = geteuid();
+  struct KsmSession *sessions = NULL;
+  size_t count = 0, capacity = 0;
+  struct dirent *d;
+
+  while ((d = readdir(dir)) != NULL) {
+    if (!isdigit((unsigned char)d->d_name[0]))
+      continue;
+
+    struct stat st;
+    if (fstatat(proc_fd, d->d_name, &st, 0) != 0 || st.st_uid != uid)
+      continue;
+
+    pid_t pid = atoi(d->d_name), sid;
+    long pages = merging_pages(pid);
+    if (pages <= 0 || proc_stat(pid, &sid, NULL) != 0)
+      continue;
+
+    size_t i = 0;
+    while (i < count && sessions[i].sid != sid)
+      i++;
+    if (i == count) {
+      if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        struct KsmSession *tmp = realloc(sessions, capacity * sizeof(*tmp));
+        if (!tmp) {
+          perror("realloc");
+          exit(1);
+        }
+        sessions = tmp;
+      }
+      sessions[count++] = (struct KsmSession){sid, 0, 0};
+    }
+    sessions[i].pages += pages;
+    sessions[i].processes++;
+  }
+  closedir(dir);
+
+  qsort(sessions, count, sizeof(*sessions), compare_pages);
+  for (size_t i = 0; i < count; i++) {
+    char path[64], comm[64] = "?";
+    snprintf(path, sizeof(path), "/proc/%d/comm", (int)sessions[i].sid);
+    FILE *f = fopen(path, "r");
+    if (f) {
+      if (fgets(comm, sizeof(comm), f))
+        comm[strcspn(comm, "\n")] = '\0';
+      fclose(f);
+    }
+    fprintf(out, "  %-24s session %-7d %ld pages merged (%ld kB) in %d "
+                 "process%s\n",
+            comm, (int)sessions[i].sid, sessions[i].pages,
+            sessions[i].pages * page_kb, sessions[i].processes,
+            sessions[i].processes == 1 ? "" : "es");
+  }
+  if (count == 0)
+    fprintf(out, "  No merged pages in this user's processes.\n");
+  free(sessions);
+}
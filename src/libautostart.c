@@ -0,0 +1,253 @@
+#include "libautostart.h"
+#include "autostart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct as_context {
+  struct Session s;
+  struct as_entry *entries;
+  size_t entries_capacity;
+  int planned;
+
+  as_event_fn fn;
+  void *userdata;
+};
+
+/**
+ * Fills a compact entry pointing into a desktop entry
+ * @param de Desktop entry
+ * @param out Compact entry
+ */
+static void to_entry(const struct DesktopEntry *de, struct as_entry *out) {
+  out->name = de->name;
+  out->exec = de->exec;
+  out->tryexec = de->tryexec;
+  out->icon = de->icon;
+  out->path = de->path;
+  out->flags = (de->terminal ? AS_ENTRY_TERMINAL : 0) |
+               (de->hidden ? AS_ENTRY_HIDDEN : 0) |
+               (de->nodisplay ? AS_ENTRY_NODISPLAY : 0) |
+               (de->dbus_activatable ? AS_ENTRY_DBUS : 0);
+  out->start_ms = -1;
+}
+
+static void notify(as_context *ctx, enum as_event event,
+                   const struct DesktopEntry *de, pid_t pid) {
+  if (!ctx->fn)
+    return;
+
+  struct as_entry entry;
+  to_entry(de, &entry);
+
+  const struct AppQueue *queue = &ctx->s.queue;
+  if (ctx->planned && de >= queue->apps && de < queue->apps + queue->count)
+    entry.start_ms = ctx->entries[de - queue->apps].start_ms;
+
+  ctx->fn(ctx->userdata, event, &entry, pid);
+}
+
+/**
+ * Session event hook, forwards launch results to the user callback
+ */
+static void on_session_event(void *userdata, enum SessionEvent event,
+                             const struct DesktopEntry *de, pid_t pid) {
+  as_context *ctx = userdata;
+
+  if (event == EVENT_LAUNCHED)
+    notify(ctx, AS_EVENT_LAUNCHED, de, pid);
+  else if (event == EVENT_FAILED)
+    notify(ctx, AS_EVENT_FAILED, de, pid);
+}
+
+/**
+ * @return API version the library was built with
+ */
+int as_api_version(void) { return AS_API_VERSION; }
+
+/**
+ * Creates an independent context with the default configuration
+ * @return New context, NULL if it can't be allocated or set up
+ */
+as_context *as_new(void) {
+  as_context *ctx = calloc(1, sizeof(*ctx));
+  if (!ctx)
+    return NULL;
+
+  if (session_init(&ctx->s, NULL) != 0) {
+    free(ctx);
+    return NULL;
+  }
+  ctx->s.on_event = on_session_event;
+  ctx->s.userdata = ctx;
+  return ctx;
+}
+
+/**
+ * Releases a context and every entry returned from it
+ * @param ctx Context (may be NULL)
+ */
+void as_free(as_context *ctx) {
+  if (!ctx)
+    return;
+
+  session_free(&ctx->s);
+  free(ctx->entries);
+  free(ctx);
+}
+
+/**
+ * Loads an autostart config file into the context
+ * @param ctx Context
+ * @param path Config file
+ * @return 0 on success, -1 if the file can't be read
+ */
+int as_load_config(as_context *ctx, const char *path) {
+  ctx->planned = 0;
+  return config_load(&ctx->s.cfg, path);
+}
+
+/**
+ * Parses every application entry of a directory, unfiltered
+ * @param ctx Context
+ * @param dir Autostart directory
+ * @return Number of entries added, -1 if the directory can't be opened
+ *         or is blocked by the [dirs] policy
+ */
+int as_scan(as_context *ctx, const char *dir) {
+  ctx->planned = 0;
+  if (config_dir_blocked(&ctx->s.cfg, dir))
+    return -1;
+  return parse_autostart_dir(dir, &ctx->s.queue);
+}
+
+/**
+ * Parses the user's and the system autostart directories, unfiltered
+ * @param ctx Context
+ * @param home User home directory
+ * @return Number of entries added
+ */
+int as_scan_default(as_context *ctx, const char *home) {
+  char dir[MAX_PATH];
+  int total = 0;
+
+  snprintf(dir, sizeof(dir), "%s/.config/autostart", home);
+  int n = as_scan(ctx, dir);
+  if (n > 0)
+    total += n;
+
+  for (int i = 0; system_autostart_dirs[i]; i++) {
+    n = as_scan(ctx, system_autostart_dirs[i]);
+    if (n > 0)
+      total += n;
+  }
+
+  return total;
+}
+
+/**
+ * Drops entries that are hidden, disallowed by config, whose TryExec
+ * is missing or that already run. AS_EVENT_SKIPPED is reported for
+ * each of them.
+ * @param ctx Context
+ * @return Number of remaining entries
+ */
+int as_filter(as_context *ctx) {
+  struct AppQueue *queue = &ctx->s.queue;
+  size_t kept = 0;
+
+  ctx->planned = 0;
+  for (size_t i = 0; i < queue->count; i++) {
+    if (entry_skip_reason(&ctx->s, &queue->apps[i]) == SKIP_NONE) {
+      if (kept != i)
+        queue->apps[kept] = queue->apps[i];
+      kept++;
+    } else {
+      notify(ctx, AS_EVENT_SKIPPED, &queue->apps[i], 0);
+    }
+  }
+
+  queue->count = kept;
+  return kept;
+}
+
+/**
+ * Computes the start offset of every entry from the configured delays
+ * @param ctx Context
+ * @return Offset of the last start (total launch time) in ms, -1 on
+ *         allocation failure
+ */
+long as_plan(as_context *ctx) {
+  if (!as_entries(ctx, NULL) && ctx->s.queue.count)
+    return -1;
+
+  long offset = 0;
+  for (size_t i = 0; i < ctx->s.queue.count; i++) {
+    struct AppRule *rule = entry_rule(&ctx->s.cfg, &ctx->s.queue.apps[i]);
+    offset += config_app_delay(&ctx->s.cfg, rule, i == 0);
+    ctx->entries[i].start_ms = offset;
+  }
+
+  ctx->planned = 1;
+  return offset;
+}
+
+/**
+ * Returns the current entries of the context. The array stays valid
+ * until the next call that modifies the context.
+ * @param ctx Context
+ * @param count Receives the number of entries (may be NULL)
+ * @return Entry array
+ */
+const struct as_entry *as_entries(as_context *ctx, size_t *count) {
+  struct AppQueue *queue = &ctx->s.queue;
+
+  if (ctx->entries_capacity < queue->count) {
+    struct as_entry *tmp =
+        realloc(ctx->entries, queue->capacity * sizeof(*tmp));
+    if (!tmp) {
+      if (count)
+        *count = 0;
+      return NULL;
+    }
+    ctx->entries = tmp;
+    ctx->entries_capacity = queue->capacity;
+  }
+
+  for (size_t i = 0; i < queue->count; i++) {
+    long start_ms = ctx->planned ? ctx->entries[i].start_ms : -1;
+    to_entry(&queue->apps[i], &ctx->entries[i]);
+    ctx->entries[i].start_ms = start_ms;
+  }
+
+  if (count)
+    *count = queue->count;
+  return ctx->entries;
+}
+
+/**
+ * Sets the callback receiving skip and launch events. Skip events come
+ * from as_filter(), so set it before.
+ * @param ctx Context
+ * @param fn Callback (NULL to disable)
+ * @param userdata Passed to the callback
+ */
+void as_set_callback(as_context *ctx, as_event_fn fn, void *userdata) {
+  ctx->fn = fn;
+  ctx->userdata = userdata;
+}
+
+/**
+ * Launches the entries with the configured staggered delays. Blocks
+ * until the last entry is started and, with critical rules, until their
+ * startup boost is released.
+ * @param ctx Context
+ * @return Number of successfully started entries
+ */
+int as_launch(as_context *ctx) {
+  if (!ctx->planned)
+    as_plan(ctx);
+  int launched = launch_queued_apps(&ctx->s);
+  boost_finish(&ctx->s);
+  return launched;
+}
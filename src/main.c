@@ -0,0 +1,156 @@
+/**
+ * main.c
+ *
+ * Command line front end of the autostart launcher
+ */
+
+#include "audit.h"
+#include "autostart.h"
+#include "daemon.h"
+#include "simulate.h"
+#include "spawner.h"
+#include "supervise.h"
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [--supervise] [CONFIG]\n"
+          "       %s --stop\n"
+          "       %s --report [CONFIG]\n"
+          "       %s --simulate [--cpus N] [--mem-mb N] [CONFIG]\n"
+          "       %s --connect [--socket PATH] [CONFIG]\n"
+          "       %s --daemon [--socket PATH] [--max-sessions N] "
+          "[--group GROUP]\n"
+          "       %s --generate DIR [CONFIG]\n"
+          "       %s --audit [--jobs N] ROOT... [CONFIG]\n",
+          prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv) {
+  const char *config_path = NULL;
+  const char *socket_path = DAEMON_SOCKET;
+  const char *generate_dir = NULL;
+  const char *socket_group = NULL;
+  int daemon_mode = 0;
+  int connect_mode = 0;
+  int max_sessions = 0;
+  int supervise = 0;
+  int report = 0;
+  int simulate = 0;
+  int audit = 0;
+  int jobs = 0;
+  // Positional arguments, then the homes (or directories of homes) to
+  // audit among them
+  const char **roots = calloc(argc, sizeof(*roots));
+  size_t root_count = 0;
+  if (!roots) {
+    perror("calloc");
+    exit(1);
+  }
+  struct SimHost host;
+  sim_host_detect(&host);
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--daemon")) {
+      daemon_mode = 1;
+    } else if (!strcmp(argv[i], "--supervise")) {
+      supervise = 1;
+    } else if (!strcmp(argv[i], "--stop")) {
+      return supervise_stop() != 0;
+    } else if (!strcmp(argv[i], "--report")) {
+      report = 1;
+    } else if (!strcmp(argv[i], "--simulate")) {
+      simulate = 1;
+    } else if (!strcmp(argv[i], "--cpus") && i + 1 < argc) {
+      host.cpus = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--mem-mb") && i + 1 < argc) {
+      host.mem_kb = atol(argv[++i]) * 1024;
+    } else if (!strcmp(argv[i], "--connect")) {
+      connect_mode = 1;
+    } else if (!strcmp(argv[i], "--generate") && i + 1 < argc) {
+      generate_dir = argv[++i];
+    } else if (!strcmp(argv[i], "--audit")) {
+      audit = 1;
+    } else if (!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--socket") && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (!strcmp(argv[i], "--max-sessions") && i + 1 < argc) {
+      max_sessions = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--group") && i + 1 < argc) {
+      socket_group = argv[++i];
+    } else if (argv[i][0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      roots[root_count++] = argv[i]; // sorted out once --audit is known
+    }
+  }
+
+  // With --audit the directories are ROOTs and a file is CONFIG; a ROOT
+  // that does not exist is an error, not a config to fall back from
+  size_t args = root_count;
+  root_count = 0;
+  for (size_t i = 0; i < args; i++) {
+    struct stat st;
+    if (!audit) {
+      config_path = roots[i];
+    } else if (stat(roots[i], &st) != 0) {
+      perror(roots[i]);
+      free(roots);
+      return 1;
+    } else if (S_ISDIR(st.st_mode)) {
+      roots[root_count++] = roots[i];
+    } else {
+      config_path = roots[i];
+    }
+  }
+
+  if (daemon_mode)
+    return daemon_run(socket_path, max_sessions, socket_group);
+
+  // Only a launch spawns applications. The spawner is forked before the
+  // connection to the daemon, so that it holds no copy of it
+  int launch = !audit && !report && !simulate && !generate_dir;
+  if (launch && spawner_start() != 0)
+    perror("spawner");
+
+  // The daemon only admits the session, the launch stays local
+  int admission = -1;
+  if (connect_mode) {
+    admission = daemon_connect(socket_path);
+    if (admission < 0)
+      fprintf(stderr, "Daemon not available, launching without it\n");
+  }
+
+  // Get home directory
+  const char *home = getenv("HOME");
+  if (!home) {
+    struct passwd *pw = getpwuid(getuid());
+    home = pw->pw_dir;
+  }
+
+  int ret = 0;
+  if (audit && root_count == 0) {
+    usage(argv[0]);
+    ret = 1;
+  } else if (audit)
+    ret = audit_run(stdout, roots, root_count, config_path, jobs) != 0;
+  else if (report)
+    ret = report_session(home, config_path) != 0;
+  else if (simulate)
+    ret = simulate_session(home, config_path, &host) != 0;
+  else if (generate_dir)
+    ret = generate_session(home, config_path, generate_dir) < 0;
+  else
+    ret = run_session(home, config_path, admission, supervise) < 0;
+  spawner_stop();
+  free(roots);
+
+  return ret;
+}
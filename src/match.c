@@ -0,0 +1,695 @@
+/**
+ * match.c
+ *
+ * Matches a string against many glob and anchored regex patterns at
+ * once. Every pattern is compiled into one shared Thompson NFA; a DFA
+ * is built lazily from it while matching, so each input byte costs one
+ * table lookup no matter how many patterns there are. The result is the
+ * lowest rule number among the patterns matching the whole string.
+ *
+ * Regex syntax: literals, ., [..] / [^..] classes with ranges, \ escapes,
+ * ( ), |, *, +, ?. Patterns always match the whole string, a leading ^
+ * and a trailing $ are accepted and ignored.
+ * Glob syntax: *, ?, [..] / [!..] classes, \ escapes.
+ */
+
+#include "match.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum NodeType {
+  NODE_SET,
+  NODE_EMPTY, // matches the empty string only
+  NODE_CAT,
+  NODE_ALT,
+  NODE_STAR,
+  NODE_PLUS,
+  NODE_QUEST,
+};
+
+struct Node {
+  enum NodeType type;
+  int left, right;
+  uint32_t set[8];
+};
+
+enum NfaType { NFA_SET, NFA_SPLIT, NFA_MATCH };
+
+struct NfaState {
+  enum NfaType type;
+  int out, out1;
+  int rule;
+  uint32_t set[8];
+};
+
+struct DfaState {
+  int *states; // sorted NFA SET/MATCH states
+  int n;
+  int accept; // lowest matching rule, -1 if none
+  unsigned hash;
+  int next[256]; // -1 until computed
+};
+
+struct Matcher {
+  struct NfaState *nfa;
+  int nfa_count, nfa_cap;
+  int *starts;
+  int start_count, start_cap;
+
+  struct DfaState **dfa;
+  int dfa_count;
+  int *table; // open addressing hash of DFA states, size table_size
+  int table_size;
+  int dfa_start;
+
+  // scratch of matcher_add(), kept for the next pattern
+  struct Node *nodes;
+  int node_cap;
+  char *copy;
+  size_t copy_cap;
+
+  // scratch for closures
+  int *stack;
+  unsigned *mark; // == gen when visited by the current closure
+  unsigned gen;
+  int scratch_cap;
+};
+
+struct Parser {
+  const char *p;
+  struct Node *nodes;
+  int count, cap;
+  int error;
+};
+
+/* ---------------------------------------------------------------- AST */
+
+static void set_add(uint32_t *set, unsigned char c) {
+  set[c >> 5] |= 1u << (c & 31);
+}
+
+static int set_has(const uint32_t *set, unsigned char c) {
+  return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+static int node_new(struct Parser *ps, enum NodeType type, int left,
+                    int right) {
+  if (ps->count == ps->cap) {
+    int cap = ps->cap ? ps->cap * 2 : 16;
+    struct Node *tmp = realloc(ps->nodes, cap * sizeof(*tmp));
+    if (!tmp) {
+      ps->error = 1;
+      return -1;
+    }
+    ps->nodes = tmp;
+    ps->cap = cap;
+  }
+
+  struct Node *n = &ps->nodes[ps->count];
+  memset(n, 0, sizeof(*n));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  return ps->count++;
+}
+
+static int node_set(struct Parser *ps, const uint32_t *set) {
+  int n = node_new(ps, NODE_SET, -1, -1);
+  if (n >= 0)
+    memcpy(ps->nodes[n].set, set, sizeof(ps->nodes[n].set));
+  return n;
+}
+
+static int node_char(struct Parser *ps, unsigned char c) {
+  uint32_t set[8] = {0};
+  set_add(set, c);
+  return node_set(ps, set);
+}
+
+static int node_any(struct Parser *ps) {
+  uint32_t set[8];
+  memset(set, 0xff, sizeof(set));
+  return node_set(ps, set);
+}
+
+static int node_cat(struct Parser *ps, int left, int right) {
+  if (left < 0)
+    return right;
+  return node_new(ps, NODE_CAT, left, right);
+}
+
+/**
+ * Parses a [...] class, ps->p points after '['
+ * @param negate_chars Characters that negate the class when first
+ */
+static int parse_class(struct Parser *ps, const char *negate_chars) {
+  uint32_t set[8] = {0};
+  int negate = 0;
+
+  if (*ps->p && strchr(negate_chars, *ps->p)) {
+    negate = 1;
+    ps->p++;
+  }
+
+  int first = 1;
+  while (*ps->p && (*ps->p != ']' || first)) {
+    unsigned char lo = *ps->p++;
+    if (lo == '\\' && *ps->p)
+      lo = *ps->p++;
+
+    unsigned char hi = lo;
+    if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+      ps->p++;
+      hi = *ps->p++;
+      if (hi == '\\' && *ps->p)
+        hi = *ps->p++;
+    }
+    for (unsigned c = lo; c <= hi; c++)
+      set_add(set, c);
+    first = 0;
+  }
+
+  if (*ps->p != ']') {
+    ps->error = 1;
+    return -1;
+  }
+  ps->p++;
+
+  if (negate)
+    for (int i = 0; i < 8; i++)
+      set[i] = ~set[i];
+  return node_set(ps, set);
+}
+
+static int parse_alt(struct Parser *ps);
+
+static int parse_atom(struct Parser *ps) {
+  char c = *ps->p++;
+
+  switch (c) {
+  case '(': {
+    int n = parse_alt(ps);
+    if (*ps->p != ')') {
+      ps->error = 1;
+      return -1;
+    }
+    ps->p++;
+    return n;
+  }
+  case '[':
+    return parse_class(ps, "^");
+  case '.':
+    return node_any(ps);
+  case '\\':
+    if (!*ps->p) {
+      ps->error = 1;
+      return -1;
+    }
+    return node_char(ps, *ps->p++);
+  case '*':
+  case '+':
+  case '?':
+  case '^':
+  case '$':
+    ps->error = 1;
+    return -1;
+  default:
+    return node_char(ps, c);
+  }
+}
+
+static int parse_repeat(struct Parser *ps) {
+  int n = parse_atom(ps);
+
+  while (!ps->error && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?')) {
+    char op = *ps->p++;
+    enum NodeType type = op == '*' ? NODE_STAR
+                         : op == '+' ? NODE_PLUS
+                                     : NODE_QUEST;
+    n = node_new(ps, type, n, -1);
+  }
+  return n;
+}
+
+static int parse_cat(struct Parser *ps) {
+  int n = -1;
+
+  while (!ps->error && *ps->p && *ps->p != '|' && *ps->p != ')')
+    n = node_cat(ps, n, parse_repeat(ps));
+
+  // Empty branch or group: matches the empty string
+  if (n < 0 && !ps->error)
+    n = node_new(ps, NODE_EMPTY, -1, -1);
+  return n;
+}
+
+static int parse_alt(struct Parser *ps) {
+  int n = parse_cat(ps);
+
+  while (!ps->error && *ps->p == '|') {
+    ps->p++;
+    n = node_new(ps, NODE_ALT, n, parse_cat(ps));
+  }
+  return n;
+}
+
+/**
+ * Parses a regex in place
+ * @param s Copy of the pattern, its explicit anchors are cut off
+ */
+static int parse_regex(struct Parser *ps, char *s) {
+  // Patterns are always anchored, accept explicit anchors
+  size_t len = strlen(s);
+  if (*s == '^')
+    s++, len--;
+  if (len > 0 && s[len - 1] == '$' && (len < 2 || s[len - 2] != '\\'))
+    s[--len] = '\0';
+
+  ps->p = s;
+  int n = parse_alt(ps);
+  if (*ps->p)
+    ps->error = 1;
+  return n;
+}
+
+static int parse_glob(struct Parser *ps, const char *pattern) {
+  int n = -1;
+  ps->p = pattern;
+
+  while (!ps->error && *ps->p) {
+    char c = *ps->p++;
+    if (c == '*')
+      n = node_cat(ps, n, node_new(ps, NODE_STAR, node_any(ps), -1));
+    else if (c == '?')
+      n = node_cat(ps, n, node_any(ps));
+    else if (c == '[')
+      n = node_cat(ps, n, parse_class(ps, "!^"));
+    else if (c == '\\' && *ps->p)
+      n = node_cat(ps, n, node_char(ps, *ps->p++));
+    else
+      n = node_cat(ps, n, node_char(ps, c));
+  }
+
+  if (n < 0 && !ps->error)
+    n = node_new(ps, NODE_EMPTY, -1, -1);
+  return n;
+}
+
+/* ---------------------------------------------------------------- NFA */
+
+static int nfa_new(struct Matcher *m, enum NfaType type, int out, int out1) {
+  if (m->nfa_count == m->nfa_cap) {
+    int cap = m->nfa_cap ? m->nfa_cap * 2 : 64;
+    struct NfaState *tmp = realloc(m->nfa, cap * sizeof(*tmp));
+    if (!tmp)
+      return -1;
+    m->nfa = tmp;
+    m->nfa_cap = cap;
+  }
+
+  struct NfaState *s = &m->nfa[m->nfa_count];
+  memset(s, 0, sizeof(*s));
+  s->type = type;
+  s->out = out;
+  s->out1 = out1;
+  s->rule = -1;
+  return m->nfa_count++;
+}
+
+/**
+ * Compiles an AST node so that it continues into state next
+ * @return Entry state of the node, -1 on allocation failure
+ */
+static int compile_node(struct Matcher *m, const struct Parser *ps, int node,
+                        int next) {
+  if (next < 0)
+    return -1;
+
+  const struct Node *n = &ps->nodes[node];
+  int s, body;
+
+  switch (n->type) {
+  case NODE_SET:
+    s = nfa_new(m, NFA_SET, next, -1);
+    if (s >= 0)
+      memcpy(m->nfa[s].set, n->set, sizeof(n->set));
+    return s;
+  case NODE_EMPTY:
+    return next;
+  case NODE_CAT:
+    return compile_node(m, ps, n->left, compile_node(m, ps, n->right, next));
+  case NODE_ALT:
+    s = compile_node(m, ps, n->left, next);
+    body = compile_node(m, ps, n->right, next);
+    return s < 0 || body < 0 ? -1 : nfa_new(m, NFA_SPLIT, s, body);
+  case NODE_QUEST:
+    body = compile_node(m, ps, n->left, next);
+    return body < 0 ? -1 : nfa_new(m, NFA_SPLIT, body, next);
+  case NODE_STAR:
+  case NODE_PLUS:
+    s = nfa_new(m, NFA_SPLIT, -1, next);
+    if (s < 0)
+      return -1;
+    body = compile_node(m, ps, n->left, s);
+    if (body < 0)
+      return -1;
+    m->nfa[s].out = body;
+    return n->type == NODE_STAR ? s : body;
+  }
+  return -1;
+}
+
+/* ---------------------------------------------------------------- DFA */
+
+/**
+ * Forgets the DFA states. The hash table only holds interned states, so
+ * it is cleared only when there are some: compiling many patterns in a
+ * row does not clear it once per pattern.
+ */
+static void dfa_flush(struct Matcher *m) {
+  if (m->dfa_count)
+    memset(m->table, 0xff, m->table_size * sizeof(int));
+  for (int i = 0; i < m->dfa_count; i++) {
+    free(m->dfa[i]->states);
+    free(m->dfa[i]);
+  }
+  m->dfa_count = 0;
+  m->dfa_start = -1;
+}
+
+static int scratch_reserve(struct Matcher *m) {
+  if (m->scratch_cap >= m->nfa_count)
+    return 0;
+
+  int *stack = realloc(m->stack, m->nfa_count * sizeof(int));
+  if (!stack)
+    return -1;
+  m->stack = stack;
+
+  unsigned *mark = realloc(m->mark, m->nfa_count * sizeof(unsigned));
+  if (!mark)
+    return -1;
+  m->mark = mark;
+  memset(m->mark, 0, m->nfa_count * sizeof(unsigned));
+  m->gen = 0;
+
+  m->scratch_cap = m->nfa_count;
+  return 0;
+}
+
+/**
+ * Starts building a new state set, forgetting earlier closure marks
+ */
+static void set_begin(struct Matcher *m) {
+  if (++m->gen == 0) {
+    memset(m->mark, 0, m->nfa_count * sizeof(unsigned));
+    m->gen = 1;
+  }
+}
+
+/**
+ * Adds the epsilon closure of state s to a set being built in list
+ * @return New list length
+ */
+static int closure(struct Matcher *m, int s, int *list, int n) {
+  int sp = 0;
+  m->stack[sp++] = s;
+
+  while (sp > 0) {
+    int cur = m->stack[--sp];
+    if (cur < 0 || m->mark[cur] == m->gen)
+      continue;
+    m->mark[cur] = m->gen;
+
+    if (m->nfa[cur].type == NFA_SPLIT) {
+      m->stack[sp++] = m->nfa[cur].out1;
+      m->stack[sp++] = m->nfa[cur].out;
+    } else {
+      list[n++] = cur;
+    }
+  }
+  return n;
+}
+
+static int compare_int(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static unsigned hash_states(const int *states, int n) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++) {
+    h ^= (unsigned)states[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**
+ * Interns a set of NFA states as a DFA state, sorting list
+ * @return DFA state index, -1 on allocation failure, -2 if the cache
+ *         is full
+ */
+static int dfa_intern(struct Matcher *m, int *list, int n) {
+  qsort(list, n, sizeof(int), compare_int);
+
+  unsigned h = hash_states(list, n);
+  unsigned mask = m->table_size - 1;
+
+  for (unsigned i = h & mask;; i = (i + 1) & mask) {
+    int d = m->table[i];
+    if (d < 0)
+      break;
+    struct DfaState *st = m->dfa[d];
+    if (st->hash == h && st->n == n &&
+        memcmp(st->states, list, n * sizeof(int)) == 0)
+      return d;
+  }
+
+  if (m->dfa_count >= MATCH_MAX_DFA)
+    return -2;
+
+  struct DfaState *st = malloc(sizeof(*st));
+  if (!st)
+    return -1;
+  st->states = malloc((n ? n : 1) * sizeof(int));
+  if (!st->states) {
+    free(st);
+    return -1;
+  }
+  memcpy(st->states, list, n * sizeof(int));
+  st->n = n;
+  st->hash = h;
+  st->accept = -1;
+  memset(st->next, 0xff, sizeof(st->next));
+
+  for (int i = 0; i < n; i++) {
+    const struct NfaState *ns = &m->nfa[list[i]];
+    if (ns->type == NFA_MATCH && (st->accept < 0 || ns->rule < st->accept))
+      st->accept = ns->rule;
+  }
+
+  int d = m->dfa_count++;
+  m->dfa[d] = st;
+  for (unsigned i = h & mask;; i = (i + 1) & mask) {
+    if (m->table[i] < 0) {
+      m->table[i] = d;
+      break;
+    }
+  }
+  return d;
+}
+
+static int dfa_start(struct Matcher *m, int *list) {
+  int n = 0;
+  set_begin(m);
+  for (int i = 0; i < m->start_count; i++)
+    n = closure(m, m->starts[i], list, n);
+
+  int d = dfa_intern(m, list, n);
+  if (d == -2) {
+    dfa_flush(m);
+    d = dfa_intern(m, list, n);
+  }
+  return d;
+}
+
+/**
+ * Computes the transition of DFA state d on byte c
+ * @param d In/out: current state, may be renumbered by a cache flush
+ * @return Next DFA state, -1 on allocation failure
+ */
+static int dfa_step(struct Matcher *m, int *d, unsigned char c, int *list) {
+  struct DfaState *st = m->dfa[*d];
+  int n = 0;
+
+  set_begin(m);
+  for (int i = 0; i < st->n; i++) {
+    const struct NfaState *ns = &m->nfa[st->states[i]];
+    if (ns->type == NFA_SET && set_has(ns->set, c))
+      n = closure(m, ns->out, list, n);
+  }
+
+  int next = dfa_intern(m, list, n);
+  if (next != -2) {
+    if (next >= 0)
+      m->dfa[*d]->next[c] = next;
+    return next;
+  }
+
+  // Cache full: keep the current and next sets, drop everything else
+  int *cur = malloc((st->n ? st->n : 1) * sizeof(int));
+  int *nxt = malloc((n ? n : 1) * sizeof(int));
+  if (!cur || !nxt) {
+    free(cur);
+    free(nxt);
+    return -1;
+  }
+  int cur_n = st->n;
+  memcpy(cur, st->states, cur_n * sizeof(int));
+  memcpy(nxt, list, n * sizeof(int));
+
+  dfa_flush(m);
+  *d = dfa_intern(m, cur, cur_n);
+  next = dfa_intern(m, nxt, n);
+  free(cur);
+  free(nxt);
+
+  if (*d >= 0 && next >= 0)
+    m->dfa[*d]->next[c] = next;
+  return next;
+}
+
+/* ---------------------------------------------------------------- API */
+
+/**
+ * @return Empty matcher, NULL on allocation failure
+ */
+struct Matcher *matcher_new(void) {
+  struct Matcher *m = calloc(1, sizeof(*m));
+  if (!m)
+    return NULL;
+
+  m->table_size = 2 * MATCH_MAX_DFA;
+  m->table = malloc(m->table_size * sizeof(int));
+  m->dfa = malloc(MATCH_MAX_DFA * sizeof(*m->dfa));
+  if (!m->table || !m->dfa) {
+    matcher_free(m);
+    return NULL;
+  }
+  memset(m->table, 0xff, m->table_size * sizeof(int));
+  m->dfa_start = -1;
+  return m;
+}
+
+void matcher_free(struct Matcher *m) {
+  if (!m)
+    return;
+  if (m->dfa)
+    dfa_flush(m);
+  free(m->dfa);
+  free(m->table);
+  free(m->nfa);
+  free(m->starts);
+  free(m->nodes);
+  free(m->copy);
+  free(m->stack);
+  free(m->mark);
+  free(m);
+}
+
+/**
+ * @return Number of patterns in the matcher
+ */
+int matcher_count(const struct Matcher *m) { return m ? m->start_count : 0; }
+
+/**
+ * Compiles a pattern into the matcher
+ * @param m Matcher
+ * @param pattern Glob or regex
+ * @param kind MATCH_GLOB or MATCH_REGEX
+ * @param rule Value returned by matcher_match() for this pattern; the
+ *        lowest one wins when several patterns match
+ * @return 0 on success, -1 on syntax or allocation error
+ */
+int matcher_add(struct Matcher *m, const char *pattern, enum MatchKind kind,
+                int rule) {
+  // The parser works in the scratch of the matcher, no allocation per
+  // pattern once it is large enough
+  struct Parser ps = {.nodes = m->nodes, .cap = m->node_cap};
+  int root;
+  if (kind == MATCH_GLOB) {
+    root = parse_glob(&ps, pattern);
+  } else {
+    size_t size = strlen(pattern) + 1;
+    if (size > m->copy_cap) {
+      char *tmp = realloc(m->copy, size);
+      if (!tmp)
+        return -1;
+      m->copy = tmp;
+      m->copy_cap = size;
+    }
+    memcpy(m->copy, pattern, size);
+    root = parse_regex(&ps, m->copy);
+  }
+  m->nodes = ps.nodes;
+  m->node_cap = ps.cap;
+  if (ps.error || root < 0)
+    return -1;
+
+  int match = nfa_new(m, NFA_MATCH, -1, -1);
+  if (match >= 0)
+    m->nfa[match].rule = rule;
+  int start = compile_node(m, &ps, root, match);
+  if (start < 0)
+    return -1;
+
+  if (m->start_count == m->start_cap) {
+    int cap = m->start_cap ? m->start_cap * 2 : 16;
+    int *tmp = realloc(m->starts, cap * sizeof(int));
+    if (!tmp)
+      return -1;
+    m->starts = tmp;
+    m->start_cap = cap;
+  }
+  m->starts[m->start_count++] = start;
+
+  // New NFA states invalidate every cached DFA state
+  dfa_flush(m);
+  return 0;
+}
+
+/**
+ * Matches a whole string against every pattern at once
+ * @param m Matcher
+ * @param s String
+ * @return Lowest rule of the matching patterns, -1 if none matches
+ */
+int matcher_match(struct Matcher *m, const char *s) {
+  if (!m || m->start_count == 0 || scratch_reserve(m) != 0)
+    return -1;
+
+  int *list = malloc(m->nfa_count * sizeof(int));
+  if (!list)
+    return -1;
+
+  if (m->dfa_start < 0)
+    m->dfa_start = dfa_start(m, list);
+
+  int d = m->dfa_start;
+  for (const unsigned char *p = (const unsigned char *)s; *p && d >= 0; p++) {
+    if (m->dfa[d]->n == 0)
+      break;
+    int next = m->dfa[d]->next[*p];
+    if (next < 0)
+      next = dfa_step(m, &d, *p, list);
+    d = next;
+  }
+
+  free(list);
+  if (d < 0 || m->dfa[d]->n == 0)
+    return -1;
+  return m->dfa[d]->accept;
+}
@@ -0,0 +1,112 @@
+/**
+ * perfstat.c
+ *
+ * Cold start counters. With perf_window set, a launched application
+ * stops itself right before exec; the launcher attaches counting
+ * perf_event_open() events to it and lets it continue, so the counts
+ * start at exec. The events are inherited, so threads and processes
+ * the application starts later are counted too. Kernel side counts need
+ * kernel.perf_event_paranoid 1 or root; at 2, the default, only user
+ * space is counted and context switches, which happen in the kernel,
+ * stay unknown. Major faults show which applications wait for the disk
+ * at startup, and are worth prefetching.
+ */
+
+#define _GNU_SOURCE
+#include "perfstat.h"
+#include "syscalls.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} events[PSTAT_EVENTS] = {
+    [PSTAT_TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    [PSTAT_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    [PSTAT_MAJOR_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ},
+    [PSTAT_CSWITCHES] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    [PSTAT_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PSTAT_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+};
+
+void perfstat_init(struct PerfStat *p) {
+  for (int i = 0; i < PSTAT_EVENTS; i++) {
+    p->fd[i] = -1;
+    p->value[i] = -1;
+  }
+  p->until_ms = 0;
+}
+
+/**
+ * Starts counting a process that is stopped or about to exec
+ * @param p Counters, initialized
+ * @param pid Process
+ * @param until_ms End of the window, CLOCK_MONOTONIC
+ * @return Number of events counted, -1 if not even task-clock can be
+ *         (errno: EACCES with perf_event_paranoid 3, ENOSYS)
+ */
+int perfstat_attach(struct PerfStat *p, pid_t pid, long until_ms) {
+  int opened = 0;
+
+  for (int i = 0; i < PSTAT_EVENTS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+
+    p->fd[i] = sys_perf_event_open(&attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (p->fd[i] < 0 && (errno == EACCES || errno == EPERM) &&
+        i != PSTAT_CSWITCHES) {
+      attr.exclude_kernel = 1;
+      p->fd[i] =
+          sys_perf_event_open(&attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    if (p->fd[i] < 0 && i == PSTAT_TASK_CLOCK)
+      return -1;
+    opened += p->fd[i] >= 0;
+  }
+
+  p->until_ms = until_ms;
+  return opened;
+}
+
+/**
+ * Reads the counters and stops counting. Counts of events that had to
+ * share the PMU are scaled to the whole window.
+ */
+void perfstat_read(struct PerfStat *p) {
+  for (int i = 0; i < PSTAT_EVENTS; i++) {
+    uint64_t v[3]; // value, time enabled, time running
+    if (p->fd[i] < 0 || read(p->fd[i], v, sizeof(v)) != sizeof(v))
+      continue;
+
+    if (v[2] == 0)
+      continue; // never scheduled on the PMU
+    if (v[2] < v[1])
+      v[0] = (uint64_t)((double)v[0] * v[1] / v[2]);
+    p->value[i] = i == PSTAT_TASK_CLOCK ? (long long)(v[0] / 1000000)
+                                        : (long long)v[0];
+  }
+  perfstat_close(p);
+}
+
+/**
+ * Stops counting without reading
+ */
+void perfstat_close(struct PerfStat *p) {
+  for (int i = 0; i < PSTAT_EVENTS; i++) {
+    if (p->fd[i] >= 0)
+      close(p->fd[i]);
+    p->fd[i] = -1;
+  }
+  p->until_ms = 0;
+}
@@ -0,0 +1,375 @@
+#include "prefetch.h"
+#include "util.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_PATH 2048
+#define MAX_THEMES 8
+#define CACHE_NONE 0xffffffffu
+
+struct IconCache {
+  const unsigned char *data;
+  size_t size;
+};
+
+/**
+ * Asks the kernel to read a whole file into the page cache in background.
+ * posix_fadvise() only queues the readahead, so issuing it for many files
+ * in a row lets the block layer service them in parallel.
+ * @param path File to prefetch
+ * @return 1 if readahead was queued, 0 otherwise
+ */
+static int prefetch_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+
+  int ret = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0;
+  close(fd);
+  return ret;
+}
+
+/**
+ * Prefetches every regular file of a directory (not recursive)
+ * @param path Directory to walk
+ * @return Number of files queued for readahead
+ */
+static int prefetch_dir(const char *path) {
+  DIR *dir = opendir(path);
+  if (!dir)
+    return 0;
+
+  struct dirent *entry;
+  int count = 0;
+  char full_path[MAX_PATH];
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+    snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+    count += prefetch_file(full_path);
+  }
+
+  closedir(dir);
+  return count;
+}
+
+// Offsets come from the file, so the checks must not wrap around
+static uint16_t cache_u16(const struct IconCache *c, uint32_t off) {
+  if (c->size < 2 || off > c->size - 2)
+    return 0;
+  return (uint16_t)(c->data[off] << 8 | c->data[off + 1]);
+}
+
+static uint32_t cache_u32(const struct IconCache *c, uint32_t off) {
+  if (c->size < 4 || off > c->size - 4)
+    return CACHE_NONE;
+  return (uint32_t)c->data[off] << 24 | (uint32_t)c->data[off + 1] << 16 |
+         (uint32_t)c->data[off + 2] << 8 | (uint32_t)c->data[off + 3];
+}
+
+static const char *cache_str(const struct IconCache *c, uint32_t off) {
+  if (off >= c->size || !memchr(c->data + off, '\0', c->size - off))
+    return NULL;
+  return (const char *)c->data + off;
+}
+
+/**
+ * Same hash as GTK's icon_name_hash(), used to index icon-theme.cache
+ * @param name Icon name
+ * @return Hash value
+ */
+static uint32_t icon_name_hash(const char *name) {
+  const signed char *p = (const signed char *)name;
+  uint32_t h = (uint32_t)*p;
+
+  if (h)
+    for (p += 1; *p; p++)
+      h = (h << 5) - h + (uint32_t)*p;
+  return h;
+}
+
+/**
+ * Looks an icon up in a mapped icon-theme.cache and prefetches every
+ * image file the cache lists for it.
+ * @param c Mapped cache
+ * @param theme_dir Theme directory the cache belongs to
+ * @param icon Icon name without extension
+ * @return Number of files queued for readahead, -1 if not in cache
+ */
+static int cache_prefetch_icon(const struct IconCache *c, const char *theme_dir,
+                               const char *icon) {
+  static const struct {
+    int flag;
+    const char *ext;
+  } suffixes[] = {{ICON_CACHE_HAS_PNG, ".png"},
+                  {ICON_CACHE_HAS_SVG, ".svg"},
+                  {ICON_CACHE_HAS_XPM, ".xpm"}};
+
+  if (cache_u16(c, 0) != 1)
+    return -1;
+
+  uint32_t hash_off = cache_u32(c, 4);
+  uint32_t dirs_off = cache_u32(c, 8);
+  uint32_t n_buckets = cache_u32(c, hash_off);
+  if (n_buckets == 0 || n_buckets == CACHE_NONE)
+    return -1;
+
+  uint32_t n_dirs = cache_u32(c, dirs_off);
+  uint32_t bucket = icon_name_hash(icon) % n_buckets;
+  uint32_t chain = cache_u32(c, hash_off + 4 + 4 * bucket);
+
+  // Each entry takes 12 bytes, a longer chain is corrupt or cyclic
+  size_t max_entries = c->size / 12;
+  size_t walked = 0;
+  while (chain != CACHE_NONE && walked++ < max_entries) {
+    const char *name = cache_str(c, cache_u32(c, chain + 4));
+    if (name && strcmp(name, icon) == 0)
+      break;
+    chain = cache_u32(c, chain);
+  }
+  if (chain == CACHE_NONE || walked > max_entries)
+    return -1;
+
+  uint32_t list = cache_u32(c, chain + 8);
+  uint32_t n_images = cache_u32(c, list);
+  if (n_images == CACHE_NONE || n_images > (c->size - list) / 8)
+    return -1;
+
+  int count = 0;
+  char full_path[MAX_PATH];
+
+  for (uint32_t i = 0; i < n_images; i++) {
+    uint32_t image = list + 4 + 8 * i;
+    uint16_t dir_index = cache_u16(c, image);
+    uint16_t flags = cache_u16(c, image + 2);
+    if (dir_index >= n_dirs)
+      continue;
+
+    const char *dir = cache_str(c, cache_u32(c, dirs_off + 4 + 4 * dir_index));
+    if (!dir)
+      continue;
+
+    for (size_t s = 0; s < sizeof(suffixes) / sizeof(suffixes[0]); s++) {
+      if (!(flags & suffixes[s].flag))
+        continue;
+      if (snprintf(full_path, sizeof(full_path), "%s/%s/%s%s", theme_dir, dir,
+                   icon, suffixes[s].ext) >= (int)sizeof(full_path))
+        continue;
+      count += prefetch_file(full_path);
+    }
+  }
+
+  return count;
+}
+
+/**
+ * Maps <theme_dir>/icon-theme.cache and prefetches the icon through it
+ * @param theme_dir Theme directory
+ * @param icon Icon name
+ * @return Number of files queued, -1 if no cache or icon not found
+ */
+static int prefetch_from_theme_dir(const char *theme_dir, const char *icon) {
+  char cache_path[MAX_PATH];
+  if (snprintf(cache_path, sizeof(cache_path), "%s/icon-theme.cache",
+               theme_dir) >= (int)sizeof(cache_path))
+    return -1;
+
+  int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 12) {
+    close(fd);
+    return -1;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  struct IconCache cache = {.data = map, .size = st.st_size};
+  int count = cache_prefetch_icon(&cache, theme_dir, icon);
+
+  munmap(map, st.st_size);
+  return count;
+}
+
+/**
+ * Fills the list of icon base directories in lookup order
+ * @param bases Output array of paths
+ * @param max Capacity of the output array
+ * @return Number of base directories
+ */
+static int icon_base_dirs(char bases[][MAX_PATH], int max) {
+  int n = 0;
+  const char *home = getenv("HOME");
+  const char *data_home = getenv("XDG_DATA_HOME");
+  const char *data_dirs = getenv("XDG_DATA_DIRS");
+
+  if (home && n < max)
+    snprintf(bases[n++], MAX_PATH, "%s/.icons", home);
+  if (data_home && *data_home && n < max)
+    snprintf(bases[n++], MAX_PATH, "%s/icons", data_home);
+  else if (home && n < max)
+    snprintf(bases[n++], MAX_PATH, "%s/.local/share/icons", home);
+
+  if (!data_dirs || !*data_dirs)
+    data_dirs = "/usr/local/share:/usr/share";
+
+  const char *p = data_dirs;
+  while (*p && n < max) {
+    size_t len = strcspn(p, ":");
+    if (len > 0)
+      snprintf(bases[n++], MAX_PATH, "%.*s/icons", (int)len, p);
+    p += len;
+    if (*p == ':')
+      p++;
+  }
+
+  return n;
+}
+
+/**
+ * Reads the Inherits= key of a theme's index.theme
+ * @param bases Icon base directories
+ * @param n_bases Number of base directories
+ * @param theme Theme name
+ * @param out Buffer for the comma separated parent list
+ * @param size Size of out
+ * @return 1 if found, 0 otherwise
+ */
+static int theme_inherits(char bases[][MAX_PATH], int n_bases,
+                          const char *theme, char *out, size_t size) {
+  char path[MAX_PATH];
+  char line[1024];
+
+  for (int i = 0; i < n_bases; i++) {
+    if (snprintf(path, sizeof(path), "%s/%s/index.theme", bases[i], theme) >=
+        (int)sizeof(path))
+      continue;
+    FILE *f = fopen(path, "r");
+    if (!f)
+      continue;
+
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+      char *s = trim(line);
+      if (strncmp(s, "Inherits", 8) != 0)
+        continue;
+      char *v = strchr(s, '=');
+      if (!v)
+        continue;
+      snprintf(out, size, "%s", trim(v + 1));
+      found = 1;
+    }
+
+    fclose(f);
+    if (found)
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Resolves an Icon= value through the icon theme lookup rules and queues
+ * readahead for the matching image files. Absolute paths are prefetched
+ * as is, names are looked up via icon-theme.cache of the theme, its
+ * parents and hicolor, then /usr/share/pixmaps.
+ * @param theme Icon theme name (NULL or empty for hicolor)
+ * @param icon Icon key value of a desktop entry
+ * @return Number of files queued for readahead
+ */
+int prefetch_icon(const char *theme, const char *icon) {
+  if (!icon || !*icon)
+    return 0;
+
+  if (icon[0] == '/')
+    return prefetch_file(icon);
+
+  char bases[16][MAX_PATH];
+  int n_bases = icon_base_dirs(bases, 16);
+
+  char themes[MAX_THEMES][256];
+  int n_themes = 0;
+  snprintf(themes[n_themes++], sizeof(themes[0]), "%s",
+           theme && *theme ? theme : "hicolor");
+
+  // Walk the inheritance chain breadth first, hicolor always last
+  for (int t = 0; t < n_themes && n_themes < MAX_THEMES - 1; t++) {
+    char inherits[1024];
+    if (!theme_inherits(bases, n_bases, themes[t], inherits, sizeof(inherits)))
+      continue;
+
+    for (char *tok = strtok(inherits, ","); tok && n_themes < MAX_THEMES - 1;
+         tok = strtok(NULL, ",")) {
+      char *name = trim(tok);
+      int seen = strcmp(name, "hicolor") == 0;
+      for (int k = 0; k < n_themes && !seen; k++)
+        seen = strcmp(themes[k], name) == 0;
+      if (!seen && *name)
+        snprintf(themes[n_themes++], sizeof(themes[0]), "%s", name);
+    }
+  }
+  if (strcmp(themes[0], "hicolor") != 0)
+    snprintf(themes[n_themes++], sizeof(themes[0]), "hicolor");
+
+  char theme_dir[MAX_PATH];
+  for (int t = 0; t < n_themes; t++) {
+    int count = 0;
+    for (int b = 0; b < n_bases; b++) {
+      if (snprintf(theme_dir, sizeof(theme_dir), "%s/%s", bases[b],
+                   themes[t]) >= (int)sizeof(theme_dir))
+        continue;
+      int n = prefetch_from_theme_dir(theme_dir, icon);
+      if (n > 0)
+        count += n;
+    }
+    if (count > 0)
+      return count;
+  }
+
+  static const char *pixmap_exts[] = {".png", ".svg", ".xpm"};
+  char full_path[MAX_PATH];
+  for (size_t i = 0; i < sizeof(pixmap_exts) / sizeof(pixmap_exts[0]); i++) {
+    snprintf(full_path, sizeof(full_path), "/usr/share/pixmaps/%s%s", icon,
+             pixmap_exts[i]);
+    if (prefetch_file(full_path))
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Prefetches shared caches that every GUI toolkit reads on startup:
+ * fontconfig caches and the shared MIME database.
+ * @param home User home directory
+ * @return Number of files queued for readahead
+ */
+int prefetch_gui_caches(const char *home) {
+  char path[MAX_PATH];
+  int count = 0;
+
+  const char *cache_home = getenv("XDG_CACHE_HOME");
+  if (cache_home && *cache_home)
+    snprintf(path, sizeof(path), "%s/fontconfig", cache_home);
+  else
+    snprintf(path, sizeof(path), "%s/.cache/fontconfig", home);
+
+  count += prefetch_dir(path);
+  count += prefetch_dir("/var/cache/fontconfig");
+  count += prefetch_file("/usr/share/mime/mime.cache");
+
+  return count;
+}
@@ -0,0 +1,222 @@
+/**
+ * reactor.c
+ *
+ * Single-threaded event core of the launcher. Launch deadlines are
+ * absolute timerfd deadlines, stop signals arrive through a signalfd,
+ * child exits through pidfds and requests through sockets, all on one
+ * epoll set, so nothing waits in a sleep the launcher can't wake from.
+ *
+ * Sources may be removed from inside handlers, including sources whose
+ * events are still pending in the current batch; they are freed once
+ * the batch is dispatched.
+ */
+
+#define _GNU_SOURCE
+#include "reactor.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define REACTOR_BATCH 32
+
+/**
+ * Creates the epoll set
+ * @return 0 on success, -1 on failure
+ */
+int reactor_init(struct Reactor *r) {
+  memset(r, 0, sizeof(*r));
+  r->epfd = epoll_create1(EPOLL_CLOEXEC);
+  return r->epfd < 0 ? -1 : 0;
+}
+
+/**
+ * Removes every source and closes the epoll set
+ */
+void reactor_free(struct Reactor *r) {
+  while (r->sources) {
+    struct ReactorSource *src = r->sources;
+    r->sources = src->next;
+    if (src->owned && src->fd >= 0)
+      close(src->fd);
+    free(src);
+  }
+  if (r->epfd >= 0)
+    close(r->epfd);
+  r->epfd = -1;
+}
+
+static struct ReactorSource *add_source(struct Reactor *r,
+                                        enum ReactorKind kind, int fd,
+                                        int owned, reactor_fn fn,
+                                        void *data) {
+  struct ReactorSource *src = calloc(1, sizeof(*src));
+  if (!src) {
+    perror("calloc");
+    exit(1);
+  }
+  src->reactor = r;
+  src->kind = kind;
+  src->fd = fd;
+  src->owned = owned;
+  src->fn = fn;
+  src->data = data;
+
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = src};
+  if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    if (owned)
+      close(fd);
+    free(src);
+    return NULL;
+  }
+
+  src->next = r->sources;
+  r->sources = src;
+  return src;
+}
+
+/**
+ * Watches a file descriptor for input
+ * @param r Reactor
+ * @param fd Descriptor
+ * @param owned Close fd when the source is removed
+ * @param fn Handler, called with the epoll events
+ * @param data Handler data
+ * @return Source, NULL on failure
+ */
+struct ReactorSource *reactor_add(struct Reactor *r, int fd, int owned,
+                                  reactor_fn fn, void *data) {
+  return add_source(r, REACTOR_FD, fd, owned, fn, data);
+}
+
+/**
+ * Creates a disarmed timer, see reactor_timer_set()
+ * @return Source, NULL on failure
+ */
+struct ReactorSource *reactor_timer(struct Reactor *r, reactor_fn fn,
+                                    void *data) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  return add_source(r, REACTOR_TIMER, fd, 1, fn, data);
+}
+
+/**
+ * Arms a timer for an absolute deadline. Deadlines in the past fire
+ * right away, so a late launch never shifts the ones after it.
+ * @param src Timer source
+ * @param deadline_ms CLOCK_MONOTONIC time in ms, 0 disarms
+ * @return 0 on success, -1 on failure
+ */
+int reactor_timer_set(struct ReactorSource *src, long deadline_ms) {
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (deadline_ms > 0) {
+    its.it_value.tv_sec = deadline_ms / 1000;
+    its.it_value.tv_nsec = (deadline_ms % 1000) * 1000000L;
+  }
+  return timerfd_settime(src->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * Receives signals of a mask, which must already be blocked
+ * @return Source, NULL on failure
+ */
+struct ReactorSource *reactor_signals(struct Reactor *r, const sigset_t *mask,
+                                      reactor_fn fn, void *data) {
+  int fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  return add_source(r, REACTOR_SIGNAL, fd, 1, fn, data);
+}
+
+/**
+ * Stops watching a source, closing its fd if owned
+ */
+void reactor_remove(struct ReactorSource *src) {
+  struct Reactor *r = src->reactor;
+
+  if (src->fd >= 0) {
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    if (src->owned)
+      close(src->fd);
+    src->fd = -1;
+  }
+
+  // Events of this batch may still point at the source
+  if (r->dispatching) {
+    src->dead = 1;
+    return;
+  }
+
+  for (struct ReactorSource **p = &r->sources; *p; p = &(*p)->next) {
+    if (*p == src) {
+      *p = src->next;
+      break;
+    }
+  }
+  free(src);
+}
+
+/**
+ * Waits for one batch of events and dispatches it
+ * @param r Reactor
+ * @param timeout_ms Longest wait, -1 for no limit
+ * @return Number of events, -1 on failure
+ */
+int reactor_poll(struct Reactor *r, int timeout_ms) {
+  struct epoll_event events[REACTOR_BATCH];
+  int n = epoll_wait(r->epfd, events, REACTOR_BATCH, timeout_ms);
+  if (n < 0)
+    return errno == EINTR ? 0 : -1;
+
+  r->dispatching = 1;
+  for (int i = 0; i < n; i++) {
+    struct ReactorSource *src = events[i].data.ptr;
+    if (src->dead)
+      continue;
+
+    uint32_t value = events[i].events;
+    if (src->kind == REACTOR_TIMER) {
+      uint64_t expirations;
+      if (read(src->fd, &expirations, sizeof(expirations)) !=
+          (ssize_t)sizeof(expirations))
+        continue;
+      value = (uint32_t)expirations;
+    } else if (src->kind == REACTOR_SIGNAL) {
+      struct signalfd_siginfo si;
+      if (read(src->fd, &si, sizeof(si)) != (ssize_t)sizeof(si))
+        continue;
+      value = si.ssi_signo;
+    }
+    src->fn(src, value);
+  }
+  r->dispatching = 0;
+
+  for (struct ReactorSource **p = &r->sources; *p;) {
+    struct ReactorSource *src = *p;
+    if (src->dead) {
+      *p = src->next;
+      free(src);
+    } else {
+      p = &src->next;
+    }
+  }
+  return n;
+}
+
+/**
+ * Dispatches events until a handler sets r->stop
+ * @return 0 when stopped, -1 on failure
+ */
+int reactor_run(struct Reactor *r) {
+  r->stop = 0;
+  while (!r->stop)
+    if (reactor_poll(r, -1) < 0)
+      return -1;
+  return 0;
+}
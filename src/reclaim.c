@@ -0,0 +1,407 @@
+/**
+ * reclaim.c
+ *
+ * Proactive reclaim of idle applications. Applications are session
+ * leaders, so an application is everything in its session: its idle
+ * time is the CPU time of the session.
+ *
+ * When the launcher runs in a cgroup delegated to the user (a systemd
+ * user service with Delegate=yes), it moves itself into a leaf of it
+ * and starts every background application in a leaf of its own. An idle
+ * application is then reclaimed by writing to its memory.reclaim, a
+ * bounded chunk per supervisor tick, which needs no privileges.
+ *
+ * Elsewhere every mapping of every process of the session is passed to
+ * process_madvise(MADV_PAGEOUT) through a pidfd, batched by IOV_MAX,
+ * which the kernel only allows with CAP_SYS_NICE. Clean file pages are
+ * dropped and anonymous pages go to swap either way.
+ */
+
+#define _GNU_SOURCE
+#include "reclaim.h"
+#include "syscalls.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define RECLAIM_BATCH 1024 // UIO_MAXIOV
+
+/**
+ * Collects the address ranges of a process worth paging out
+ * @param pid Process
+ * @param count Receives the number of ranges
+ * @return Ranges, NULL if the process is gone
+ */
+static struct iovec *read_ranges(pid_t pid, size_t *count) {
+  char path[64], line[512];
+  snprintf(path, sizeof(path), "/proc/%d/maps", (int)pid);
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return NULL;
+
+  struct iovec *ranges = NULL;
+  size_t n = 0, capacity = 0;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long start, end;
+    char perms[8];
+    int name = 0;
+    if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %n", &start, &end, perms,
+               &name) < 3)
+      continue;
+    // Kernel provided pages ([vdso], [vvar], [vsyscall]) can't be paged
+    // out, and neither can mappings without access
+    if (line[name] == '[' && strncmp(line + name, "[heap]", 6) != 0 &&
+        strncmp(line + name, "[stack]", 7) != 0)
+      continue;
+    if (!strncmp(perms, "---", 3))
+      continue;
+
+    if (n == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      struct iovec *tmp = realloc(ranges, capacity * sizeof(*tmp));
+      if (!tmp) {
+        perror("realloc");
+        exit(1);
+      }
+      ranges = tmp;
+    }
+    ranges[n].iov_base = (void *)start;
+    ranges[n].iov_len = end - start;
+    n++;
+  }
+
+  fclose(f);
+  *count = n;
+  return ranges;
+}
+
+/**
+ * Pages out the memory of a process
+ * @param pidfd pidfd of the process
+ * @param pid The same process, for /proc
+ * @return Bytes advised, -1 on error (EPERM without CAP_SYS_NICE)
+ */
+static long reclaim_process(int pidfd, pid_t pid) {
+  size_t n = 0;
+  struct iovec *ranges = read_ranges(pid, &n);
+  if (!ranges) {
+    errno = ESRCH;
+    return -1;
+  }
+
+  long advised = 0;
+  int err = 0;
+  for (size_t i = 0; i < n;) {
+    size_t batch = n - i < RECLAIM_BATCH ? n - i : RECLAIM_BATCH;
+    ssize_t r = sys_process_madvise(pidfd, ranges + i, batch, MADV_PAGEOUT);
+    if (r < 0) {
+      // Nothing will work on this process
+      if (errno == EPERM || errno == ENOSYS || errno == ESRCH) {
+        err = errno;
+        break;
+      }
+      i++; // locked or special mapping
+      continue;
+    }
+
+    // The call stops at the first range it can't advise, skip that one
+    advised += r;
+    size_t done = r, end = i + batch;
+    while (i < end && done >= ranges[i].iov_len) {
+      done -= ranges[i].iov_len;
+      i++;
+    }
+    if (i < end)
+      i++;
+  }
+
+  free(ranges);
+  if (err && advised == 0) {
+    errno = err;
+    return -1;
+  }
+  return advised;
+}
+
+/**
+ * @return Resident set of a process in kB, -1 if it is gone
+ */
+static long proc_rss_kb(pid_t pid) {
+  char path[64], line[128];
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+
+  long rss = -1;
+  while (fgets(line, sizeof(line), f))
+    if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+      break;
+  fclose(f);
+  return rss;
+}
+
+static int add_cpu(pid_t pid, size_t session, void *data) {
+  long *cpu_ms = data, cpu;
+  if (proc_stat(pid, NULL, &cpu) == 0)
+    cpu_ms[session] += cpu;
+  return 0;
+}
+
+/**
+ * Sums the CPU time of every process in each of the sessions, with one
+ * walk over /proc
+ * @param sessions Session ids, i.e. pids of the launched applications
+ * @param count Number of sessions
+ * @param cpu_ms Receives the CPU time of each session in ms
+ */
+void session_cpu_ms(const pid_t *sessions, size_t count, long *cpu_ms) {
+  memset(cpu_ms, 0, count * sizeof(*cpu_ms));
+  proc_session_walk(sessions, count, add_cpu, cpu_ms);
+}
+
+static int reclaim_member(pid_t pid, size_t session, void *data) {
+  (void)session;
+  long *freed = data;
+  int pidfd = sys_pidfd_open(pid, 0);
+  if (pidfd < 0)
+    return errno == ENOSYS ? -1 : 0;
+
+  long before = proc_rss_kb(pid);
+  long advised = reclaim_process(pidfd, pid);
+  int err = errno;
+  long after = proc_rss_kb(pid);
+  close(pidfd);
+
+  if (advised < 0 && (err == EPERM || err == ENOSYS)) {
+    errno = err;
+    return -1;
+  }
+  if (before >= 0 && after >= 0 && before > after)
+    *freed += before - after;
+  return 0;
+}
+
+/**
+ * Pages out every process of a session
+ * @param session Session id, i.e. pid of the launched application
+ * @return Resident memory freed in kB, -1 if reclaim is not permitted
+ */
+long reclaim_session(pid_t session) {
+  long freed = 0;
+  if (proc_session_walk(&session, 1, reclaim_member, &freed) != 0)
+    return -1;
+  return freed;
+}
+
+/**
+ * Writes a string to a cgroup control file
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int write_file(const char *path, const char *str) {
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  int ret = write_all(fd, str, strlen(str));
+  int err = errno;
+  close(fd);
+  errno = err;
+  return ret;
+}
+
+/**
+ * Reads a number from a cgroup control file
+ * @return Value, -1 on error
+ */
+static long long read_number(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+  long long value;
+  if (fscanf(f, "%lld", &value) != 1)
+    value = -1;
+  fclose(f);
+  return value;
+}
+
+/**
+ * @return 1 if pid is the launcher or one of its children (the spawner)
+ */
+static int own_process(pid_t pid) {
+  char path[64], line[512];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  if (pid == getpid())
+    return 1;
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+  char *end = fgets(line, sizeof(line), f) ? strrchr(line, ')') : NULL;
+  fclose(f);
+
+  int ppid;
+  return end && sscanf(end + 1, " %*c %d", &ppid) == 1 && ppid == getpid();
+}
+
+/**
+ * Prepares memory.reclaim based reclaim: when the launcher's cgroup is
+ * delegated to the user and holds only the launcher and its spawner,
+ * they move into its RECLAIM_LAUNCHER_CGROUP leaf and the memory
+ * controller is enabled for the leaves of the applications
+ * @param base Receives the delegated cgroup directory, "" on failure
+ * @param size Size of base
+ * @return 0 on success, -1 if the cgroup is not delegated or usable
+ */
+int reclaim_cgroup_setup(char *base, size_t size) {
+  char line[PATH_MAX], path[PATH_MAX + 64];
+  base[0] = '\0';
+
+  // cgroup v2 only: "0::/user.slice/.../app.slice/autostart.service"
+  FILE *f = fopen("/proc/self/cgroup", "r");
+  if (!f)
+    return -1;
+  int found = 0;
+  while (!found && fgets(line, sizeof(line), f))
+    found = !strncmp(line, "0::/", 4);
+  fclose(f);
+  if (!found)
+    return -1;
+  line[strcspn(line, "\n")] = '\0';
+
+  // A launcher started again finds itself in its own leaf
+  char *leaf = strrchr(line + 3, '/');
+  if (!strcmp(leaf + 1, RECLAIM_LAUNCHER_CGROUP))
+    *leaf = '\0';
+  if (snprintf(base, size, "/sys/fs/cgroup%s", line + 3) >= (int)size) {
+    base[0] = '\0';
+    return -1;
+  }
+
+  snprintf(path, sizeof(path), "%s/cgroup.controllers", base);
+  f = fopen(path, "r");
+  found = 0;
+  if (f) {
+    char word[64];
+    while (!found && fscanf(f, "%63s", word) == 1)
+      found = !strcmp(word, "memory");
+    fclose(f);
+  }
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", base);
+  if (!found || access(path, W_OK) != 0)
+    goto fail;
+
+  // Other processes in the cgroup mean it is not ours to rearrange
+  snprintf(path, sizeof(path), "%s/cgroup.procs", base);
+  f = fopen(path, "r");
+  if (!f)
+    goto fail;
+  pid_t pids[16];
+  size_t count = 0;
+  int pid, foreign = 0;
+  while (fscanf(f, "%d", &pid) == 1) {
+    if (count == sizeof(pids) / sizeof(*pids) || !own_process(pid))
+      foreign = 1;
+    else
+      pids[count++] = pid;
+  }
+  fclose(f);
+  if (foreign)
+    goto fail;
+
+  snprintf(path, sizeof(path), "%s/%s", base, RECLAIM_LAUNCHER_CGROUP);
+  if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    goto fail;
+  snprintf(path, sizeof(path), "%s/%s/cgroup.procs", base,
+           RECLAIM_LAUNCHER_CGROUP);
+  for (size_t i = 0; i < count; i++) {
+    char num[16];
+    snprintf(num, sizeof(num), "%d", (int)pids[i]);
+    if (write_file(path, num) != 0)
+      goto fail;
+  }
+
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", base);
+  if (write_file(path, "+memory") != 0)
+    goto fail;
+  return 0;
+
+fail:
+  base[0] = '\0';
+  return -1;
+}
+
+/**
+ * Moves the calling process into a new leaf of the delegated cgroup,
+ * named after its pid. Runs in the child before exec, so that
+ * everything the application allocates is charged to its leaf.
+ * @param base Delegated cgroup directory
+ * @return 0 on success, -1 on error (errno set)
+ */
+int reclaim_cgroup_enter(const char *base) {
+  char path[PATH_MAX + 64];
+  snprintf(path, sizeof(path), "%s/app-%d", base, (int)getpid());
+  if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    return -1;
+  snprintf(path, sizeof(path), "%s/app-%d/cgroup.procs", base, (int)getpid());
+  return write_file(path, "0");
+}
+
+/**
+ * Reclaims at most RECLAIM_CHUNK_KB of an application's leaf, so that a
+ * large application does not stall the supervisor
+ * @param base Delegated cgroup directory
+ * @param app Pid of the application, which names its leaf
+ * @param left_kb Memory still to reclaim, -1 before the first step
+ * @param freed_kb Incremented by the memory freed
+ * @return 1 if there is more to reclaim, 0 when done, -1 on error
+ */
+int reclaim_cgroup_step(const char *base, pid_t app, long *left_kb,
+                        long *freed_kb) {
+  char path[PATH_MAX + 64];
+  snprintf(path, sizeof(path), "%s/app-%d/memory.current", base, (int)app);
+  long long before = read_number(path);
+  if (before < 0)
+    return -1;
+
+  // Everything it uses at the start, refaults don't prolong the work
+  if (*left_kb < 0)
+    *left_kb = before / 1024;
+  long chunk = *left_kb < RECLAIM_CHUNK_KB ? *left_kb : RECLAIM_CHUNK_KB;
+  if (chunk <= 0)
+    return 0;
+
+  char amount[32];
+  snprintf(amount, sizeof(amount), "%ldK", chunk);
+  snprintf(path, sizeof(path), "%s/app-%d/memory.reclaim", base, (int)app);
+  int ret = write_file(path, amount);
+  // EAGAIN: less than the chunk could be reclaimed, nothing more to get
+  if (ret != 0 && errno != EAGAIN)
+    return -1;
+
+  snprintf(path, sizeof(path), "%s/app-%d/memory.current", base, (int)app);
+  long long after = read_number(path);
+  if (after >= 0 && after < before)
+    *freed_kb += (before - after) / 1024;
+  *left_kb -= chunk;
+  return ret == 0 && *left_kb > 0;
+}
+
+/**
+ * Removes the leaf of an application once it is empty
+ * @param base Delegated cgroup directory
+ * @param app Pid of the application
+ */
+void reclaim_cgroup_remove(const char *base, pid_t app) {
+  char path[PATH_MAX + 64];
+  snprintf(path, sizeof(path), "%s/app-%d", base, (int)app);
+  rmdir(path);
+}
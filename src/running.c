@@ -0,0 +1,427 @@
+/**
+ * running.c
+ *
+ * Detects autostart entries that are already running, e.g. when the
+ * launcher is started again after a window manager restart. /proc is
+ * walked once per session and the executables of the processes of the
+ * user's login session (and absolute script paths run by interpreters)
+ * are hashed by inode, so each queued entry costs one stat() and one
+ * lookup. Other sessions of the same user, e.g. a second seat or an ssh
+ * login, do not count.
+ */
+
+#define _GNU_SOURCE
+#include "running.h"
+#include "util.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Audit session id of processes outside any login session */
+#define SESSION_NONE 4294967295u
+
+/* Programs whose inode says nothing about what they run */
+static const char *const interpreters[] = {
+    "sh",   "bash", "dash", "zsh", "fish", "env",     "perl",
+    "ruby", "node", "java", "lua", "gjs",  "flatpak", NULL};
+
+static int is_interpreter(const char *prog) {
+  const char *base = strrchr(prog, '/');
+  base = base ? base + 1 : prog;
+
+  for (int i = 0; interpreters[i]; i++)
+    if (!strcmp(base, interpreters[i]))
+      return 1;
+  return !strncmp(base, "python", 6);
+}
+
+static size_t key_hash(const struct ProcKey *key) {
+  uint64_t h = (uint64_t)key->ino * 0x9e3779b97f4a7c15ull ^ (uint64_t)key->dev;
+  return (size_t)(h ^ (h >> 29));
+}
+
+static int key_insert(struct ProcIndex *idx, const struct ProcKey *key) {
+  if ((idx->count + 1) * 2 > idx->size) {
+    size_t size = idx->size ? idx->size * 2 : 256;
+    struct ProcKey *keys = calloc(size, sizeof(*keys));
+    if (!keys)
+      return -1;
+
+    for (size_t i = 0; i < idx->size; i++) {
+      if (!idx->keys[i].ino)
+        continue;
+      size_t j = key_hash(&idx->keys[i]) & (size - 1);
+      while (keys[j].ino)
+        j = (j + 1) & (size - 1);
+      keys[j] = idx->keys[i];
+    }
+    free(idx->keys);
+    idx->keys = keys;
+    idx->size = size;
+  }
+
+  size_t i = key_hash(key) & (idx->size - 1);
+  while (idx->keys[i].ino) {
+    if (idx->keys[i].ino == key->ino && idx->keys[i].dev == key->dev)
+      return 0;
+    i = (i + 1) & (idx->size - 1);
+  }
+  idx->keys[i] = *key;
+  idx->count++;
+  return 0;
+}
+
+/**
+ * @return 1 if a process runs the executable (or script) key
+ */
+int proc_index_has(const struct ProcIndex *idx, const struct ProcKey *key) {
+  if (!idx->size)
+    return 0;
+
+  size_t i = key_hash(key) & (idx->size - 1);
+  while (idx->keys[i].ino) {
+    if (idx->keys[i].ino == key->ino && idx->keys[i].dev == key->dev)
+      return 1;
+    i = (i + 1) & (idx->size - 1);
+  }
+  return 0;
+}
+
+/**
+ * Indexes the absolute path in argv[1] of an interpreter process, which
+ * is the script it runs (python3 /opt/app.py). Other programs take files
+ * as arguments too (less /home/u/notes.txt), those don't count.
+ */
+static void index_script(struct ProcIndex *idx, int proc_fd, const char *pid) {
+  char path[64], cmdline[4096];
+  if (snprintf(path, sizeof(path), "%s/exe", pid) >= (int)sizeof(path))
+    return;
+  ssize_t n = readlinkat(proc_fd, path, cmdline, sizeof(cmdline) - 1);
+  if (n <= 0)
+    return;
+  cmdline[n] = '\0';
+  if (!is_interpreter(cmdline))
+    return;
+
+  if (snprintf(path, sizeof(path), "%s/cmdline", pid) >= (int)sizeof(path))
+    return;
+
+  int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  n = read(fd, cmdline, sizeof(cmdline) - 1);
+  close(fd);
+  if (n <= 0)
+    return;
+  cmdline[n] = '\0';
+
+  size_t arg0 = strlen(cmdline);
+  if ((ssize_t)arg0 + 1 >= n || cmdline[arg0 + 1] != '/')
+    return;
+
+  struct stat st;
+  if (stat(cmdline + arg0 + 1, &st) == 0 && S_ISREG(st.st_mode)) {
+    struct ProcKey key = {st.st_dev, st.st_ino};
+    key_insert(idx, &key);
+  }
+}
+
+/**
+ * Reads the audit login session id of a process, which logind also uses
+ * as the session id (XDG_SESSION_ID)
+ * @param proc_fd /proc directory
+ * @param pid Process directory name, or "self"
+ * @return Session id, SESSION_NONE if the process has none
+ */
+static unsigned login_session(int proc_fd, const char *pid) {
+  char path[64], buf[16];
+  if (snprintf(path, sizeof(path), "%s/sessionid", pid) >= (int)sizeof(path))
+    return SESSION_NONE;
+
+  int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return SESSION_NONE;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return SESSION_NONE;
+  buf[n] = '\0';
+  return (unsigned)strtoul(buf, NULL, 10);
+}
+
+/**
+ * Walks /proc once and indexes the executables of the processes of the
+ * user's login session, or of all the user's processes when the launcher
+ * runs outside a login session
+ * @param idx Index to fill
+ * @return 0 on success, -1 if /proc can't be read
+ */
+int proc_index_build(struct ProcIndex *idx) {
+  memset(idx, 0, sizeof(*idx));
+
+  DIR *dir = opendir("/proc");
+  if (!dir)
+    return -1;
+
+  int proc_fd = dirfd(dir);
+  uid_t uid = geteuid();
+  pid_t self = getpid();
+  unsigned session = login_session(proc_fd, "self");
+  struct dirent *d;
+
+  while ((d = readdir(dir)) != NULL) {
+    if (!isdigit((unsigned char)d->d_name[0]) || atoi(d->d_name) == self)
+      continue;
+
+    struct stat st;
+    if (fstatat(proc_fd, d->d_name, &st, 0) != 0 || st.st_uid != uid)
+      continue;
+    if (session != SESSION_NONE &&
+        login_session(proc_fd, d->d_name) != session)
+      continue;
+
+    char exe[64];
+    if (snprintf(exe, sizeof(exe), "%s/exe", d->d_name) >= (int)sizeof(exe))
+      continue;
+    // Kernel threads and zombies have no executable
+    if (fstatat(proc_fd, exe, &st, 0) != 0)
+      continue;
+
+    struct ProcKey key = {st.st_dev, st.st_ino};
+    if (key_insert(idx, &key) != 0) {
+      perror("malloc");
+      exit(1);
+    }
+    index_script(idx, proc_fd, d->d_name);
+  }
+
+  closedir(dir);
+  return 0;
+}
+
+void proc_index_free(struct ProcIndex *idx) {
+  free(idx->keys);
+  memset(idx, 0, sizeof(*idx));
+}
+
+/* Socket inodes open in the processes of a session */
+struct SocketInodes {
+  unsigned long inode[64];
+  size_t count;
+};
+
+static int collect_sockets(pid_t pid, size_t session, void *data) {
+  (void)session;
+  struct SocketInodes *sockets = data;
+  char path[64], link[64];
+
+  snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+  DIR *dir = opendir(path);
+  if (!dir)
+    return 0;
+
+  struct dirent *d;
+  while ((d = readdir(dir)) != NULL && sockets->count < 64) {
+    ssize_t n = readlinkat(dirfd(dir), d->d_name, link, sizeof(link) - 1);
+    if (n <= 0)
+      continue;
+    link[n] = '\0';
+    if (sscanf(link, "socket:[%lu]", &sockets->inode[sockets->count]) == 1)
+      sockets->count++;
+  }
+  closedir(dir);
+  return 0;
+}
+
+/**
+ * Checks whether a process of a session listens on a Unix socket, which
+ * is how servers such as foot --server or urxvtd tell that clients can
+ * connect. The session covers a server started through sh -c.
+ * @param session Session id, i.e. pid of the launched server
+ * @return 1 if listening, 0 otherwise
+ */
+int proc_listening(pid_t session) {
+  struct SocketInodes sockets = {.count = 0};
+  proc_session_walk(&session, 1, collect_sockets, &sockets);
+  if (sockets.count == 0)
+    return 0;
+
+  FILE *f = fopen("/proc/net/unix", "r");
+  if (!f)
+    return 0;
+
+  // Num RefCount Protocol Flags Type St Inode Path
+  char line[512];
+  int listening = 0;
+  while (!listening && fgets(line, sizeof(line), f)) {
+    unsigned long flags, inode;
+    if (sscanf(line, "%*s %*s %*s %lx %*s %*s %lu", &flags, &inode) != 2 ||
+        !(flags & 0x10000)) // __SO_ACCEPTCON
+      continue;
+    for (size_t i = 0; i < sockets.count && !listening; i++)
+      listening = sockets.inode[i] == inode;
+  }
+  fclose(f);
+  return listening;
+}
+
+/**
+ * Copies the next word of an Exec line, honouring quotes
+ * @return 1 if a word was found, 0 at the end
+ */
+static int next_word(const char **p, char *buf, size_t size) {
+  while (isspace((unsigned char)**p))
+    (*p)++;
+  if (!**p)
+    return 0;
+
+  size_t n = 0;
+  char quote = 0;
+  for (; **p && (quote || !isspace((unsigned char)**p)); (*p)++) {
+    if (!quote && (**p == '"' || **p == '\'')) {
+      quote = **p;
+    } else if (quote && **p == quote) {
+      quote = 0;
+    } else if (n + 1 < size) {
+      buf[n++] = **p;
+    }
+  }
+  buf[n] = '\0';
+  return 1;
+}
+
+static int is_program(const char *path, struct stat *st) {
+  return stat(path, st) == 0 && S_ISREG(st->st_mode) &&
+         access(path, X_OK) == 0;
+}
+
+/**
+ * Finds a program in PATH (or takes it as is when it has a slash), the
+ * way execvp() would: a non-executable file of the same name earlier in
+ * PATH does not hide the program
+ * @param prog Program name or path
+ * @param st Receives the program's stat
+ * @return 0 if found as an executable regular file, -1 otherwise
+ */
+int program_find(const char *prog, struct stat *st) {
+  if (strchr(prog, '/'))
+    return is_program(prog, st) ? 0 : -1;
+
+  const char *path = getenv("PATH");
+  if (!path || !*path)
+    path = "/usr/local/bin:/usr/bin:/bin";
+
+  while (*path) {
+    size_t len = strcspn(path, ":");
+    char full[4096];
+    if (len > 0 &&
+        snprintf(full, sizeof(full), "%.*s/%s", (int)len, path, prog) <
+            (int)sizeof(full) &&
+        is_program(full, st))
+      return 0;
+    path += len;
+    if (*path == ':')
+      path++;
+  }
+  return -1;
+}
+
+/**
+ * Copies the program of an Exec line, skipping an `env VAR=value` prefix
+ * @param p Exec line, left after the program
+ * @return 1 if the line has a program, 0 if it is empty
+ */
+static int exec_program(const char **p, char *prog, size_t size) {
+  do {
+    if (!next_word(p, prog, size))
+      return 0;
+  } while (!strcmp(prog, "env") || (strchr(prog, '=') && prog[0] != '/'));
+  return 1;
+}
+
+/**
+ * Computes the key identifying what an Exec line runs: the program's
+ * inode, or the script's one for `interpreter /abs/script`. The
+ * arguments of other programs are files they open, not what they run.
+ * @param exec Exec line
+ * @param key Receives the key
+ * @return 0 on success, -1 if the program can't be identified reliably
+ */
+int exec_program_key(const char *exec, struct ProcKey *key) {
+  char prog[1024], arg[1024];
+  const char *p = exec;
+
+  struct stat st;
+  if (!exec_program(&p, prog, sizeof(prog)) || program_find(prog, &st) != 0)
+    return -1;
+
+  if (is_interpreter(prog)) {
+    struct stat script;
+    if (!next_word(&p, arg, sizeof(arg)) || arg[0] != '/' ||
+        stat(arg, &script) != 0 || !S_ISREG(script.st_mode))
+      return -1;
+    key->dev = script.st_dev;
+    key->ino = script.st_ino;
+    return 0;
+  }
+
+  key->dev = st.st_dev;
+  key->ino = st.st_ino;
+  return 0;
+}
+
+/**
+ * Checks whether the program an Exec line runs exists
+ * @param exec Exec line
+ * @return 1 if it is found in PATH (or at its path), 0 otherwise
+ */
+int exec_program_exists(const char *exec) {
+  char prog[1024];
+  struct stat st;
+  const char *p = exec;
+  return exec_program(&p, prog, sizeof(prog)) && program_find(prog, &st) == 0;
+}
+
+/**
+ * Opens the lock file that serializes launcher instances of one login
+ * session. The lock is per session (XDG_SESSION_ID, or the audit session
+ * id), so other sessions of the user are not held up.
+ * @return Lock file descriptor, not locked yet; -1 on error
+ */
+int session_lock_open(void) {
+  char name[64];
+  const char *id = getenv("XDG_SESSION_ID");
+  unsigned session = login_session(AT_FDCWD, "/proc/self");
+  if (id && *id && !strchr(id, '/'))
+    snprintf(name, sizeof(name), "autostart-%s.lock", id);
+  else if (session != SESSION_NONE)
+    snprintf(name, sizeof(name), "autostart-%u.lock", session);
+  else
+    snprintf(name, sizeof(name), "autostart.lock");
+
+  char path[4096];
+  if (runtime_path(name, path, sizeof(path)) != 0)
+    return -1;
+
+  return open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+}
+
+/**
+ * Takes the session lock without blocking, see session_lock_open()
+ * @return 0 if taken, -1 if another instance holds it
+ */
+int session_lock_try(int fd) {
+  return flock(fd, LOCK_EX | LOCK_NB);
+}
+
+void session_unlock(int fd) {
+  if (fd >= 0)
+    close(fd);
+}
@@ -0,0 +1,249 @@
+/**
+ * scan.c
+ *
+ * Parallel directory scan. Each autostart directory is parsed by a
+ * forked worker that sends the parsed entries back over a pipe watched
+ * in the session reactor. A worker stuck on a hung network mount can't
+ * be interrupted, but it can be left behind: the session launches what
+ * the other workers returned and merges the late directory if it still
+ * answers during the launch.
+ *
+ * A worker sends a struct ScanHeader followed by count DesktopEntry
+ * records, then exits. Workers are reaped from their pidfd in the
+ * reactor, so one that exits after it was given up is reaped as well.
+ */
+
+#define _GNU_SOURCE
+#include "scan.h"
+#include "autostart.h"
+#include "supervise.h"
+#include "syscalls.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct ScanHeader {
+  int found;
+  int count;
+};
+
+/**
+ * Parses a directory and sends the result to the session, in the
+ * worker process
+ */
+static void scan_worker(const char *path, int fd) {
+  struct AppQueue queue;
+  struct ScanHeader h = {0, 0};
+
+  app_queue_init(&queue);
+  int parsed = parse_autostart_files(path, &queue, &h.found);
+  if (parsed < 0)
+    h.found = -1;
+  else
+    h.count = parsed;
+
+  if (write_all(fd, &h, sizeof(h)) != 0 ||
+      write_all(fd, queue.apps, queue.count * sizeof(*queue.apps)) != 0)
+    _exit(1);
+  _exit(0);
+}
+
+/**
+ * Checks the received result and points entries into it
+ * @return 0 if the result is complete, -1 otherwise
+ */
+static int scan_decode(struct ScanDir *d) {
+  struct ScanHeader h;
+  if (d->len < sizeof(h))
+    return -1;
+  memcpy(&h, d->buf, sizeof(h));
+  if (h.count < 0 ||
+      d->len != sizeof(h) + (size_t)h.count * sizeof(struct DesktopEntry))
+    return -1;
+
+  d->found = h.found;
+  d->count = h.count;
+  d->entries = (const struct DesktopEntry *)(d->buf + sizeof(h));
+  return 0;
+}
+
+/**
+ * Stops watching a worker; it exits right after closing its pipe
+ */
+static void scan_close(struct Scan *scan, struct ScanDir *d) {
+  reactor_remove(d->pipe);
+  d->pipe = NULL;
+  scan->pending--;
+}
+
+/**
+ * Collects the output of a worker, finishing its directory at EOF
+ */
+static void on_scan_pipe(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct Scan *scan = src->data;
+  struct ScanDir *d = NULL;
+  for (size_t i = 0; i < scan->count && !d; i++)
+    if (scan->dirs[i].pipe == src)
+      d = &scan->dirs[i];
+  if (!d)
+    return;
+
+  if (read_pending(src->fd, &d->buf, &d->len, &d->capacity) == 0)
+    return;
+
+  scan_close(scan, d);
+  // Without a pidfd, the worker exits right after closing the pipe
+  if (!d->exit)
+    waitpid(d->pid, NULL, WNOHANG);
+  d->state = scan_decode(d) == 0 ? SCAN_DONE : SCAN_FAILED;
+  if (scan->on_done)
+    scan->on_done(scan->data, d);
+}
+
+/**
+ * Reaps a worker once it exited, whether its directory is done, failed
+ * or given up
+ */
+static void on_scan_exit(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct Scan *scan = src->data;
+  for (size_t i = 0; i < scan->count; i++) {
+    struct ScanDir *d = &scan->dirs[i];
+    if (d->exit == src) {
+      waitpid(d->pid, NULL, WNOHANG);
+      reactor_remove(src);
+      d->exit = NULL;
+      return;
+    }
+  }
+}
+
+/**
+ * Starts a worker parsing one directory
+ * @param scan Scan state
+ * @param r Reactor watching the result pipe
+ * @param path Directory, must outlive the scan
+ * @param index Position among the session's directories
+ * @return 0 on success, -1 if no worker could be started
+ */
+int scan_add(struct Scan *scan, struct Reactor *r, const char *path,
+             int index) {
+  if (scan->count == scan->capacity) {
+    size_t capacity = scan->capacity ? scan->capacity * 2 : 4;
+    struct ScanDir *tmp = realloc(scan->dirs, capacity * sizeof(*tmp));
+    if (!tmp) {
+      perror("realloc");
+      exit(1);
+    }
+    scan->dirs = tmp;
+    scan->capacity = capacity;
+  }
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    scan_worker(path, fds[1]);
+  }
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  struct ReactorSource *src = reactor_add(r, fds[0], 1, on_scan_pipe, scan);
+  if (!src) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+
+  struct ScanDir *d = &scan->dirs[scan->count++];
+  memset(d, 0, sizeof(*d));
+  d->path = path;
+  d->index = index;
+  d->pid = pid;
+  d->pipe = src;
+  // Race free, the worker can't be reaped before
+  int pidfd = sys_pidfd_open(pid, 0);
+  if (pidfd >= 0)
+    d->exit = reactor_add(r, pidfd, 1, on_scan_exit, scan);
+  d->state = SCAN_PENDING;
+  d->started_ms = now_ms();
+  scan->pending++;
+  return 0;
+}
+
+/**
+ * @return Directory scanned at a session position, NULL if it has no
+ *         worker
+ */
+struct ScanDir *scan_find(struct Scan *scan, int index) {
+  for (size_t i = 0; i < scan->count; i++)
+    if (scan->dirs[i].index == index)
+      return &scan->dirs[i];
+  return NULL;
+}
+
+/**
+ * Gives up on every directory still pending. Their workers are killed;
+ * one blocked in the kernel on a hung mount exits once the call returns,
+ * and is reaped from its pidfd then.
+ * @return Number of directories given up
+ */
+size_t scan_abandon(struct Scan *scan) {
+  size_t abandoned = 0;
+
+  for (size_t i = 0; i < scan->count; i++) {
+    struct ScanDir *d = &scan->dirs[i];
+    if (d->state != SCAN_PENDING)
+      continue;
+
+    fprintf(stderr, "Warning: Giving up on %s after %ldms\n", d->path,
+            now_ms() - d->started_ms);
+    kill(d->pid, SIGKILL);
+    if (!d->exit)
+      waitpid(d->pid, NULL, WNOHANG);
+    scan_close(scan, d);
+    d->state = SCAN_FAILED;
+    abandoned++;
+  }
+  return abandoned;
+}
+
+/**
+ * Abandons pending directories quietly and frees the scan
+ */
+void scan_free(struct Scan *scan) {
+  for (size_t i = 0; i < scan->count; i++) {
+    struct ScanDir *d = &scan->dirs[i];
+    int unreaped = d->exit || d->state == SCAN_PENDING;
+    if (d->state == SCAN_PENDING) {
+      kill(d->pid, SIGKILL);
+      scan_close(scan, d);
+    }
+    if (d->exit) {
+      reactor_remove(d->exit);
+      d->exit = NULL;
+    }
+    // A worker still stuck in the kernel is left to init once the
+    // launcher exits
+    if (unreaped)
+      waitpid(d->pid, NULL, WNOHANG);
+    free(d->buf);
+  }
+  free(scan->dirs);
+  memset(scan, 0, sizeof(*scan));
+}
@@ -0,0 +1,328 @@
+/**
+ * simulate.c
+ *
+ * Offline launch simulator and delay tuner. The scheduler of
+ * launch_queued_apps() is replayed on a virtual clock: each application
+ * needs the CPU time its last starts used (from the startup history)
+ * before it is ready, and shares the CPUs with every other starting
+ * application by nice weight, like CFS. More runnable tasks than CPUs
+ * cost SIM_SWITCH_COST of throughput each, and a resident set beyond the
+ * available memory slows every start down in proportion, which is what
+ * makes staggering worth anything.
+ *
+ * The tuner then searches delay, startup_delay and a nice level for the
+ * heavier applications for the lowest sum of time to the first ready
+ * application and time to all ready. A limit on concurrent starts is
+ * not searched: the launcher has none to set, and delay is what bounds
+ * how many applications start at once.
+ */
+
+#include "simulate.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct SimApp {
+  const struct DesktopEntry *de;
+  double cpu_ms;
+  double rss_kb;
+  int fixed_delay; // per-application delay rule, -1 if none
+  int nice;        // nice of the config rule
+  int heavy;       // in the heavier half by CPU cost
+  int measured;    // cost comes from the history
+  double due_ms;              // planned launch
+  double launch_ms, ready_ms; // -1 until launched / ready
+  double left_ms, weight, rate;
+};
+
+static const int delay_grid[] = {0,   10,  25,  50,  75,  100,
+                                 150, 200, 300, 500, 750, 1000};
+static const int startup_grid[] = {0, 100, 250, 500};
+static const int nice_grid[] = {0, 5, 10, 19};
+
+/**
+ * Fills the host model from the running machine: online CPUs and
+ * MemAvailable
+ */
+void sim_host_detect(struct SimHost *host) {
+  host->cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (host->cpus < 1)
+    host->cpus = 1;
+
+  host->mem_kb = 0;
+  FILE *f = fopen("/proc/meminfo", "r");
+  if (f) {
+    char line[128];
+    while (fgets(line, sizeof(line), f))
+      if (sscanf(line, "MemAvailable: %ld", &host->mem_kb) == 1)
+        break;
+    fclose(f);
+  }
+  if (host->mem_kb <= 0)
+    host->mem_kb = 1024L * 1024;
+}
+
+/**
+ * @return Nice level the kernel would apply, -20 to 19
+ */
+static int clamp_nice(int nice) {
+  return nice > 19 ? 19 : nice < -20 ? -20 : nice;
+}
+
+/**
+ * @return CFS load weight of a nice level, 1024 at nice 0
+ */
+static double nice_weight(int nice) {
+  double w = 1024;
+  nice = clamp_nice(nice);
+  for (; nice > 0; nice--)
+    w /= 1.25;
+  for (; nice < 0; nice++)
+    w *= 1.25;
+  return w;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Splits the CPU capacity among the active applications by weight, no
+ * application getting more than one CPU (water filling)
+ * @param cap Throughput of one CPU after contention
+ */
+static void share_cpus(struct SimApp *apps, size_t n, double capacity,
+                       double cap) {
+  double weights = 0;
+  for (size_t i = 0; i < n; i++) {
+    apps[i].rate = -1;
+    if (apps[i].left_ms > 0 && apps[i].launch_ms >= 0)
+      weights += apps[i].weight;
+  }
+
+  // Fix the applications whose share exceeds one CPU, then split again
+  for (int changed = 1; changed && weights > 0;) {
+    changed = 0;
+    for (size_t i = 0; i < n; i++) {
+      struct SimApp *a = &apps[i];
+      if (a->rate >= 0 || a->left_ms <= 0 || a->launch_ms < 0)
+        continue;
+      if (capacity * a->weight / weights > cap) {
+        a->rate = cap;
+        capacity -= cap;
+        weights -= a->weight;
+        changed = 1;
+      }
+    }
+  }
+  for (size_t i = 0; i < n; i++)
+    if (apps[i].rate < 0)
+      apps[i].rate = weights > 0 ? capacity * apps[i].weight / weights : 0;
+}
+
+/**
+ * Replays one launch on the virtual clock
+ * @param apps Applications in launch order, launch_ms and ready_ms are set
+ * @param n Number of applications
+ * @param host Machine model
+ * @param p Settings to simulate
+ * @param res Receives the predicted times
+ */
+static void simulate(struct SimApp *apps, size_t n, const struct SimHost *host,
+                     const struct SimParams *p, struct SimResult *res) {
+  double t = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    struct SimApp *a = &apps[i];
+    int delay = a->fixed_delay >= 0 ? a->fixed_delay
+                : i == 0            ? p->startup_delay_ms
+                                    : p->delay_ms;
+    t += delay;
+    a->due_ms = t;
+    t += SIM_SPAWN_MS;
+
+    a->launch_ms = -1;
+    a->ready_ms = -1;
+    a->left_ms = a->cpu_ms;
+    a->weight = nice_weight(a->nice + (a->heavy ? p->heavy_nice : 0));
+  }
+
+  size_t ready = 0, next = 0;
+  t = 0;
+  while (ready < n) {
+    // Launch everything due, ready right away if it costs nothing
+    while (next < n && apps[next].due_ms <= t) {
+      struct SimApp *a = &apps[next++];
+      a->launch_ms = a->due_ms;
+      if (a->left_ms <= 0) {
+        a->ready_ms = a->launch_ms;
+        ready++;
+      }
+    }
+
+    size_t active = 0;
+    double resident = 0;
+    for (size_t i = 0; i < next; i++) {
+      active += apps[i].left_ms > 0;
+      resident += apps[i].rss_kb;
+    }
+
+    double cap = 1.0;
+    if ((long)active > host->cpus)
+      cap /= 1 + SIM_SWITCH_COST * (double)(active - host->cpus) / host->cpus;
+    if (resident > host->mem_kb)
+      cap *= host->mem_kb / resident;
+    share_cpus(apps, next, cap * host->cpus, cap);
+
+    double dt = next < n ? apps[next].due_ms - t : INFINITY;
+    for (size_t i = 0; i < next; i++)
+      if (apps[i].left_ms > 0 && apps[i].rate > 0 &&
+          apps[i].left_ms / apps[i].rate < dt)
+        dt = apps[i].left_ms / apps[i].rate;
+    if (!isfinite(dt))
+      break; // nothing can progress
+
+    t += dt;
+    for (size_t i = 0; i < next; i++) {
+      struct SimApp *a = &apps[i];
+      if (a->left_ms <= 0)
+        continue;
+      a->left_ms -= a->rate * dt;
+      if (a->left_ms <= 1e-6) {
+        a->left_ms = 0;
+        a->ready_ms = t;
+        ready++;
+      }
+    }
+  }
+
+  res->first_ms = INFINITY;
+  res->all_ms = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (apps[i].ready_ms < res->first_ms)
+      res->first_ms = apps[i].ready_ms;
+    if (apps[i].ready_ms > res->all_ms)
+      res->all_ms = apps[i].ready_ms;
+  }
+  if (n == 0)
+    res->first_ms = 0;
+}
+
+static double score(const struct SimResult *r) {
+  return r->first_ms + r->all_ms;
+}
+
+static void print_params(FILE *out, const char *label,
+                         const struct SimParams *p,
+                         const struct SimResult *r) {
+  fprintf(out, "%-8s delay=%d startup_delay=%d heavy nice=+%d: ", label,
+          p->delay_ms, p->startup_delay_ms, p->heavy_nice);
+  fprintf(out, "first ready %.0fms, all ready %.0fms\n", r->first_ms,
+          r->all_ms);
+}
+
+/**
+ * Predicts the launch of the queued applications with the current
+ * settings, searches better ones and prints both
+ * @param out Output stream
+ * @param queue Queued applications, in launch order
+ * @param cfg Configuration (delays and per-application rules)
+ * @param history Startup history with the measured costs
+ * @param host Machine model
+ * @return 0 on success
+ */
+int simulate_launch(FILE *out, const struct AppQueue *queue,
+                    struct Config *cfg, struct History *history,
+                    const struct SimHost *host) {
+  size_t n = queue->count;
+  struct SimApp *apps = calloc(n ? n : 1, sizeof(*apps));
+  double *costs = malloc((n ? n : 1) * sizeof(*costs));
+  if (!apps || !costs) {
+    perror("malloc");
+    exit(1);
+  }
+
+  size_t measured = 0;
+  for (size_t i = 0; i < n; i++) {
+    struct SimApp *a = &apps[i];
+    const struct AppRule *rule = entry_rule(cfg, &queue->apps[i]);
+    const struct HistoryEntry *e = history_find(history, queue->apps[i].id);
+
+    a->de = &queue->apps[i];
+    a->measured = e && e->cpu_ms >= 0;
+    a->cpu_ms = a->measured ? e->cpu_ms : SIM_DEFAULT_CPU_MS;
+    a->rss_kb = e && e->rss_kb >= 0 ? e->rss_kb : SIM_DEFAULT_RSS_KB;
+    a->fixed_delay = rule ? rule->delay_ms : -1;
+    a->nice = rule ? rule->nice : 0;
+    measured += a->measured;
+    costs[i] = a->cpu_ms;
+  }
+
+  // Heavier half: above the median CPU cost
+  double median = 0;
+  if (n) {
+    qsort(costs, n, sizeof(*costs), compare_double);
+    median = costs[n / 2];
+  }
+  for (size_t i = 0; i < n; i++)
+    apps[i].heavy = n > 1 && apps[i].cpu_ms > median;
+  free(costs);
+
+  fprintf(out, "Simulating %zu applications on %d CPUs, %ld MB available\n", n,
+          host->cpus, host->mem_kb / 1024);
+  fprintf(out, "History: %zu measured, others assume %dms CPU and %d MB\n\n",
+          measured, SIM_DEFAULT_CPU_MS, SIM_DEFAULT_RSS_KB / 1024);
+
+  struct SimParams current = {cfg->startup_delay_ms, cfg->delay_ms, 0};
+  struct SimResult cur;
+  simulate(apps, n, host, &current, &cur);
+
+  fprintf(out, "%-32s %7s %7s %8s %8s\n", "Application", "CPU ms", "RSS MB",
+          "Launch", "Ready");
+  for (size_t i = 0; i < n; i++) {
+    const struct SimApp *a = &apps[i];
+    fprintf(out, "%-32.32s %7.0f%c %6.0f %8.0f %8.0f\n", a->de->name,
+            a->cpu_ms, a->measured ? ' ' : '?', a->rss_kb / 1024,
+            a->launch_ms, a->ready_ms);
+  }
+  fprintf(out, "\n");
+
+  struct SimParams best = current;
+  struct SimResult best_res = cur;
+  for (size_t d = 0; d < sizeof(delay_grid) / sizeof(delay_grid[0]); d++)
+    for (size_t s = 0; s < sizeof(startup_grid) / sizeof(startup_grid[0]); s++)
+      for (size_t k = 0; k < sizeof(nice_grid) / sizeof(nice_grid[0]); k++) {
+        struct SimParams p = {startup_grid[s], delay_grid[d], nice_grid[k]};
+        struct SimResult r;
+        simulate(apps, n, host, &p, &r);
+        // Strictly better only, so ties keep the current settings
+        if (score(&r) < score(&best_res) - 0.5) {
+          best = p;
+          best_res = r;
+        }
+      }
+
+  print_params(out, "Current", &current, &cur);
+  print_params(out, "Tuned", &best, &best_res);
+
+  if (memcmp(&best, &current, sizeof(best)) == 0) {
+    fprintf(out, "\nThe current settings are already the best found.\n");
+  } else {
+    fprintf(out, "\nSuggested config:\n[general]\n");
+    fprintf(out, "startup_delay=%d\ndelay=%d\n", best.startup_delay_ms,
+            best.delay_ms);
+    if (best.heavy_nice) {
+      fprintf(out, "[apps]\n# merge into existing rules of these "
+                   "applications\n");
+      for (size_t i = 0; i < n; i++)
+        if (apps[i].heavy)
+          fprintf(out, "%s=nice:%d\n", apps[i].de->name,
+                  clamp_nice(apps[i].nice + best.heavy_nice));
+    }
+  }
+
+  free(apps);
+  return 0;
+}
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include "spawner.h"
+#include "reclaim.h"
+#include "supervise.h"
+#include "syscalls.h"
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE 67
+#endif
+
+struct SpawnHeader {
+  uint32_t argc;
+  uint32_t envc;
+  int32_t nice;
+  int32_t uclamp_min, uclamp_max;
+  uint32_t ksm;
+  int64_t hold_until_ms;
+  uint32_t has_cwd;
+  uint32_t has_cgroup;
+};
+
+struct SpawnReply {
+  int32_t pid;
+  int32_t err;
+};
+
+static int spawner_fd = -1;
+static pid_t spawner_pid = -1;
+
+/**
+ * Child side of every launch: detaches, applies the request's knobs
+ * and replaces the process image. Never returns.
+ * @param req Spawn request
+ */
+void spawn_exec(const struct SpawnRequest *req) {
+  pid_t launcher = getppid();
+
+  // Ignore signals that could cause coredump
+  signal(SIGSEGV, SIG_IGN);
+  signal(SIGABRT, SIG_IGN);
+  signal(SIGILL, SIG_IGN);
+
+  // A supervising launcher blocks its stop signals, don't inherit that
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
+
+  // Start new session to detach from terminal
+  setsid();
+
+  // Change working directory if specified
+  if (req->cwd && *req->cwd) {
+    if (chdir(req->cwd) != 0) {
+      // Error message before closing descriptors
+      fprintf(stderr, "Failed to chdir to %s: %s\n", req->cwd,
+              strerror(errno));
+    }
+  }
+
+  for (int i = 0; i < req->attr.env_count; i++) {
+    const char *eq = strchr(req->attr.env[i], '=');
+    if (eq) {
+      char name[256];
+      snprintf(name, sizeof(name), "%.*s", (int)(eq - req->attr.env[i]),
+               req->attr.env[i]);
+      setenv(name, eq + 1, 1);
+    } else {
+      unsetenv(req->attr.env[i]);
+    }
+  }
+
+  if (req->attr.nice) {
+    errno = 0;
+    if (nice(req->attr.nice) == -1 && errno)
+      fprintf(stderr, "Failed to renice: %s\n", strerror(errno));
+  }
+
+  // Inherited by every thread and child the application starts
+  if (req->attr.uclamp_max &&
+      sys_sched_uclamp(0, req->attr.uclamp_min, req->attr.uclamp_max) != 0 &&
+      errno != EOPNOTSUPP && errno != ENOSYS)
+    fprintf(stderr, "Failed to set uclamp: %s\n", strerror(errno));
+
+  // Charged to a leaf of its own from here on, for idle reclaim
+  if (req->attr.cgroup && reclaim_cgroup_enter(req->attr.cgroup) != 0)
+    fprintf(stderr, "Failed to enter cgroup: %s\n", strerror(errno));
+
+  // Survives exec and fork; the launcher reports kernels without it
+  if (req->attr.ksm && prctl(PR_SET_MEMORY_MERGE, 1, 0, 0, 0) != 0 &&
+      errno != EINVAL && errno != ENOSYS)
+    fprintf(stderr, "Failed to enable memory merging: %s\n", strerror(errno));
+
+  // Close standard file descriptors
+  close(STDIN_FILENO);
+  close(STDOUT_FILENO);
+  close(STDERR_FILENO);
+
+  // The launcher waits for the stop, attaches the cold start counters
+  // and sends SIGCONT, so that they start counting at exec. It gives up
+  // waiting a while after the deadline: a child that got stuck on the
+  // way (a chdir() on a hung mount, say) must not stop after that. A
+  // launcher that dies meanwhile continues it through the death signal.
+  if (req->attr.hold_until_ms && now_ms() < req->attr.hold_until_ms &&
+      prctl(PR_SET_PDEATHSIG, SIGCONT) == 0) {
+    if (getppid() == launcher)
+      raise(SIGSTOP);
+    prctl(PR_SET_PDEATHSIG, 0);
+  }
+
+  execvp(req->argv[0], (char *const *)req->argv);
+  if (strcmp(req->argv[0], "sh") == 0) {
+    const char **argv = (const char **)req->argv;
+    argv[0] = "bash";
+    execvp(argv[0], (char *const *)argv);
+  }
+
+  // Exec failed
+  _exit(EXIT_FAILURE);
+}
+
+/**
+ * Appends a NUL terminated string to a message buffer
+ * @return New length, 0 if the buffer is too small
+ */
+static size_t put_str(char *buf, size_t len, size_t size, const char *s) {
+  size_t n = strlen(s) + 1;
+  if (len == 0 || len + n > size)
+    return 0;
+  memcpy(buf + len, s, n);
+  return len + n;
+}
+
+/**
+ * Serializes a request into a single datagram:
+ * header, cwd, cgroup, argv strings, env strings (all NUL terminated)
+ * @return Message length, 0 if it does not fit
+ */
+static size_t encode_request(const struct SpawnRequest *req, char *buf,
+                             size_t size) {
+  struct SpawnHeader hdr = {.argc = req->argc,
+                            .envc = req->attr.env_count,
+                            .nice = req->attr.nice,
+                            .uclamp_min = req->attr.uclamp_min,
+                            .uclamp_max = req->attr.uclamp_max,
+                            .ksm = req->attr.ksm,
+                            .hold_until_ms = req->attr.hold_until_ms,
+                            .has_cwd = req->cwd && *req->cwd,
+                            .has_cgroup = req->attr.cgroup != NULL};
+  memcpy(buf, &hdr, sizeof(hdr));
+
+  size_t len = put_str(buf, sizeof(hdr), size, hdr.has_cwd ? req->cwd : "");
+  len = put_str(buf, len, size, hdr.has_cgroup ? req->attr.cgroup : "");
+  for (int i = 0; i < req->argc; i++)
+    len = put_str(buf, len, size, req->argv[i]);
+  for (int i = 0; i < req->attr.env_count; i++)
+    len = put_str(buf, len, size, req->attr.env[i]);
+
+  return len;
+}
+
+/**
+ * Parses a datagram produced by encode_request(). Strings point into buf.
+ * @return 1 on success, 0 on malformed message
+ */
+static int decode_request(char *buf, size_t len, struct SpawnRequest *req) {
+  struct SpawnHeader hdr;
+  if (len < sizeof(hdr))
+    return 0;
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (hdr.argc == 0 || hdr.argc > SPAWN_MAX_ARGS || hdr.envc > SPAWN_MAX_ENV)
+    return 0;
+
+  const char *strs[2 + SPAWN_MAX_ARGS + SPAWN_MAX_ENV];
+  size_t want = 2 + hdr.argc + hdr.envc;
+  size_t got = 0;
+  size_t pos = sizeof(hdr);
+
+  while (got < want && pos < len) {
+    char *end = memchr(buf + pos, '\0', len - pos);
+    if (!end)
+      return 0;
+    strs[got++] = buf + pos;
+    pos = end - buf + 1;
+  }
+  if (got != want)
+    return 0;
+
+  memset(req, 0, sizeof(*req));
+  req->cwd = hdr.has_cwd ? strs[0] : NULL;
+  req->attr.cgroup = hdr.has_cgroup ? strs[1] : NULL;
+  req->argc = hdr.argc;
+  for (uint32_t i = 0; i < hdr.argc; i++)
+    req->argv[i] = strs[2 + i];
+  req->argv[hdr.argc] = NULL;
+  req->attr.nice = hdr.nice;
+  req->attr.uclamp_min = hdr.uclamp_min;
+  req->attr.uclamp_max = hdr.uclamp_max;
+  req->attr.ksm = hdr.ksm;
+  req->attr.hold_until_ms = hdr.hold_until_ms;
+  req->attr.env_count = hdr.envc;
+  for (uint32_t i = 0; i < hdr.envc; i++)
+    req->attr.env[i] = strs[2 + hdr.argc + i];
+
+  return 1;
+}
+
+/**
+ * Sends the reply for one request, passing the pidfd with SCM_RIGHTS
+ */
+static void send_reply(int fd, pid_t pid, int err, int pidfd) {
+  struct SpawnReply reply = {.pid = pid, .err = err};
+  struct iovec iov = {.iov_base = &reply, .iov_len = sizeof(reply)};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+
+  if (pidfd >= 0) {
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &pidfd, sizeof(int));
+  }
+
+  sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+/**
+ * Main loop of the zygote. Children are created with CLONE_PARENT so
+ * they belong to the launcher, which can wait for them as usual.
+ * @param fd Socket connected to the launcher
+ */
+static void spawner_loop(int fd) {
+  static char buf[SPAWN_MSG_MAX];
+
+  for (;;) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      _exit(0);
+
+    struct SpawnRequest req;
+    if (!decode_request(buf, n, &req)) {
+      send_reply(fd, -1, EINVAL, -1);
+      continue;
+    }
+
+    int pidfd = -1;
+    pid_t pid = sys_clone_pidfd(CLONE_PARENT, &pidfd);
+    if (pid == 0) {
+      close(fd);
+      spawn_exec(&req);
+    }
+
+    send_reply(fd, pid, pid < 0 ? errno : 0, pid > 0 ? pidfd : -1);
+    if (pid > 0)
+      close(pidfd);
+  }
+}
+
+/**
+ * Forks the zygote spawner. Meant to be called once a launch is known to
+ * follow and before the config is read, while the launcher is still
+ * small and has nothing buffered in stdio.
+ * @return 0 on success, -1 on failure (launches then fork locally)
+ */
+int spawner_start(void) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    close(sv[0]);
+    spawner_loop(sv[1]);
+  }
+
+  close(sv[1]);
+  spawner_fd = sv[0];
+  spawner_pid = pid;
+  return 0;
+}
+
+/**
+ * Shuts the zygote down and reaps it
+ */
+void spawner_stop(void) {
+  if (spawner_fd < 0)
+    return;
+
+  close(spawner_fd);
+  waitpid(spawner_pid, NULL, 0);
+  spawner_fd = -1;
+  spawner_pid = -1;
+}
+
+/**
+ * @return 1 if launches go through the zygote, 0 otherwise
+ */
+int spawner_active(void) { return spawner_fd >= 0; }
+
+/**
+ * Asks the zygote to spawn a process
+ * @param req Spawn request
+ * @param pidfd Receives the child's pidfd (-1 if none), may be NULL
+ * @return Child pid, -1 on error. On protocol or kernel errors the
+ *         zygote is stopped and callers should fork locally.
+ */
+pid_t spawner_spawn(const struct SpawnRequest *req, int *pidfd) {
+  char buf[SPAWN_MSG_MAX];
+  size_t len = encode_request(req, buf, sizeof(buf));
+
+  if (pidfd)
+    *pidfd = -1;
+  if (spawner_fd < 0 || len == 0) {
+    errno = len == 0 ? E2BIG : EBADF;
+    return -1;
+  }
+
+  if (send(spawner_fd, buf, len, MSG_NOSIGNAL) < 0) {
+    spawner_stop();
+    return -1;
+  }
+
+  struct SpawnReply reply;
+  struct iovec iov = {.iov_base = &reply, .iov_len = sizeof(reply)};
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+
+  ssize_t n;
+  do {
+    n = recvmsg(spawner_fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+
+  if (n != sizeof(reply)) {
+    spawner_stop();
+    return -1;
+  }
+
+  int fd = -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+  if (reply.pid <= 0) {
+    // Kernel without clone3/CLONE_PARENT support: stop using the zygote
+    if (reply.err == ENOSYS || reply.err == EINVAL || reply.err == EPERM)
+      spawner_stop();
+    errno = reply.err;
+    return -1;
+  }
+
+  if (pidfd)
+    *pidfd = fd;
+  else if (fd >= 0)
+    close(fd);
+  return reply.pid;
+}
@@ -0,0 +1,712 @@
+/**
+ * supervise.c
+ *
+ * Supervise mode: the launcher stays alive for the whole login session,
+ * reaps its applications and, on SIGTERM or a "stop" request on its
+ * control socket, tears them down in parallel. Every child gets SIGTERM
+ * in reverse launch order, then all pidfds are waited on at once in the
+ * session reactor with one deadline; children still alive at the
+ * deadline get SIGKILL. Logout takes at most stop_timeout plus a short
+ * grace.
+ */
+
+#define _GNU_SOURCE
+#include "supervise.h"
+#include "reclaim.h"
+#include "syscalls.h"
+#include "util.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @return CLOCK_MONOTONIC time in ms
+ */
+long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void reap_all(struct ChildList *list);
+
+/**
+ * Reaps whatever exited when a watched pidfd becomes readable
+ */
+static void on_child_exit(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct Session *s = src->data;
+  reap_all(&s->children);
+}
+
+/**
+ * Records a launched process and watches its pidfd in the session
+ * reactor. The pidfd is race free: the child can't be reaped, so its
+ * pid can't be reused, before it is opened.
+ * @param s Session
+ * @param pid Child pid
+ * @param pidfd Its pidfd, owned by the child from now on; -1 to open one
+ * @param name Application name
+ * @param id Desktop file ID (NULL for helpers such as terminal servers)
+ * @return The tracked child, valid until the next track_child()
+ */
+struct Child *track_child(struct Session *s, pid_t pid, int pidfd,
+                          const char *name, const char *id) {
+  struct ChildList *list = &s->children;
+
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 16;
+    struct Child *tmp = realloc(list->items, capacity * sizeof(*tmp));
+    if (!tmp) {
+      perror("realloc");
+      exit(1);
+    }
+    list->items = tmp;
+    list->capacity = capacity;
+  }
+
+  struct Child *c = &list->items[list->count++];
+  memset(c, 0, sizeof(*c));
+  c->pid = pid;
+  c->pidfd = pidfd >= 0 ? pidfd : sys_pidfd_open(pid, 0);
+  if (c->pidfd >= 0)
+    c->watch = reactor_add(&s->reactor, c->pidfd, 1, on_child_exit, s);
+  c->status = -1;
+  c->started_ms = now_ms();
+  c->cpu_ms = c->rss_kb = -1;
+  c->idle_since_ms = c->started_ms;
+  perfstat_init(&c->perf);
+  snprintf(c->name, sizeof(c->name), "%s", name);
+  snprintf(c->id, sizeof(c->id), "%s", id ? id : "");
+  return c;
+}
+
+/**
+ * Marks a child as exited
+ * @param status Wait status, -1 if unknown
+ * @param ru Resource usage of the child, NULL if unknown
+ */
+static void child_exited(struct Child *c, int status,
+                         const struct rusage *ru) {
+  c->exited = 1;
+  c->status = status;
+  c->exited_ms = now_ms();
+  if (ru) {
+    c->cpu_ms = (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000L +
+                (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1000;
+    c->rss_kb = ru->ru_maxrss;
+  }
+  if (c->watch)
+    reactor_remove(c->watch);
+  else if (c->pidfd >= 0)
+    close(c->pidfd);
+  c->watch = NULL;
+  c->pidfd = -1;
+}
+
+/**
+ * Reaps a child if it has exited
+ * @return 1 if the child is gone
+ */
+static int reap_child(struct Child *c) {
+  if (c->exited)
+    return 1;
+
+  int status;
+  struct rusage ru;
+  pid_t r = wait4(c->pid, &status, WNOHANG, &ru);
+  if (r == c->pid)
+    child_exited(c, status, &ru);
+  else if (r < 0 && errno == ECHILD)
+    child_exited(c, -1, NULL);
+  return c->exited;
+}
+
+/**
+ * Reaps tracked children, then every orphan reparented to the launcher
+ * (a child subreaper), so that exited group members don't linger as
+ * zombies
+ */
+static void reap_all(struct ChildList *list) {
+  for (size_t i = 0; i < list->count; i++)
+    reap_child(&list->items[i]);
+
+  int status;
+  struct rusage ru;
+  pid_t pid;
+  while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+    // A tracked child that exited after its own check
+    for (size_t i = 0; i < list->count; i++)
+      if (list->items[i].pid == pid && !list->items[i].exited)
+        child_exited(&list->items[i], status, &ru);
+  }
+}
+
+/**
+ * Checks whether a child and everything left in its process group (it
+ * is a session leader) are gone
+ * @return 1 if nothing of the child runs any more
+ */
+static int child_done(struct Child *c) {
+  return reap_child(c) && kill(-c->pid, 0) != 0 && errno != EPERM;
+}
+
+/**
+ * Signals a child's process group (children are session leaders), or
+ * the child alone through its pidfd
+ */
+static void signal_child(const struct Child *c, int sig) {
+  // A reaped pid may be reused, only its group is still safe to signal
+  if (kill(-c->pid, sig) == 0 || c->exited)
+    return;
+  if (c->pidfd < 0 || sys_pidfd_send_signal(c->pidfd, sig) != 0)
+    kill(c->pid, sig);
+}
+
+/**
+ * Waits until every child and its process group exited or the deadline
+ * passed. Exits of children wake the wait through their pidfds in the
+ * session reactor; group members and children without pidfd are polled
+ * every 50ms.
+ * @param s Session
+ * @param deadline Absolute CLOCK_MONOTONIC time in ms
+ * @return Number of children still alive
+ */
+static size_t wait_children(struct Session *s, long deadline) {
+  struct ChildList *list = &s->children;
+
+  for (;;) {
+    size_t alive = 0;
+    reap_all(list);
+    for (size_t i = 0; i < list->count; i++)
+      alive += !child_done(&list->items[i]);
+
+    long left = deadline - now_ms();
+    if (alive == 0 || left <= 0)
+      return alive;
+    if (reactor_poll(&s->reactor, left < 50 ? (int)left : 50) < 0)
+      return alive;
+  }
+}
+
+/**
+ * Reads the CPU time and peak RSS of a live child from /proc
+ */
+static void sample_child(struct Child *c) {
+  char path[64], buf[1024];
+
+  if (proc_stat(c->pid, NULL, &c->cpu_ms) != 0)
+    c->cpu_ms = -1;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)c->pid);
+  FILE *f = fopen(path, "r");
+  if (f) {
+    while (fgets(buf, sizeof(buf), f))
+      if (sscanf(buf, "VmHWM: %ld", &c->rss_kb) == 1)
+        break;
+    fclose(f);
+  }
+}
+
+static void on_watch_timer(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  *(int *)src->data = 1;
+}
+
+/**
+ * Waits until every tracked application has exited or outlived its first
+ * window_ms, so that crashes at startup can be told from normal runs.
+ * Returns early on a stop request in supervise mode. The cost (CPU
+ * time, peak RSS) of applications still running is sampled at the end,
+ * exited ones report it through wait4().
+ * @param s Session
+ * @param window_ms Crash window, counted from each launch
+ * @return Number of applications that exited within the window
+ */
+int watch_startup(struct Session *s, int window_ms) {
+  struct ChildList *list = &s->children;
+  long deadline = 0;
+  int expired = 0;
+
+  for (size_t i = 0; i < list->count; i++) {
+    struct Child *c = &list->items[i];
+    if (*c->id && c->started_ms + window_ms > deadline)
+      deadline = c->started_ms + window_ms;
+  }
+
+  struct ReactorSource *timer =
+      reactor_timer(&s->reactor, on_watch_timer, &expired);
+  if (timer)
+    reactor_timer_set(timer, deadline);
+
+  for (;;) {
+    reap_all(list);
+
+    size_t watching = 0;
+    for (size_t i = 0; i < list->count; i++) {
+      struct Child *c = &list->items[i];
+      watching += *c->id && !c->exited;
+    }
+    if (watching == 0 || expired || s->stopping || now_ms() >= deadline)
+      break;
+
+    // Without a timer, fall back to polling the deadline
+    if (reactor_poll(&s->reactor, timer ? -1 : 50) < 0)
+      break;
+  }
+
+  if (timer)
+    reactor_remove(timer);
+
+  int early = 0;
+  for (size_t i = 0; i < list->count; i++) {
+    struct Child *c = &list->items[i];
+    if (*c->id && !c->exited)
+      sample_child(c);
+    early += *c->id && c->exited && c->exited_ms - c->started_ms < window_ms;
+  }
+  return early;
+}
+
+/**
+ * Stops every tracked child: SIGTERM in reverse launch order, a parallel
+ * wait bounded by timeout_ms, then SIGKILL for the remaining ones
+ * @param s Session
+ * @param timeout_ms Time the children get to exit after SIGTERM
+ * @param killed Receives the number of children that needed SIGKILL
+ * @return Number of children that were still running
+ */
+int session_teardown(struct Session *s, int timeout_ms, int *killed) {
+  struct ChildList *list = &s->children;
+  int stopped = 0;
+
+  *killed = 0;
+  for (size_t i = list->count; i-- > 0;) {
+    struct Child *c = &list->items[i];
+    if (child_done(c))
+      continue;
+
+    signal_child(c, SIGTERM);
+    stopped++;
+  }
+
+  long deadline = now_ms() + timeout_ms;
+  if (wait_children(s, deadline) > 0) {
+    for (size_t i = list->count; i-- > 0;) {
+      struct Child *c = &list->items[i];
+      if (child_done(c))
+        continue;
+      fprintf(stderr, "Killing %s (pid %d) after %dms\n", c->name, c->pid,
+              timeout_ms);
+      signal_child(c, SIGKILL);
+      (*killed)++;
+    }
+    wait_children(s, now_ms() + SUPERVISE_KILL_GRACE_MS);
+  }
+
+  return stopped;
+}
+
+/**
+ * Binds the control socket, unless another supervisor owns it
+ * @return Listening socket, -1 on error
+ */
+static int ctl_listen(void) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (runtime_path(SUPERVISE_CTL, addr.sun_path, sizeof(addr.sun_path)) != 0)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "Another supervisor owns %s\n", addr.sun_path);
+    close(fd);
+    return -1;
+  }
+
+  unlink(addr.sun_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 4) != 0) {
+    perror(addr.sun_path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* A control connection whose request has not fully arrived yet */
+struct CtlClient {
+  struct Session *s;
+  struct ReactorSource *watch, *timer;
+  char msg[8];
+  size_t len;
+  struct CtlClient *next;
+};
+
+/**
+ * Forgets a control connection
+ * @param c Connection, freed
+ * @param keep_fd Leave its socket open, it awaits the teardown reply
+ */
+static void ctl_client_drop(struct CtlClient *c, int keep_fd) {
+  struct CtlClient **p = &c->s->ctl_clients;
+  while (*p != c)
+    p = &(*p)->next;
+  *p = c->next;
+
+  c->watch->owned = !keep_fd;
+  reactor_remove(c->watch);
+  if (c->timer)
+    reactor_remove(c->timer);
+  free(c);
+}
+
+/**
+ * Takes what a control connection sent. The request may arrive in
+ * pieces; anything but "stop", optionally followed by a newline, drops
+ * the connection, as does the peer closing it first.
+ */
+static void on_ctl_client(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct CtlClient *c = src->data;
+  struct Session *s = c->s;
+
+  ssize_t n = recv(src->fd, c->msg + c->len, sizeof(c->msg) - c->len, 0);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n <= 0) {
+    ctl_client_drop(c, 0);
+    return;
+  }
+  c->len += n;
+
+  size_t cmp = c->len < 4 ? c->len : 4;
+  if (memcmp(c->msg, "stop", cmp) != 0 ||
+      (c->len > 4 && (c->len > 5 || c->msg[4] != '\n'))) {
+    ctl_client_drop(c, 0);
+    return;
+  }
+  if (c->len < 4)
+    return;
+
+  int fd = src->fd;
+  ctl_client_drop(c, 1);
+  if (s->ctl_client >= 0)
+    close(fd); // already stopping
+  else
+    s->ctl_client = fd;
+  s->stopping = 1;
+  s->reactor.stop = 1;
+}
+
+/**
+ * Drops a control connection that did not send its request in time
+ */
+static void on_ctl_timeout(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  struct CtlClient *c = src->data;
+  c->timer = NULL;
+  reactor_remove(src);
+  ctl_client_drop(c, 0);
+}
+
+/**
+ * Accepts a control connection from this user and watches it in the
+ * session reactor, so that a peer that connects and sends nothing holds
+ * up neither the supervisor nor its teardown
+ */
+static void on_ctl(struct ReactorSource *src, uint32_t events) {
+  (void)events;
+  struct Session *s = src->data;
+  int fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+      cred.uid != geteuid()) {
+    close(fd);
+    return;
+  }
+
+  struct CtlClient *c = calloc(1, sizeof(*c));
+  if (!c) {
+    perror("calloc");
+    exit(1);
+  }
+  c->s = s;
+  c->watch = reactor_add(&s->reactor, fd, 1, on_ctl_client, c);
+  if (!c->watch) {
+    free(c);
+    return;
+  }
+  c->timer = reactor_timer(&s->reactor, on_ctl_timeout, c);
+  if (c->timer)
+    reactor_timer_set(c->timer, now_ms() + SUPERVISE_CTL_TIMEOUT_MS);
+  c->next = s->ctl_clients;
+  s->ctl_clients = c;
+}
+
+static void on_stop_signal(struct ReactorSource *src, uint32_t signo) {
+  struct Session *s = src->data;
+  if (!s->stopping)
+    printf("Received signal %u, stopping session\n", signo);
+  s->stopping = 1;
+  src->reactor->stop = 1;
+}
+
+/**
+ * Blocks SIGTERM, SIGINT and SIGHUP and has them set the stop flag of
+ * the session through its reactor, so that a stopped launcher still
+ * releases the startup boost and saves its history on the way out
+ * @param s Session
+ * @return 0 on success, -1 if the signals can't be watched
+ */
+int session_stop_signals(struct Session *s) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGHUP);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+
+  if (!reactor_signals(&s->reactor, &mask, on_stop_signal, s)) {
+    perror("signalfd");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Prepares supervise mode before anything is launched: stop signals are
+ * blocked and arrive through the session reactor, the control socket
+ * takes stop requests, and orphaned helpers of the applications are
+ * reparented to the launcher for reaping. Stop requests thus cut the
+ * launch and the crash window short, too.
+ * @param s Session
+ * @return 0 on success, -1 if stop signals can't be watched
+ */
+int supervise_begin(struct Session *s) {
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+  if (session_stop_signals(s) != 0)
+    return -1;
+
+  int fd = ctl_listen();
+  if (fd >= 0)
+    s->ctl = reactor_add(&s->reactor, fd, 1, on_ctl, s);
+  return 0;
+}
+
+/**
+ * Advances the reclaim in progress by one memory.reclaim chunk
+ * @return 1 if a reclaim is in progress, 0 if none, -1 on error
+ */
+static int reclaim_step(struct Session *s, long now) {
+  struct ChildList *list = &s->children;
+  for (size_t i = 0; i < list->count; i++) {
+    struct Child *c = &list->items[i];
+    if (!c->reclaiming)
+      continue;
+
+    int more = c->exited ? 0
+                         : reclaim_cgroup_step(s->reclaim_cgroup, c->pid,
+                                               &c->reclaim_left_kb,
+                                               &c->reclaim_freed_kb);
+    if (more < 0)
+      return -1;
+    if (!more) {
+      c->reclaiming = 0;
+      c->reclaimed = 1;
+      printf("Reclaimed %ld kB of %s after %lds idle\n", c->reclaim_freed_kb,
+             c->name, (now - c->idle_since_ms) / 1000);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Checks the background children for idleness and pages out the ones
+ * whose session used less than 1% of a CPU for reclaim_idle seconds.
+ * Each tick does a bounded amount of work: one memory.reclaim chunk of
+ * the application being reclaimed, or one process_madvise() pass, so
+ * that the reactor stays responsive to stop requests.
+ */
+static void on_reclaim_tick(struct ReactorSource *src, uint32_t expirations) {
+  (void)expirations;
+  struct Session *s = src->data;
+  struct ChildList *list = &s->children;
+  long now = now_ms();
+
+  int busy = *s->reclaim_cgroup ? reclaim_step(s, now) : 0;
+  if (busy < 0) {
+    perror("memory.reclaim");
+    reactor_remove(src);
+    return;
+  }
+
+  size_t count = 0;
+  pid_t *sessions = calloc(list->count + 1, sizeof(*sessions));
+  long *cpu = malloc((list->count + 1) * sizeof(*cpu));
+  struct Child **waiting = malloc((list->count + 1) * sizeof(*waiting));
+  if (!sessions || !cpu || !waiting) {
+    perror("malloc");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < list->count; i++) {
+    struct Child *c = &list->items[i];
+    if (!c->exited && c->background && !c->reclaimed && !c->reclaiming) {
+      waiting[count] = c;
+      sessions[count++] = c->pid;
+    }
+  }
+  session_cpu_ms(sessions, count, cpu);
+
+  size_t left = 0;
+  for (size_t i = 0; i < count; i++) {
+    struct Child *c = waiting[i];
+    long idle = now - c->idle_since_ms;
+
+    if (cpu[i] - c->idle_cpu_ms > idle / 100) {
+      c->idle_cpu_ms = cpu[i];
+      c->idle_since_ms = now;
+    } else if (idle >= s->cfg.reclaim_idle_s * 1000L && !busy) {
+      // One application at a time, the others stay idle meanwhile
+      busy = 1;
+      if (*s->reclaim_cgroup) {
+        c->reclaiming = 1;
+        c->reclaim_left_kb = -1;
+        c->reclaim_freed_kb = 0;
+        continue;
+      }
+      long freed = reclaim_session(c->pid);
+      if (freed < 0) {
+        perror("process_madvise (reclaim needs CAP_SYS_NICE)");
+        busy = 0;
+        left = 0;
+        break;
+      }
+      c->reclaimed = 1;
+      printf("Reclaimed %ld kB of %s after %lds idle\n", freed, c->name,
+             idle / 1000);
+      continue;
+    }
+    left++;
+  }
+
+  free(sessions);
+  free(cpu);
+  free(waiting);
+  if (left || busy)
+    reactor_timer_set(src, now + RECLAIM_TICK_MS);
+  else
+    reactor_remove(src);
+}
+
+/**
+ * Keeps the launcher alive after launching: reaps exiting children and
+ * tears the session down on SIGTERM, SIGINT, SIGHUP or a stop request.
+ * Expects supervise_begin() to have run before the launch.
+ * @param s Session with tracked children
+ * @return 0 on success
+ */
+int supervise_session(struct Session *s) {
+  // Idle background applications are paged out once
+  if (s->cfg.reclaim_idle_s > 0) {
+    struct ReactorSource *tick = reactor_timer(&s->reactor, on_reclaim_tick, s);
+    if (tick)
+      reactor_timer_set(tick, now_ms() + RECLAIM_TICK_MS);
+  }
+
+  printf("Supervising %zu applications (pid %d)\n", s->children.count,
+         getpid());
+  fflush(stdout);
+
+  // Child exits are reaped by their pidfd handlers meanwhile
+  while (!s->stopping)
+    if (reactor_run(&s->reactor) != 0) {
+      perror("epoll_wait");
+      break;
+    }
+
+  // What still runs at the stop request is what the user kept open
+  if (s->cfg.restore != RESTORE_OFF)
+    session_record_alive(s);
+
+  long start = now_ms();
+  int killed;
+  int stopped = session_teardown(s, s->cfg.stop_timeout_ms, &killed);
+  if (*s->reclaim_cgroup)
+    for (size_t i = 0; i < s->children.count; i++)
+      if (s->children.items[i].background)
+        reclaim_cgroup_remove(s->reclaim_cgroup, s->children.items[i].pid);
+
+  char reply[128];
+  snprintf(reply, sizeof(reply),
+           "Stopped %d applications in %ldms, killed %d\n", stopped,
+           now_ms() - start, killed);
+  fputs(reply, stdout);
+  if (s->ctl_client >= 0) {
+    send(s->ctl_client, reply, strlen(reply), MSG_NOSIGNAL);
+    close(s->ctl_client);
+    s->ctl_client = -1;
+  }
+
+  while (s->ctl_clients)
+    ctl_client_drop(s->ctl_clients, 0);
+  if (s->ctl) {
+    struct sockaddr_un addr;
+    if (runtime_path(SUPERVISE_CTL, addr.sun_path, sizeof(addr.sun_path)) == 0)
+      unlink(addr.sun_path);
+    reactor_remove(s->ctl);
+    s->ctl = NULL;
+  }
+  return 0;
+}
+
+/**
+ * Asks the supervising launcher of this user to stop its session and
+ * waits for the teardown to finish
+ * @return 0 on success, -1 if no supervisor is reachable
+ */
+int supervise_stop(void) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (runtime_path(SUPERVISE_CTL, addr.sun_path, sizeof(addr.sun_path)) != 0)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      send(fd, "stop", 4, MSG_NOSIGNAL) != 4) {
+    perror(addr.sun_path);
+    close(fd);
+    return -1;
+  }
+
+  char reply[128];
+  ssize_t n = recv(fd, reply, sizeof(reply) - 1, 0);
+  close(fd);
+  if (n <= 0)
+    return -1;
+
+  reply[n] = '\0';
+  fputs(reply, stdout);
+  return 0;
+}
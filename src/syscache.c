@@ -0,0 +1,214 @@
+#include "syscache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t fnv_mix(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  return h;
+}
+
+/**
+ * Hashes name, size and mtime of every .desktop file of a directory.
+ * Editing a file in place leaves the directory mtime alone, but not this.
+ */
+static uint64_t dir_files_hash(const char *path, uint64_t h) {
+  DIR *dir = opendir(path);
+  if (!dir)
+    return h;
+
+  struct dirent *d;
+  while ((d = readdir(dir)) != NULL) {
+    size_t len = strlen(d->d_name);
+    struct stat st;
+    if (len < 8 || strcmp(d->d_name + len - 8, ".desktop") != 0 ||
+        fstatat(dirfd(dir), d->d_name, &st, 0) != 0)
+      continue;
+
+    // Order independent, readdir() order is not stable
+    int64_t meta[3] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    uint64_t f = fnv_mix(0xcbf29ce484222325ull, d->d_name, len);
+    h += fnv_mix(f, meta, sizeof(meta));
+  }
+  closedir(dir);
+  return h;
+}
+
+/**
+ * Collects the state of the system autostart directories
+ * @param mtimes Output, {sec, nsec} per directory, zero if missing
+ * @return Hash over the .desktop files of all directories
+ */
+static uint64_t system_dir_mtimes(int64_t mtimes[][2]) {
+  uint64_t files = 0;
+  memset(mtimes, 0, sizeof(int64_t[MAX_SYSTEM_DIRS][2]));
+
+  for (int i = 0; system_autostart_dirs[i] && i < MAX_SYSTEM_DIRS; i++) {
+    struct stat st;
+    if (stat(system_autostart_dirs[i], &st) == 0) {
+      mtimes[i][0] = st.st_mtim.tv_sec;
+      mtimes[i][1] = st.st_mtim.tv_nsec;
+      files = dir_files_hash(system_autostart_dirs[i], files + i);
+    }
+  }
+  return files;
+}
+
+static uint32_t system_dir_count(void) {
+  uint32_t n = 0;
+  while (system_autostart_dirs[n] && n < MAX_SYSTEM_DIRS)
+    n++;
+  return n;
+}
+
+/**
+ * Maps the shared cache if it is trustworthy and up to date: owned by
+ * root, not writable by others, same layout version, and directory
+ * mtimes and file hash equal to the current ones. A cache of any other
+ * owner could pass entries off as system entries.
+ * @param cache Cache to fill
+ * @param mtimes Current directory mtimes
+ * @param files Current hash of the directories' files
+ * @return 0 if mapped, -1 otherwise
+ */
+static int syscache_map(struct SysCache *cache, const int64_t mtimes[][2],
+                        uint64_t files) {
+  int fd = open(SYSCACHE_PATH, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_uid != 0 ||
+      (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+      (size_t)st.st_size < sizeof(struct SysCacheHeader)) {
+    close(fd);
+    return -1;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  const struct SysCacheHeader *hdr = map;
+  if (memcmp(hdr->magic, SYSCACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != SYSCACHE_VERSION ||
+      hdr->entry_size != sizeof(struct DesktopEntry) ||
+      hdr->dir_count != system_dir_count() ||
+      memcmp(hdr->mtimes, mtimes, sizeof(hdr->mtimes)) != 0 ||
+      hdr->files != files ||
+      (size_t)st.st_size !=
+          sizeof(*hdr) + (size_t)hdr->count * sizeof(struct DesktopEntry)) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+
+  cache->map = map;
+  cache->map_size = st.st_size;
+  cache->entries.apps = (struct DesktopEntry *)((char *)map + sizeof(*hdr));
+  cache->entries.count = hdr->count;
+  cache->entries.capacity = hdr->count;
+  return 0;
+}
+
+/**
+ * Parses the system directories and drops entries that no user can
+ * launch (Hidden/NoDisplay)
+ * @param cache Cache to fill with heap allocated entries
+ */
+static void syscache_parse(struct SysCache *cache) {
+  struct AppQueue all;
+  app_queue_init(&all);
+  app_queue_init(&cache->entries);
+
+  for (int i = 0; system_autostart_dirs[i]; i++)
+    parse_autostart_dir(system_autostart_dirs[i], &all);
+
+  for (size_t i = 0; i < all.count; i++)
+    if (!all.apps[i].hidden && !all.apps[i].nodisplay)
+      app_queue_add(&cache->entries, all.apps[i]);
+
+  free(all.apps);
+}
+
+/**
+ * Atomically replaces the shared cache file. Fails silently for users
+ * that may not write SYSCACHE_DIR.
+ * @param entries Pre-filtered system entries
+ * @param mtimes Directory mtimes taken before parsing
+ * @param files Hash of the directories' files taken before parsing
+ * @return 0 on success, -1 on failure
+ */
+int syscache_publish(const struct AppQueue *entries, const int64_t mtimes[][2],
+                     uint64_t files) {
+  if (mkdir(SYSCACHE_DIR, 0755) != 0 && errno != EEXIST)
+    return -1;
+
+  char tmp[] = SYSCACHE_PATH ".XXXXXX";
+  int fd = mkstemp(tmp);
+  if (fd < 0)
+    return -1;
+
+  struct SysCacheHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SYSCACHE_MAGIC, sizeof(hdr.magic));
+  hdr.version = SYSCACHE_VERSION;
+  hdr.entry_size = sizeof(struct DesktopEntry);
+  hdr.count = entries->count;
+  hdr.dir_count = system_dir_count();
+  memcpy(hdr.mtimes, mtimes, sizeof(hdr.mtimes));
+  hdr.files = files;
+
+  size_t body = entries->count * sizeof(struct DesktopEntry);
+  int ok = fchmod(fd, 0644) == 0 &&
+           write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+           (body == 0 || write(fd, entries->apps, body) == (ssize_t)body);
+  close(fd);
+
+  if (!ok || rename(tmp, SYSCACHE_PATH) != 0) {
+    unlink(tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Gets the pre-filtered system entries, from the shared cache when it
+ * is valid, otherwise by parsing (and republishing the cache)
+ * @param cache Cache to fill, release with syscache_close()
+ * @return 1 if served from the shared cache, 0 if parsed
+ */
+int syscache_open(struct SysCache *cache) {
+  int64_t mtimes[MAX_SYSTEM_DIRS][2];
+
+  memset(cache, 0, sizeof(*cache));
+  uint64_t files = system_dir_mtimes(mtimes);
+
+  if (syscache_map(cache, mtimes, files) == 0)
+    return 1;
+
+  syscache_parse(cache);
+  syscache_publish(&cache->entries, mtimes, files);
+  return 0;
+}
+
+/**
+ * Releases entries returned by syscache_open()
+ * @param cache Cache to release
+ */
+void syscache_close(struct SysCache *cache) {
+  if (cache->map)
+    munmap(cache->map, cache->map_size);
+  else
+    free(cache->entries.apps);
+  memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "syscalls.h"
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#define SCHED_FLAG_KEEP_ALL 0x18
+#define SCHED_FLAG_UTIL_CLAMP 0x60
+
+/* struct sched_attr of <linux/sched/types.h>, SCHED_ATTR_SIZE_VER1 */
+struct sched_attr_v1 {
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+  uint32_t sched_util_min;
+  uint32_t sched_util_max;
+};
+
+/* struct clone_args of <linux/sched.h>, CLONE_ARGS_SIZE_VER0 */
+struct clone_args_v0 {
+  uint64_t flags;
+  uint64_t pidfd;
+  uint64_t child_tid;
+  uint64_t parent_tid;
+  uint64_t exit_signal;
+  uint64_t stack;
+  uint64_t stack_size;
+  uint64_t tls;
+};
+
+/**
+ * Opens a pidfd referring to a process
+ * @param pid Process id
+ * @param flags pidfd_open() flags
+ * @return pidfd, -1 on error
+ */
+int sys_pidfd_open(pid_t pid, unsigned int flags) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, flags);
+#else
+  (void)pid;
+  (void)flags;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/**
+ * fork()-like clone3() that also returns a pidfd for the child.
+ * Extra clone flags (e.g. CLONE_PARENT) are passed through.
+ * @param flags Additional CLONE_* flags
+ * @param pidfd Receives the child's pidfd in the parent
+ * @return Child pid in the parent, 0 in the child, -1 on error
+ */
+pid_t sys_clone_pidfd(unsigned long flags, int *pidfd) {
+#ifdef SYS_clone3
+  struct clone_args_v0 args;
+  memset(&args, 0, sizeof(args));
+  args.flags = flags | CLONE_PIDFD;
+  args.pidfd = (uint64_t)(uintptr_t)pidfd;
+  // clone3() wants 0 with CLONE_PARENT: the child then gets the exit
+  // signal of the caller, SIGCHLD for the zygote
+  args.exit_signal = (flags & CLONE_PARENT) ? 0 : SIGCHLD;
+  return (pid_t)syscall(SYS_clone3, &args, sizeof(args));
+#else
+  (void)flags;
+  (void)pidfd;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/**
+ * Sends a signal through a pidfd, immune to pid reuse
+ * @param pidfd Process file descriptor
+ * @param sig Signal number
+ * @return 0 on success, -1 on error
+ */
+int sys_pidfd_send_signal(int pidfd, int sig) {
+#ifdef SYS_pidfd_send_signal
+  return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#else
+  (void)pidfd;
+  (void)sig;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/**
+ * Sets the utilization clamps of a task, keeping its policy and nice
+ * @param tid Thread id, 0 for the calling thread
+ * @param min uclamp.min, 0..1024
+ * @param max uclamp.max, 0..1024
+ * @return 0 on success, -1 on error (EOPNOTSUPP without CONFIG_UCLAMP_TASK)
+ */
+int sys_sched_uclamp(pid_t tid, int min, int max) {
+#ifdef SYS_sched_setattr
+  struct sched_attr_v1 attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.sched_flags = SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP;
+  attr.sched_util_min = min;
+  attr.sched_util_max = max;
+  return (int)syscall(SYS_sched_setattr, tid, &attr, 0);
+#else
+  (void)tid;
+  (void)min;
+  (void)max;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/**
+ * Resets the utilization clamps of a task to the system defaults, so that
+ * it follows its cgroup again instead of keeping clamps of its own
+ * @param tid Thread id, 0 for the calling thread
+ * @return 0 on success, -1 on error (EINVAL before Linux 5.11)
+ */
+int sys_sched_uclamp_reset(pid_t tid) {
+#ifdef SYS_sched_setattr
+  struct sched_attr_v1 attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.sched_flags = SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP;
+  attr.sched_util_min = UINT32_MAX; // -1 resets the clamp
+  attr.sched_util_max = UINT32_MAX;
+  return (int)syscall(SYS_sched_setattr, tid, &attr, 0);
+#else
+  (void)tid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/**
+ * Gives memory advice for ranges of another process
+ * @param pidfd Target process
+ * @param iov Address ranges in the target
+ * @param count Number of ranges, at most IOV_MAX
+ * @param advice MADV_* advice
+ * @return Bytes advised, -1 on error
+ */
+ssize_t sys_process_madvise(int pidfd, const struct iovec *iov, size_t count,
+                            int advice) {
+#ifdef SYS_process_madvise
+  return syscall(SYS_process_madvise, pidfd, iov, count, advice, 0);
+#else
+  (void)pidfd;
+  (void)iov;
+  (void)count;
+  (void)advice;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/**
+ * Opens a performance counter
+ * @param attr Event description
+ * @param pid Process to count, with its future threads if attr->inherit
+ * @param cpu CPU to count on, -1 for any
+ * @param group Group leader fd, -1 for none
+ * @param flags PERF_FLAG_* flags
+ * @return Counter fd, -1 on error
+ */
+int sys_perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+                        int group, unsigned long flags) {
+#ifdef SYS_perf_event_open
+  return (int)syscall(SYS_perf_event_open, attr, pid, cpu, group, flags);
+#else
+  (void)attr;
+  (void)pid;
+  (void)cpu;
+  (void)group;
+  (void)flags;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
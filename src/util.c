@@ -1,7 +1,19 @@
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "util.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTIL_X86 1
+#endif
+
 /**
  * Removes leading and trailing whitespace from a string
  * @param str String to trim (modified in place)
@@ -50,3 +62,394 @@ void remove_desktop_specifiers(char *cmd) {
   }
   *dst = '\0';
 }
+
+/**
+ * Extracts the program name of an Exec line: the basename of its first
+ * word, without surrounding quotes
+ * @param exec Exec line
+ * @param buf Output buffer
+ * @param size Size of buf
+ */
+void exec_basename(const char *exec, char *buf, size_t size) {
+  while (isspace((unsigned char)*exec))
+    exec++;
+
+  char quote = 0;
+  if (*exec == '"' || *exec == '\'')
+    quote = *exec++;
+
+  const char *start = exec, *end = exec;
+  while (*end && (quote ? *end != quote : !isspace((unsigned char)*end))) {
+    if (*end == '/')
+      start = end + 1;
+    end++;
+  }
+
+  size_t len = end - start;
+  if (len >= size)
+    len = size - 1;
+  memcpy(buf, start, len);
+  buf[len] = '\0';
+}
+
+/**
+ * Scalar fallback of the line scanner
+ * @param p Buffer
+ * @param len Bytes to scan
+ * @param stop Byte that ends the scan besides '\n'
+ * @return Offset of the first '\n' or stop byte, len if none
+ */
+static size_t scan_scalar(const char *p, size_t len, char stop) {
+  for (size_t i = 0; i < len; i++)
+    if (p[i] == '\n' || p[i] == stop)
+      return i;
+  return len;
+}
+
+#ifdef UTIL_X86
+__attribute__((target("sse2"))) static size_t
+scan_sse2(const char *p, size_t len, char stop) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i st = _mm_set1_epi8(stop);
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    unsigned mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, st)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + scan_scalar(p + i, len - i, stop);
+}
+
+// Not dispatched, see scan(); make bench and make check still run it
+__attribute__((target("avx2"), unused)) static size_t
+scan_avx2(const char *p, size_t len, char stop) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i st = _mm256_set1_epi8(stop);
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    unsigned mask = _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, st)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + scan_scalar(p + i, len - i, stop);
+}
+#endif
+
+/**
+ * Finds the first '\n' or stop byte, with SSE2 where the CPU has it
+ * (checked on first use). AVX2 is not used: .desktop and config lines
+ * are short, the first block mostly holds the hit, and the wider loads
+ * scan fewer bytes per cycle than SSE2 in make bench.
+ */
+static size_t scan(const char *p, size_t len, char stop) {
+  static size_t (*impl)(const char *, size_t, char);
+
+  if (!impl) {
+    impl = scan_scalar;
+#ifdef UTIL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+      impl = scan_sse2;
+#endif
+  }
+  return impl(p, len, stop);
+}
+
+/**
+ * Reads a whole file for tokenizing
+ * @param t Tokenizer to initialize
+ * @param path File to read
+ * @param flags TokenizerFlags. With TOKENIZER_REGULAR a FIFO or device
+ *        neither blocks the open nor is read.
+ * @return 0 on success, -1 on error (errno set: EINVAL for a file that
+ *         is not regular, EFBIG beyond TOKENIZER_MAX_SIZE, ELOOP for a
+ *         symbolic link)
+ */
+int tokenizer_open(struct Tokenizer *t, const char *path, int flags) {
+  memset(t, 0, sizeof(*t));
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC |
+                          (flags & TOKENIZER_REGULAR ? O_NONBLOCK : 0) |
+                          (flags & TOKENIZER_NOFOLLOW ? O_NOFOLLOW : 0));
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  size_t max = (size_t)-1;
+  if (flags & TOKENIZER_REGULAR) {
+    max = TOKENIZER_MAX_SIZE;
+    if (!S_ISREG(st.st_mode) || (size_t)st.st_size > max) {
+      close(fd);
+      errno = S_ISREG(st.st_mode) ? EFBIG : EINVAL;
+      return -1;
+    }
+  }
+
+  // st_size is a hint only (procfs, growing files): read until EOF
+  size_t cap = st.st_size > 0 ? (size_t)st.st_size + 1 : 4096;
+  t->buf = malloc(cap);
+  if (!t->buf) {
+    close(fd);
+    return -1;
+  }
+
+  for (;;) {
+    if (t->len + 1 >= cap) {
+      char *tmp = realloc(t->buf, cap * 2);
+      if (!tmp) {
+        tokenizer_close(t);
+        close(fd);
+        return -1;
+      }
+      t->buf = tmp;
+      cap *= 2;
+    }
+
+    ssize_t n = read(fd, t->buf + t->len, cap - t->len - 1);
+    if (n < 0 || t->len + n > max) {
+      if (n >= 0)
+        errno = EFBIG; // grew since the fstat()
+      tokenizer_close(t);
+      close(fd);
+      return -1;
+    }
+    if (n == 0)
+      break;
+    t->len += n;
+  }
+
+  close(fd);
+  t->buf[t->len] = '\0';
+  return 0;
+}
+
+void tokenizer_close(struct Tokenizer *t) {
+  free(t->buf);
+  t->buf = NULL;
+  t->len = t->pos = 0;
+}
+
+/**
+ * Terminates and trims the span [start, end) in place
+ * @return Trimmed span
+ */
+static char *span(char *start, char *end) {
+  while (start < end && is_space(*start))
+    start++;
+  while (end > start && is_space(end[-1]))
+    end--;
+  *end = '\0';
+  return start;
+}
+
+/**
+ * Returns the next meaningful line of the file in a single pass over the
+ * buffer. Empty lines and # comments are skipped; key and value are
+ * trimmed and NUL terminated in place, valid until tokenizer_close().
+ * @param t Tokenizer
+ * @param tok Receives the line
+ * @return Type of the line, TOKEN_END at the end of the file
+ */
+enum TokenType tokenizer_next(struct Tokenizer *t, struct Token *tok) {
+  memset(tok, 0, sizeof(*tok));
+
+  while (t->pos < t->len) {
+    char *line = t->buf + t->pos;
+    size_t left = t->len - t->pos;
+    t->line++;
+
+    // One scan finds the first '=' or the end of the line
+    size_t sep = scan(line, left, '=');
+    size_t eol = sep;
+    if (sep < left && line[sep] == '=')
+      eol = sep + 1 + scan(line + sep + 1, left - sep - 1, '\n');
+    else
+      sep = eol;
+
+    t->pos += eol < left ? eol + 1 : left;
+
+    char *p = line;
+    while (p < line + eol && is_space(*p))
+      p++;
+    if (p == line + eol || *p == '#')
+      continue;
+
+    tok->line = t->line;
+    tok->text = line;
+    if (*p == '[') {
+      char *close = memchr(p, ']', line + eol - p);
+      tok->type = TOKEN_SECTION;
+      tok->key = span(p + 1, close ? close : line + eol);
+    } else if (sep < eol) {
+      tok->type = TOKEN_PAIR;
+      tok->key = span(p, line + sep);
+      tok->value = span(line + sep + 1, line + eol);
+    } else {
+      tok->type = TOKEN_LINE;
+      tok->key = span(p, line + eol);
+    }
+    return tok->type;
+  }
+
+  return TOKEN_END;
+}
+
+/**
+ * Builds the path of a per-user runtime file: $XDG_RUNTIME_DIR/NAME, or
+ * /tmp/NAME.UID without a runtime directory
+ * @param name File name
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @return 0 on success, -1 if the path does not fit
+ */
+int runtime_path(const char *name, char *buf, size_t size) {
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  int n;
+
+  if (runtime && *runtime)
+    n = snprintf(buf, size, "%s/%s", runtime, name);
+  else
+    n = snprintf(buf, size, "/tmp/%s.%u", name, (unsigned)geteuid());
+  return n >= 0 && (size_t)n < size ? 0 : -1;
+}
+
+/**
+ * Writes a whole buffer to a descriptor
+ * @return 0 on success, -1 on error
+ */
+int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * Reads what a non-blocking pipe holds into a buffer grown as needed
+ * @param fd Pipe
+ * @param buf Buffer, reallocated
+ * @param len Bytes in the buffer
+ * @param capacity Size of the buffer
+ * @return 0 once the pipe is drained for now, 1 at EOF or on error,
+ *         running out of memory included
+ */
+int read_pending(int fd, char **buf, size_t *len, size_t *capacity) {
+  for (;;) {
+    if (*len == *capacity) {
+      size_t grown = *capacity ? *capacity * 2 : 16384;
+      char *tmp = realloc(*buf, grown);
+      if (!tmp) {
+        perror("realloc");
+        return 1;
+      }
+      *buf = tmp;
+      *capacity = grown;
+    }
+
+    ssize_t n = read(fd, *buf + *len, *capacity - *len);
+    if (n > 0) {
+      *len += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return 0;
+    return 1; // EOF or error
+  }
+}
+
+/**
+ * Reads the session and the CPU time of a process from /proc
+ * @param pid Process
+ * @param session Receives the session id, may be NULL
+ * @param cpu_ms Receives user plus system time in ms, may be NULL
+ * @return 0 on success, -1 if the process is gone
+ */
+int proc_stat(pid_t pid, pid_t *session, long *cpu_ms) {
+  char path[64], buf[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+  char *p = fgets(buf, sizeof(buf), f) ? strrchr(buf, ')') : NULL;
+  fclose(f);
+
+  // comm may hold spaces, the fields after it start behind the last ')'
+  int sid;
+  unsigned long utime, stime;
+  long ticks = sysconf(_SC_CLK_TCK);
+  if (!p || ticks <= 0 ||
+      sscanf(p + 1, " %*c %*d %*d %d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &sid, &utime, &stime) != 3)
+    return -1;
+
+  if (session)
+    *session = sid;
+  if (cpu_ms)
+    *cpu_ms = (long)((utime + stime) * 1000 / ticks);
+  return 0;
+}
+
+/**
+ * Calls fn for every process of the user in one of the sessions, with
+ * one walk over /proc
+ * @param sessions Session ids
+ * @param count Number of sessions
+ * @param fn Called with the pid and the index of its session
+ * @param data Passed to fn
+ * @return 0 on success, the first non-zero result of fn otherwise
+ */
+int proc_session_walk(const pid_t *sessions, size_t count,
+                      int (*fn)(pid_t pid, size_t session, void *data),
+                      void *data) {
+  DIR *dir = opendir("/proc");
+  if (!dir)
+    return 0;
+
+  int proc_fd = dirfd(dir);
+  uid_t uid = geteuid();
+  int ret = 0;
+  struct dirent *d;
+
+  while (!ret && (d = readdir(dir)) != NULL) {
+    if (!isdigit((unsigned char)d->d_name[0]))
+      continue;
+
+    struct stat st;
+    if (fstatat(proc_fd, d->d_name, &st, 0) != 0 || st.st_uid != uid)
+      continue;
+
+    pid_t pid = atoi(d->d_name), session;
+    if (proc_stat(pid, &session, NULL) != 0)
+      continue;
+    for (size_t i = 0; i < count; i++) {
+      if (sessions[i] == session) {
+        ret = fn(pid, i, data);
+        break;
+      }
+    }
+  }
+
+  closedir(dir);
+  return ret;
+}
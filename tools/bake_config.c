@@ -0,0 +1,129 @@
+/**
+ * bake_config.c
+ *
+ * Turns a config.conf into config_baked.h, a header holding the whole
+ * configuration as a constant struct Config with duplicate application
+ * rules dropped, drop-ins of the config.d directory included. Builds
+ * with BAKED_CONFIG=... compile it in and never read or parse a config
+ * file at runtime; only the rule index and the pattern matchers are
+ * still built at startup.
+ *
+ * Usage: bake-config CONFIG > config_baked.h
+ */
+
+#include "config.h"
+#include <stdio.h>
+
+/**
+ * Prints a C string literal, escaping everything that is not plain text
+ * @param s String to print
+ */
+static void print_str(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20 || c >= 0x7f)
+      printf("\\%03o", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+static void print_field_str(const char *field, const char *value) {
+  printf("    .%s = ", field);
+  print_str(value);
+  printf(",\n");
+}
+
+static void print_app(const struct AppRule *app) {
+  printf("    {.name = ");
+  print_str(app->name);
+  printf(", .kind = %d, .field = %d", app->kind, app->field);
+  printf(", .allow = %d, .delay_ms = %d, .nice = %d, .dbus = %d",
+         app->allow, app->delay_ms, app->nice, app->dbus);
+  printf(", .critical = %d, .ksm = %d, .always = %d", app->critical, app->ksm,
+         app->always);
+  printf(", .env_count = %d", app->env_count);
+  if (app->env_count) {
+    printf(", .env = {");
+    for (int i = 0; i < app->env_count; i++) {
+      print_str(app->env[i]);
+      printf(i + 1 < app->env_count ? ", " : "}");
+    }
+  }
+  printf("},\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s CONFIG > config_baked.h\n", argv[0]);
+    return 1;
+  }
+
+  static struct Config cfg;
+  config_init(&cfg);
+  if (config_load(&cfg, argv[1]) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  printf("/* Generated by bake-config from %s, do not edit */\n", argv[1]);
+  printf("#ifndef CONFIG_BAKED_H\n#define CONFIG_BAKED_H\n\n");
+
+  // Rule arrays are not owned by the config, it never frees them
+  if (cfg.app_count) {
+    printf("static struct AppRule baked_apps[] = {\n");
+    for (int i = 0; i < cfg.app_count; i++)
+      print_app(&cfg.apps[i]);
+    printf("};\n\n");
+  }
+  if (cfg.dir_count) {
+    printf("static struct DirRule baked_dirs[] = {\n");
+    for (int i = 0; i < cfg.dir_count; i++) {
+      printf("    {.path = ");
+      print_str(cfg.dirs[i].path);
+      printf(", .allow = %d},\n", cfg.dirs[i].allow);
+    }
+    printf("};\n\n");
+  }
+
+  printf("static const struct Config baked_config = {\n");
+  printf("    .startup_delay_ms = %d,\n", cfg.startup_delay_ms);
+  printf("    .delay_ms = %d,\n", cfg.delay_ms);
+  printf("    .prefetch = %d,\n", cfg.prefetch);
+  printf("    .system_cache = %d,\n", cfg.system_cache);
+  printf("    .skip_running = %d,\n", cfg.skip_running);
+  printf("    .stop_timeout_ms = %d,\n", cfg.stop_timeout_ms);
+  printf("    .scan_timeout_ms = %d,\n", cfg.scan_timeout_ms);
+  printf("    .quarantine = %d,\n", cfg.quarantine);
+  printf("    .quarantine_after = %d,\n", cfg.quarantine_after);
+  printf("    .quarantine_retry_s = %d,\n", cfg.quarantine_retry_s);
+  printf("    .restore = %d,\n", cfg.restore);
+  printf("    .crash_window_ms = %d,\n", cfg.crash_window_ms);
+  printf("    .dbus_activation = %d,\n", cfg.dbus_activation);
+  printf("    .boost_time_ms = %d,\n", cfg.boost_time_ms);
+  printf("    .background_uclamp = %d,\n", cfg.background_uclamp);
+  printf("    .reclaim_idle_s = %d,\n", cfg.reclaim_idle_s);
+  printf("    .perf_window_ms = %d,\n", cfg.perf_window_ms);
+  print_field_str("icon_theme", cfg.icon_theme);
+  print_field_str("terminal", cfg.terminal);
+  print_field_str("terminal_server", cfg.terminal_server);
+  print_field_str("terminal_client", cfg.terminal_client);
+  printf("    .log_level = %d,\n", cfg.log_level);
+  print_field_str("log_file", cfg.log_file);
+
+  if (cfg.app_count)
+    printf("    .apps = baked_apps,\n");
+  printf("    .app_count = %d,\n", cfg.app_count);
+
+  if (cfg.dir_count)
+    printf("    .dirs = baked_dirs,\n");
+  printf("    .dir_count = %d,\n", cfg.dir_count);
+  printf("};\n\n#endif\n");
+
+  config_free(&cfg);
+  return 0;
+}
@@ -0,0 +1,152 @@
+/**
+ * bench_config.c
+ *
+ * Measures config_load() on a generated rule set the size fleet
+ * management produces: a config file plus four drop-ins in its .d
+ * directory, mostly exact [apps] rules with a glob pattern every 100.
+ * Each iteration loads, deduplicates and indexes the whole set from the
+ * page cache and frees it again. Page faults are reported too: on
+ * virtual machines they can cost more than the parsing itself.
+ *
+ * Usage: bench-config [RULES] [ITERATIONS]
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DROPINS 4
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_ns(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Writes rules [first, last) as an [apps] section
+ */
+static void write_rules(FILE *f, int first, int last) {
+  fprintf(f, "[apps]\n");
+  for (int i = first; i < last; i++) {
+    if (i % 100 == 99)
+      fprintf(f, "exec:glob:fleet-tool-%d-*=delay:%d,nice:5\n", i, i % 997);
+    else
+      fprintf(f, "fleet-app-%d=allow:%d,delay:%d,env:FLEET_ID=%d\n", i,
+              i % 7 != 0, i % 997, i);
+  }
+}
+
+/**
+ * Generates the rule set in a temporary directory
+ * @param dir Temporary directory
+ * @param rules Number of rules
+ * @return 0 on success, -1 on error
+ */
+static int generate(const char *dir, int rules) {
+  char path[4096];
+  int per_file = rules / (BENCH_DROPINS + 1);
+
+  snprintf(path, sizeof(path), "%s/bench.conf", dir);
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return -1;
+  fprintf(f, "[general]\ndelay=100\nprefetch=1\n\n");
+  write_rules(f, 0, per_file);
+  fclose(f);
+
+  snprintf(path, sizeof(path), "%s/bench.d", dir);
+  if (mkdir(path, 0700) != 0)
+    return -1;
+  for (int d = 0; d < BENCH_DROPINS; d++) {
+    snprintf(path, sizeof(path), "%s/bench.d/%02d-fleet.conf", dir, d * 10);
+    f = fopen(path, "w");
+    if (!f)
+      return -1;
+    int first = per_file * (d + 1);
+    write_rules(f, first, d + 1 == BENCH_DROPINS ? rules : first + per_file);
+    fclose(f);
+  }
+  return 0;
+}
+
+static void cleanup(const char *dir) {
+  char path[4096];
+  for (int d = 0; d < BENCH_DROPINS; d++) {
+    snprintf(path, sizeof(path), "%s/bench.d/%02d-fleet.conf", dir, d * 10);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/bench.d", dir);
+  rmdir(path);
+  snprintf(path, sizeof(path), "%s/bench.conf", dir);
+  unlink(path);
+  rmdir(dir);
+}
+
+int main(int argc, char **argv) {
+  int rules = argc > 1 ? atoi(argv[1]) : 10000;
+  int iterations = argc > 2 ? atoi(argv[2]) : 200;
+  if (rules <= 0 || iterations <= 0) {
+    fprintf(stderr, "Usage: %s [RULES] [ITERATIONS]\n", argv[0]);
+    return 1;
+  }
+
+  char dir[] = "/tmp/bench-config.XXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  if (generate(dir, rules) != 0) {
+    perror(dir);
+    cleanup(dir);
+    return 1;
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/bench.conf", dir);
+  long long *ns = malloc(iterations * sizeof(*ns));
+  if (!ns) {
+    perror("malloc");
+    exit(1);
+  }
+
+  static struct Config cfg;
+  struct rusage before, after;
+  int loaded = 0;
+  getrusage(RUSAGE_SELF, &before);
+  for (int i = 0; i < iterations; i++) {
+    config_init(&cfg);
+    long long start = now_ns();
+    if (config_load(&cfg, path) != 0) {
+      perror(path);
+      cleanup(dir);
+      return 1;
+    }
+    ns[i] = now_ns() - start;
+    loaded = cfg.app_count;
+    config_free(&cfg);
+  }
+  getrusage(RUSAGE_SELF, &after);
+  cleanup(dir);
+
+  qsort(ns, iterations, sizeof(*ns), compare_ns);
+  printf("config_load: %d rules in %d files, %d iterations\n", loaded,
+         BENCH_DROPINS + 1, iterations);
+  printf("  min %.1f us, median %.1f us, p95 %.1f us\n", ns[0] / 1e3,
+         ns[iterations / 2] / 1e3, ns[iterations * 95 / 100] / 1e3);
+  printf("  %ld page faults per load\n",
+         (after.ru_minflt - before.ru_minflt) / iterations);
+  free(ns);
+  return 0;
+}
@@ -0,0 +1,245 @@
+/**
+ * bench_tokenizer.c
+ *
+ * Measures the line tokenizer shared by parse_desktop_file() and
+ * config_load() in bytes per cycle, against the fgets(), trim() and
+ * strchr() loop it replaced. The input is a buffer of generated
+ * .desktop entries with translated names, comments and empty lines,
+ * tokenized from memory, so that file I/O does not hide the scan.
+ *
+ * Besides the dispatched tokenizer, each scanner (scalar, SSE2, AVX2
+ * where the CPU has it) is timed on its own, walking the lines the way
+ * tokenizer_next() does. util.c is included rather than linked for
+ * that, its scanners are static.
+ *
+ * Cycles are read from the time stamp counter on x86; elsewhere the
+ * figures are bytes per nanosecond.
+ *
+ * Usage: bench-tokenizer [KIB] [ITERATIONS]
+ */
+
+#define _GNU_SOURCE
+#include "../src/util.c"
+#include <time.h>
+
+#define BENCH_LINE_MAX 1024 // line limit of the fgets() path
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef UTIL_X86
+#define TICK_UNIT "cycle"
+static long long ticks(void) { return (long long)__rdtsc(); }
+#else
+#define TICK_UNIT "ns"
+static long long ticks(void) { return now_ns(); }
+#endif
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Generates .desktop entries until size bytes are filled
+ * @param size Bytes to generate
+ * @param len Receives the length, which is at most size
+ * @return NUL terminated buffer
+ */
+static char *generate(size_t size, size_t *len) {
+  static const char *const langs[] = {"de", "fr", "es", "it", "ja", "pt_BR"};
+  char *buf = malloc(size + 1);
+  char entry[2048];
+  if (!buf) {
+    perror("malloc");
+    exit(1);
+  }
+
+  *len = 0;
+  for (int i = 0;; i++) {
+    int n = snprintf(entry, sizeof(entry),
+                     "# Generated entry %d\n"
+                     "[Desktop Entry]\n"
+                     "Type=Application\n"
+                     "Name=Bench Application %d\n",
+                     i, i);
+    for (size_t l = 0; l < sizeof(langs) / sizeof(*langs); l++)
+      n += snprintf(entry + n, sizeof(entry) - n,
+                    "Name[%s] = Bench Application %d (%s)\n", langs[l], i,
+                    langs[l]);
+    n += snprintf(entry + n, sizeof(entry) - n,
+                  "Comment=Starts the benchmark application number %d at "
+                  "login\n"
+                  "Exec=/usr/libexec/bench/app-%d --session --no-splash %%U\n"
+                  "Icon=bench-app-%d\n"
+                  "OnlyShowIn=GNOME;KDE;XFCE;\n"
+                  "X-GNOME-Autostart-Delay=%d\n"
+                  "\n"
+                  "[Desktop Action new-window]\n"
+                  "Name=New Window\n"
+                  "Exec=/usr/libexec/bench/app-%d --new-window\n"
+                  "\n",
+                  i, i, i, i % 30, i);
+    if (*len + n > size)
+      break;
+    memcpy(buf + *len, entry, n);
+    *len += n;
+  }
+  buf[*len] = '\0';
+  return buf;
+}
+
+/**
+ * Tokenizes the buffer like the parsers do
+ * @return Number of key=value pairs, so that the work is not dropped
+ */
+static size_t run_tokenizer(char *buf, size_t len) {
+  struct Tokenizer t = {.buf = buf, .len = len};
+  struct Token tok;
+  size_t pairs = 0;
+  while (tokenizer_next(&t, &tok) != TOKEN_END)
+    pairs += tok.type == TOKEN_PAIR;
+  return pairs;
+}
+
+/**
+ * Walks the lines with one scanner, as tokenizer_next() does: up to the
+ * first '=', then to the end of the line
+ */
+static size_t run_scanner(size_t (*impl)(const char *, size_t, char),
+                          char *buf, size_t len) {
+  size_t pairs = 0;
+  for (size_t pos = 0; pos < len;) {
+    const char *line = buf + pos;
+    size_t left = len - pos;
+    size_t eol = impl(line, left, '=');
+    if (eol < left && line[eol] == '=') {
+      eol += 1 + impl(line + eol + 1, left - eol - 1, '\n');
+      pairs++;
+    }
+    pos += eol < left ? eol + 1 : left;
+  }
+  return pairs;
+}
+
+/**
+ * The loop the parsers ran before the tokenizer: fgets(), trim() and
+ * strchr() for '=' on every line
+ */
+static size_t run_fgets(char *buf, size_t len) {
+  FILE *f = fmemopen(buf, len, "r");
+  if (!f) {
+    perror("fmemopen");
+    exit(1);
+  }
+
+  char line[BENCH_LINE_MAX];
+  size_t pairs = 0;
+  while (fgets(line, sizeof(line), f)) {
+    char *trimmed = trim(line);
+    if (trimmed[0] == '#' || trimmed[0] == 0)
+      continue;
+    if (trimmed[0] == '[')
+      continue;
+    char *sep = strchr(trimmed, '=');
+    if (!sep)
+      continue;
+    *sep = '\0';
+    trim(trimmed);
+    trim(sep + 1);
+    pairs++;
+  }
+  fclose(f);
+  return pairs;
+}
+
+enum BenchKind { BENCH_TOKENIZER, BENCH_SCANNER, BENCH_FGETS };
+
+/**
+ * Times one path and prints its median bytes per cycle
+ * @param name Label
+ * @param kind Path to time
+ * @param impl Scanner for BENCH_SCANNER
+ * @param input Pristine input, the tokenizer terminates spans in place
+ * @param work Scratch copy of the input
+ * @return Pairs found, for cross-checking the paths
+ */
+static size_t bench(const char *name, enum BenchKind kind,
+                    size_t (*impl)(const char *, size_t, char),
+                    const char *input, char *work, size_t len,
+                    int iterations) {
+  long long *cycles = malloc(iterations * sizeof(*cycles));
+  long long *ns = malloc(iterations * sizeof(*ns));
+  if (!cycles || !ns) {
+    perror("malloc");
+    exit(1);
+  }
+
+  size_t pairs = 0;
+  for (int i = 0; i < iterations; i++) {
+    memcpy(work, input, len + 1);
+    long long start_ns = now_ns(), start = ticks();
+    if (kind == BENCH_TOKENIZER)
+      pairs = run_tokenizer(work, len);
+    else if (kind == BENCH_SCANNER)
+      pairs = run_scanner(impl, work, len);
+    else
+      pairs = run_fgets(work, len);
+    cycles[i] = ticks() - start;
+    ns[i] = now_ns() - start_ns;
+  }
+
+  qsort(cycles, iterations, sizeof(*cycles), compare_ll);
+  qsort(ns, iterations, sizeof(*ns), compare_ll);
+  long long median = cycles[iterations / 2];
+  printf("  %-10s %6.2f bytes/%s, %6.2f GB/s, median %.1f us\n", name,
+         (double)len / (median > 0 ? median : 1), TICK_UNIT,
+         (double)len / ns[iterations / 2], ns[iterations / 2] / 1e3);
+  free(cycles);
+  free(ns);
+  return pairs;
+}
+
+int main(int argc, char **argv) {
+  long kib = argc > 1 ? atol(argv[1]) : 1024;
+  int iterations = argc > 2 ? atoi(argv[2]) : 100;
+  if (kib <= 0 || iterations <= 0) {
+    fprintf(stderr, "Usage: %s [KIB] [ITERATIONS]\n", argv[0]);
+    return 1;
+  }
+
+  size_t len;
+  char *input = generate((size_t)kib * 1024, &len);
+  char *work = malloc(len + 1);
+  if (!work) {
+    perror("malloc");
+    exit(1);
+  }
+
+  printf("tokenizer: %zu bytes of .desktop entries, %d iterations\n", len,
+         iterations);
+  size_t pairs = bench("tokenizer", BENCH_TOKENIZER, NULL, input, work, len,
+                       iterations);
+  bench("scalar", BENCH_SCANNER, scan_scalar, input, work, len, iterations);
+#ifdef UTIL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    bench("sse2", BENCH_SCANNER, scan_sse2, input, work, len, iterations);
+  if (__builtin_cpu_supports("avx2"))
+    bench("avx2", BENCH_SCANNER, scan_avx2, input, work, len, iterations);
+#endif
+  size_t fgets_pairs =
+      bench("fgets", BENCH_FGETS, NULL, input, work, len, iterations);
+
+  free(work);
+  free(input);
+  if (pairs != fgets_pairs) {
+    fprintf(stderr, "Paths disagree: %zu pairs tokenized, %zu with fgets\n",
+            pairs, fgets_pairs);
+    return 1;
+  }
+  return 0;
+}
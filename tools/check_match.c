@@ -0,0 +1,209 @@
+/**
+ * check_match.c
+ *
+ * Checks matcher_match() against fnmatch() for globs and regexec() for
+ * regexes, on a corpus of patterns and every string of up to
+ * CHECK_MAX_LEN bytes over an alphabet of their literals and
+ * metacharacters. Each pattern is matched on its own, then all of a
+ * kind together and both kinds in one matcher, where the lowest
+ * matching rule must win as it does in the config.
+ *
+ * The corpus keeps to the syntax both sides define alike: no backslash
+ * inside a class and no empty alternative, which POSIX leaves open.
+ *
+ * Usage: check-match
+ */
+
+#include "match.h"
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_MAX_LEN 4    // generated strings
+#define CHECK_MAX_FAILS 10 // failures printed in full
+
+static const char *const globs[] = {
+    "",      "*",     "?",      "a",          "a*",       "*a",
+    "*a*",   "a?c",   "??",     "[abc]",      "[!abc]",   "[^abc]",
+    "[a-c]*", "[]a]", "[!]a]",  "[a-]b",      "a\\*b",    "\\?",
+    "*.a",   "*.*",   "a*b*c",  "*[0-9]",     "[0-9][0-9]", "*-*",
+    "a.b",   "*a*b*", "[.-]*",  "b[!a-c]*",   "**",       "*?*",
+};
+
+static const char *const regexes[] = {
+    "a",      "abc",      "a|b",       "(ab)*",         "a+b?",
+    ".*",     ".",        "[a-c]+",    "[^a]*",         "a(b|c)*9?",
+    "^abc$",  "a.c",      "\\.",       "a\\..*",        "(a|b)(c|0)",
+    "x?",     "[]a]+",    "[^]a]",     "(a*)*b",        "((a|b)c)+",
+    "[0-9]+", "a*|b*",    ".*-.*",     "^a",            "c$",
+    "(a|ab)(c|bcd)", "[.]*", "a?b+c*", "(..)*",         "[a-]+",
+};
+
+/* Characters of the generated strings: literals and metacharacters of
+ * the corpus */
+static const char alphabet[] = "abc09.-*?]";
+
+static int failures;
+static int cases;
+
+static int glob_matches(const char *pattern, const char *s) {
+  return fnmatch(pattern, s, 0) == 0;
+}
+
+static int regex_matches(const regex_t *re, const char *s) {
+  return regexec(re, s, 0, NULL, 0) == 0;
+}
+
+/**
+ * Compiles the regexes for regexec(), anchored like the matcher
+ * anchors them
+ */
+static void compile_regexes(regex_t *out) {
+  char anchored[128];
+  for (size_t i = 0; i < sizeof(regexes) / sizeof(*regexes); i++) {
+    snprintf(anchored, sizeof(anchored), "^(%s)$", regexes[i]);
+    if (regcomp(&out[i], anchored, REG_EXTENDED | REG_NOSUB) != 0) {
+      fprintf(stderr, "regcomp: %s\n", regexes[i]);
+      exit(1);
+    }
+  }
+}
+
+static struct Matcher *matcher(void) {
+  struct Matcher *m = matcher_new();
+  if (!m) {
+    perror("matcher_new");
+    exit(1);
+  }
+  return m;
+}
+
+static void add(struct Matcher *m, const char *pattern, enum MatchKind kind,
+                int rule) {
+  if (matcher_add(m, pattern, kind, rule) != 0) {
+    fprintf(stderr, "matcher_add: %s\n", pattern);
+    exit(1);
+  }
+}
+
+/**
+ * Compares one string on every matcher
+ * @param single Matchers holding one pattern each, globs then regexes
+ * @param all_globs Every glob, rule = index
+ * @param all_regexes Every regex, rule = index
+ * @param mixed Globs at even rules, regexes at odd ones
+ */
+static void check_string(const char *s, struct Matcher **single,
+                         struct Matcher *all_globs,
+                         struct Matcher *all_regexes, struct Matcher *mixed,
+                         const regex_t *compiled) {
+  int nglobs = sizeof(globs) / sizeof(*globs);
+  int nregexes = sizeof(regexes) / sizeof(*regexes);
+  int first_glob = -1, first_regex = -1, first_mixed = -1;
+
+  for (int i = 0; i < nglobs + nregexes; i++) {
+    int glob = i < nglobs;
+    const char *pattern = glob ? globs[i] : regexes[i - nglobs];
+    int want = glob ? glob_matches(pattern, s)
+                    : regex_matches(&compiled[i - nglobs], s);
+    int got = matcher_match(single[i], s) == i;
+
+    cases++;
+    if (got != want && ++failures <= CHECK_MAX_FAILS)
+      fprintf(stderr, "%s \"%s\" on \"%s\": %s, %s says %s\n",
+              glob ? "glob" : "regex", pattern, s, got ? "match" : "no match",
+              glob ? "fnmatch" : "regexec", want ? "match" : "no match");
+
+    if (!want)
+      continue;
+    int rule = glob ? 2 * i : 2 * (i - nglobs) + 1;
+    if (glob && first_glob < 0)
+      first_glob = i;
+    if (!glob && first_regex < 0)
+      first_regex = i - nglobs;
+    if (first_mixed < 0 || rule < first_mixed)
+      first_mixed = rule;
+  }
+
+  struct {
+    const char *name;
+    struct Matcher *m;
+    int want;
+  } sets[] = {{"globs", all_globs, first_glob},
+              {"regexes", all_regexes, first_regex},
+              {"mixed", mixed, first_mixed}};
+  for (size_t i = 0; i < sizeof(sets) / sizeof(*sets); i++) {
+    int got = matcher_match(sets[i].m, s);
+    cases++;
+    if (got != sets[i].want && ++failures <= CHECK_MAX_FAILS)
+      fprintf(stderr, "%s on \"%s\": rule %d, reference %d\n", sets[i].name,
+              s, got, sets[i].want);
+  }
+}
+
+int main(void) {
+  int nglobs = sizeof(globs) / sizeof(*globs);
+  int nregexes = sizeof(regexes) / sizeof(*regexes);
+  regex_t compiled[sizeof(regexes) / sizeof(*regexes)];
+  struct Matcher *single[sizeof(globs) / sizeof(*globs) +
+                         sizeof(regexes) / sizeof(*regexes)];
+  struct Matcher *all_globs = matcher(), *all_regexes = matcher();
+  struct Matcher *mixed = matcher();
+
+  compile_regexes(compiled);
+  for (int i = 0; i < nglobs; i++) {
+    single[i] = matcher();
+    add(single[i], globs[i], MATCH_GLOB, i);
+    add(all_globs, globs[i], MATCH_GLOB, i);
+    add(mixed, globs[i], MATCH_GLOB, 2 * i);
+  }
+  for (int i = 0; i < nregexes; i++) {
+    single[nglobs + i] = matcher();
+    add(single[nglobs + i], regexes[i], MATCH_REGEX, nglobs + i);
+    add(all_regexes, regexes[i], MATCH_REGEX, i);
+    add(mixed, regexes[i], MATCH_REGEX, 2 * i + 1);
+  }
+
+  // Every string of up to CHECK_MAX_LEN characters of the alphabet,
+  // counting in base sizeof(alphabet) - 1 with digit 0 meaning "none"
+  size_t base = sizeof(alphabet) - 1;
+  size_t digits[CHECK_MAX_LEN] = {0};
+  char s[CHECK_MAX_LEN + 1];
+  for (;;) {
+    size_t n = 0;
+    for (size_t i = 0; i < CHECK_MAX_LEN && digits[i]; i++)
+      s[n++] = alphabet[digits[i] - 1];
+    s[n] = '\0';
+    check_string(s, single, all_globs, all_regexes, mixed, compiled);
+
+    size_t i = 0;
+    while (i < CHECK_MAX_LEN && ++digits[i] > base)
+      digits[i++] = 1;
+    if (i == CHECK_MAX_LEN)
+      break;
+  }
+
+  // Syntax errors are reported, not compiled into something else
+  static const char *const bad[] = {"[abc", "a(b", "a)b", "*a", "a|+"};
+  struct Matcher *m = matcher();
+  for (size_t i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+    cases++;
+    if (matcher_add(m, bad[i], i ? MATCH_REGEX : MATCH_GLOB, 0) == 0 &&
+        ++failures <= CHECK_MAX_FAILS)
+      fprintf(stderr, "\"%s\" compiled, expected a syntax error\n", bad[i]);
+  }
+  matcher_free(m);
+
+  for (int i = 0; i < nglobs + nregexes; i++)
+    matcher_free(single[i]);
+  for (int i = 0; i < nregexes; i++)
+    regfree(&compiled[i]);
+  matcher_free(all_globs);
+  matcher_free(all_regexes);
+  matcher_free(mixed);
+
+  printf("check-match: %d cases, %d failed\n", cases, failures);
+  return failures != 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * check_tokenizer.c
+ *
+ * Checks the line scanners and the tokenizer on the inputs where vector
+ * code goes wrong. Every scanner the CPU has (SSE2, AVX2) must return
+ * what the scalar one does for each length up to three AVX2 blocks, with
+ * the '\n' or stop byte at every position, bytes above 0x7f around it,
+ * and the buffer ending right before a PROT_NONE page, so that a load
+ * past the end faults. The dispatched tokenizer must then split like a
+ * plain line-by-line reference: '=' at every offset around the 16 and
+ * 32 byte blocks, CRLF line ends, no newline at the end of the file.
+ * util.c is included rather than linked, its scanners are static.
+ *
+ * Usage: check-tokenizer
+ */
+
+#define _GNU_SOURCE
+#include "../src/util.c"
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#define CHECK_MAX_LEN 96   // three AVX2 blocks
+#define CHECK_MAX_FAILS 10 // failures printed in full
+
+typedef size_t (*scan_fn)(const char *, size_t, char);
+
+static int failures;
+static int cases;
+
+/**
+ * Returns a buffer whose last byte is followed by an inaccessible page.
+ * There is one, each call hands out its end again.
+ * @param len Bytes the caller needs, at most CHECK_MAX_LEN * 4
+ * @return Start of the len bytes
+ */
+static char *guarded(size_t len) {
+  static char *end;
+
+  if (!end) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (CHECK_MAX_LEN * 4 + page - 1) / page * page + page;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED || mprotect(map + size - page, page, PROT_NONE)) {
+      perror("mmap");
+      exit(1);
+    }
+    end = map + size - page;
+  }
+  return end - len;
+}
+
+static void fail(const char *fmt, ...) {
+  failures++;
+  if (failures > CHECK_MAX_FAILS)
+    return;
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+/**
+ * Compares a scanner with the expected offset on every length, position
+ * and filler
+ */
+static void check_scanner(const char *name, scan_fn impl) {
+  static const char fillers[] = {'a', ' ', '\r', '#', (char)0x80, (char)0xff};
+  static const char stops[] = {'=', '\n'};
+
+  for (size_t len = 0; len <= CHECK_MAX_LEN; len++) {
+    char *p = guarded(len);
+    for (size_t s = 0; s < sizeof(stops); s++)
+      for (size_t f = 0; f < sizeof(fillers); f++)
+        // at == len puts no hit in the buffer
+        for (size_t at = 0; at <= len; at++)
+          for (int n = 0; n < 2; n++) {
+            char hit = n ? '\n' : stops[s];
+            for (size_t i = 0; i < len; i++)
+              p[i] = fillers[(f + i) % sizeof(fillers)];
+            if (at < len)
+              p[at] = hit;
+            // A later hit must not win over the first one
+            if (at + 1 < len)
+              p[len - 1] = n ? stops[s] : '\n';
+
+            cases++;
+            size_t want = scan_scalar(p, len, stops[s]);
+            size_t got = impl(p, len, stops[s]);
+            if (want != at || got != want)
+              fail("%s: len %zu, stop 0x%02x, 0x%02x at %zu: got %zu, "
+                   "scalar %zu\n",
+                   name, len, stops[s], hit, at, got, want);
+          }
+  }
+}
+
+/* One tokenized line, as text for comparing */
+struct Line {
+  enum TokenType type;
+  unsigned line;
+  char key[CHECK_MAX_LEN * 2];
+  char value[CHECK_MAX_LEN * 2];
+};
+
+static void copy_trimmed(char *dst, size_t size, const char *start,
+                         const char *end) {
+  while (start < end && is_space(*start))
+    start++;
+  while (end > start && is_space(end[-1]))
+    end--;
+  size_t n = (size_t)(end - start) < size - 1 ? (size_t)(end - start)
+                                                : size - 1;
+  memcpy(dst, start, n);
+  dst[n] = '\0';
+}
+
+/**
+ * Splits the input line by line with strchr(), the way the format is
+ * specified
+ * @return Number of lines stored in out
+ */
+static size_t reference(const char *text, struct Line *out, size_t max) {
+  size_t n = 0;
+  unsigned number = 0;
+
+  for (const char *line = text; *line && n < max;) {
+    const char *eol = strchr(line, '\n');
+    if (!eol)
+      eol = line + strlen(line);
+    number++;
+
+    const char *p = line, *next = *eol ? eol + 1 : eol;
+    while (p < eol && is_space(*p))
+      p++;
+    if (p == eol || *p == '#') {
+      line = next;
+      continue;
+    }
+
+    const char *sep = memchr(line, '=', eol - line);
+    struct Line *l = &out[n++];
+    memset(l, 0, sizeof(*l));
+    l->line = number;
+    if (*p == '[') {
+      const char *close = memchr(p, ']', eol - p);
+      l->type = TOKEN_SECTION;
+      copy_trimmed(l->key, sizeof(l->key), p + 1, close ? close : eol);
+    } else if (sep) {
+      l->type = TOKEN_PAIR;
+      copy_trimmed(l->key, sizeof(l->key), p, sep);
+      copy_trimmed(l->value, sizeof(l->value), sep + 1, eol);
+    } else {
+      l->type = TOKEN_LINE;
+      copy_trimmed(l->key, sizeof(l->key), p, eol);
+    }
+    line = next;
+  }
+  return n;
+}
+
+/**
+ * Tokenizes the input with tokenizer_next() from a buffer ending at a
+ * PROT_NONE page
+ * @return Number of lines stored in out
+ */
+static size_t tokenize(const char *text, struct Line *out, size_t max) {
+  size_t len = strlen(text);
+  char *buf = guarded(len + 1);
+  memcpy(buf, text, len + 1);
+
+  struct Tokenizer t = {.buf = buf, .len = len};
+  struct Token tok;
+  size_t n = 0;
+  while (n < max && tokenizer_next(&t, &tok) != TOKEN_END) {
+    struct Line *l = &out[n++];
+    memset(l, 0, sizeof(*l));
+    l->type = tok.type;
+    l->line = tok.line;
+    snprintf(l->key, sizeof(l->key), "%s", tok.key);
+    if (tok.value)
+      snprintf(l->value, sizeof(l->value), "%s", tok.value);
+  }
+  return n;
+}
+
+static void check_text(const char *text) {
+  struct Line want[8], got[8];
+  size_t nwant = reference(text, want, 8);
+  size_t ngot = tokenize(text, got, 8);
+
+  cases++;
+  int same = nwant == ngot;
+  for (size_t i = 0; same && i < nwant; i++)
+    same = want[i].type == got[i].type && want[i].line == got[i].line &&
+           !strcmp(want[i].key, got[i].key) &&
+           !strcmp(want[i].value, got[i].value);
+  if (same)
+    return;
+
+  fail("tokenizer: input \"");
+  for (const char *p = text; *p && failures <= CHECK_MAX_FAILS; p++)
+    fprintf(stderr, *p == '\n' ? "\\n" : *p == '\r' ? "\\r" : "%c", *p);
+  if (failures <= CHECK_MAX_FAILS)
+    fprintf(stderr, "\": %zu lines, reference %zu\n", ngot, nwant);
+}
+
+/**
+ * Runs the tokenizer over '=' at every offset of a line, behind a first
+ * line that shifts it against the vector blocks
+ */
+static void check_tokenizer(void) {
+  static const char *const ends[] = {"\n", "\r\n", ""};
+  static const char *const fixed[] = {
+      "", "\n", "\r\n", "=", "k=", "=v", "k=v", " k = v ", "k==v",
+      "# k=v", "#k=v\nk=v", "[S]", "[S", "[S]k=v", " [ S ] \r\n",
+      "line", "line\r", "\n\n\nk=v", "k=v\n\n", "k=\rv\r\n",
+  };
+  char text[CHECK_MAX_LEN * 3];
+
+  for (size_t i = 0; i < sizeof(fixed) / sizeof(*fixed); i++)
+    check_text(fixed[i]);
+
+  for (size_t shift = 0; shift <= 33; shift++)
+    for (size_t at = 0; at < CHECK_MAX_LEN - 1; at++)
+      for (size_t e = 0; e < sizeof(ends) / sizeof(*ends); e++) {
+        size_t n = 0;
+        if (shift) {
+          memset(text, 'x', shift - 1);
+          n = shift - 1;
+          text[n++] = '\n';
+        }
+        for (size_t i = 0; i < CHECK_MAX_LEN - 1; i++)
+          text[n++] = i == at ? '=' : i % 7 == 3 ? ' ' : 'k';
+        n += snprintf(text + n, sizeof(text) - n, "%s", ends[e]);
+        // The last line again, to cross the end of the buffer
+        memcpy(text + n, text + shift, CHECK_MAX_LEN - 1);
+        n += CHECK_MAX_LEN - 1;
+        text[n] = '\0';
+        check_text(text);
+      }
+}
+
+int main(void) {
+  check_scanner("scalar", scan_scalar);
+#ifdef UTIL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    check_scanner("sse2", scan_sse2);
+  if (__builtin_cpu_supports("avx2"))
+    check_scanner("avx2", scan_avx2);
+#endif
+  check_tokenizer();
+
+  printf("check-tokenizer: %d cases, %d failed\n", cases, failures);
+  return failures != 0;
+}